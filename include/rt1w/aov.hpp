@@ -0,0 +1,37 @@
+#pragma once
+
+#include "rt1w/geometry.hpp"
+#include "rt1w/spectrum.hpp"
+#include "rt1w/utils.hpp"
+
+struct Interaction;
+struct Material;
+struct Primitive;
+
+/* Passes rendered along with the image, on request only */
+enum {
+    AOV_NORMALS = 1,
+    AOV_ALBEDO = 1 << 1,
+    AOV_DEPTH = 1 << 2,
+    AOV_PRIMITIVE_ID = 1 << 3,
+    AOV_MATERIAL_ID = 1 << 4,
+
+    /* Taken from the nearest hit among the samples of a pixel */
+    AOV_NEAREST = AOV_DEPTH | AOV_PRIMITIVE_ID | AOV_MATERIAL_ID
+};
+
+/* Values of the passes for one camera ray. The integrators only fill the requested
+ * ones, and are given no AOVSample at all when only the image is rendered. */
+struct AOVSample {
+    explicit AOVSample(uint32_t requested) : requested(requested) {}
+
+    /* Records the passes that only depend on the first hit */
+    void record(const Interaction &isect);
+
+    uint32_t requested;
+    v3f N;
+    Spectrum A;
+    float depth = (float)Infinity;
+    const Primitive *primitive = nullptr;
+    const Material *material = nullptr;
+};
@@ -2,8 +2,61 @@
 
 #include "rt1w/sptr.hpp"
 
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+/* Usage of an arena, in bytes */
+struct ArenaStats {
+    size_t blocks = 0;
+    size_t allocated = 0;
+    size_t used = 0;
+    /* Most bytes used at once since the arena was created */
+    size_t peak = 0;
+};
+
+/* Allocates by bumping a pointer in large blocks, and frees everything at once. The
+ * blocks are kept to serve the allocations that follow. The objects built in an arena
+ * are never destroyed, they mustn't own anything. */
 struct Arena : Object {
     static uptr<Arena> create();
 
-    virtual void *alloc(size_t n) = 0;
+    /* The one of the calling thread, e.g. for the temporary allocations of a job */
+    static Arena &local();
+
+    /* Position of the arena, the allocations made after it are freed by rewind().
+     * Nested marks are rewound in the reverse order they were taken. */
+    struct Mark {
+        size_t block;
+        size_t offset;
+        size_t used;
+    };
+
+    /* Aligned on 16 bytes */
+    void *alloc(size_t n) { return alloc(n, 16); }
+    /* The alignment must be a power of two */
+    virtual void *alloc(size_t n, size_t align) = 0;
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /* Default initialized, so the trivial types are left uninitialized */
+    template <typename T>
+    T *array(size_t n)
+    {
+        auto *p = static_cast<T *>(alloc(n * sizeof(T), alignof(T)));
+        std::uninitialized_default_construct_n(p, n);
+        return p;
+    }
+
+    virtual Mark mark() const = 0;
+    virtual void rewind(const Mark &mark) = 0;
+    /* Frees all the allocations */
+    virtual void reset() = 0;
+
+    virtual ArenaStats stats() const = 0;
 };
@@ -3,8 +3,7 @@
 #include "rt1w/geometry.hpp"
 #include "rt1w/sptr.hpp"
 
-#include <vector>
-
+struct Arena;
 struct Interaction;
 struct Fresnel;
 struct Spectrum;
@@ -47,8 +46,15 @@ struct BxDF : Object {
 
 #pragma mark - BSDF
 
+/* Most BxDFs a BSDF is made of */
+constexpr size_t MaxBxDFs = 8;
+
+/* The BSDFs, their BxDFs and Fresnel terms are built in an arena for each vertex of a
+ * path, usually Arena::local() which is reset after each sample */
 struct BSDF : Object {
-    static sptr<BSDF> create(const Interaction &i, const std::vector<sptr<BxDF>> &bxdfs);
+    static BSDF *create(Arena &arena, const Interaction &i);
+
+    virtual void add(const BxDF *bxdf) = 0;
 
     virtual Spectrum f(const v3f &woW,
                        const v3f &wiW,
@@ -65,20 +71,26 @@ struct BSDF : Object {
 };
 
 struct LambertianReflection : BxDF {
-    static sptr<LambertianReflection> create(const Spectrum &R);
+    static LambertianReflection *create(Arena &arena, const Spectrum &R);
 };
 
 struct SpecularReflection : BxDF {
-    static sptr<SpecularReflection> create(const Spectrum &R, uptr<Fresnel> fresnel);
+    static SpecularReflection *create(Arena &arena,
+                                      const Spectrum &R,
+                                      const Fresnel *fresnel);
 };
 
 struct SpecularTransmission : BxDF {
-    static sptr<SpecularTransmission> create(const Spectrum &T, float etaA, float etaB);
-};
-
-struct FresnelSpecular : BxDF {
-    static sptr<FresnelSpecular> create(const Spectrum &R,
+    static SpecularTransmission *create(Arena &arena,
                                         const Spectrum &T,
                                         float etaA,
                                         float etaB);
 };
+
+struct FresnelSpecular : BxDF {
+    static FresnelSpecular *create(Arena &arena,
+                                   const Spectrum &R,
+                                   const Spectrum &T,
+                                   float etaA,
+                                   float etaB);
+};
@@ -1,19 +1,87 @@
 #pragma once
 
+#include "rt1w/geometry.hpp"
 #include "rt1w/sptr.hpp"
 #include "rt1w/types.h"
 
+#include <string>
+#include <vector>
+
 struct Camera;
+struct Event;
 struct Image;
 struct Integrator;
+struct Primitive;
 struct Scene;
 
+/* Order in which the tiles of the first pass are rendered */
+enum struct TileOrder { Columns, Center, Hilbert };
+
+/* Per-pixel sums of the samples of a region, in rows. The AOVs that weren't requested
+ * are left empty. */
+struct TileSamples {
+    rect_t rect;
+    std::vector<v3f> L;
+    std::vector<v3f> N;
+    std::vector<v3f> A;
+    std::vector<float> Y2;
+    std::vector<uint32_t> count;
+    std::vector<float> depth;
+    std::vector<uint32_t> primitive;
+    std::vector<uint32_t> material;
+};
+
 struct Render : Object {
     static sptr<Render> create(const sptr<Scene> &scene,
                                const sptr<Camera> &camera,
                                const sptr<Integrator> &integrator);
 
+    /* Only the image is rendered by default, the AOV_* passes are added on request,
+     * before the first pass is scheduled. The ID passes number the primitives from 1,
+     * in the order of the list, and their materials as they come. Zero is for the
+     * pixels without any hit, which are also at zero depth. */
+    virtual void setAOVs(uint32_t aovs,
+                         const std::vector<sptr<Primitive>> &primitives = {}) = 0;
+    virtual uint32_t aovs() const = 0;
+
+    /* The passes that weren't requested are nullptr */
     virtual sptr<Image> image() const = 0;
     virtual sptr<Image> normals() const = 0;
     virtual sptr<Image> albedo() const = 0;
+    virtual sptr<Image> depth() const = 0;
+    virtual sptr<Image> primitiveIDs() const = 0;
+    virtual sptr<Image> materialIDs() const = 0;
+
+    /* Renders one more pass of samples over the whole image, accumulated with the
+     * previous ones. The images are updated once the returned event is signaled.
+     * Requesting the images without scheduling a pass first renders a single pass.
+     * The tiles are rendered with the priority of the calling thread's workq_context.
+     * Once its token is cancelled, the event is signaled early, without the samples
+     * of the tiles that weren't finished. */
+    virtual sptr<Event> schedulePass() = 0;
+    virtual uint32_t passes() const = 0;
+
+    /* Pixels whose relative standard error falls below the threshold are no longer
+     * sampled by the following passes. Zero, the default, samples every pixel. */
+    virtual void setAdaptiveThreshold(float threshold) = 0;
+    virtual size_t activePixels() const = 0;
+    virtual uint64_t samples() const = 0;
+
+    /* Must be set before the first pass is scheduled. The following passes start
+     * with the tiles that took the longest to render in the previous one. */
+    virtual void setTiles(uint32_t size, TileOrder order) = 0;
+    virtual std::vector<rect_t> tiles() = 0;
+
+    /* Renders the given pass over a region only, for the samples to be accumulated by
+     * another Render. The samples only depend on the pixel and on the pass, so the
+     * images are the same whichever process renders which region. */
+    virtual TileSamples renderRegion(const rect_t &rect, uint32_t pass) = 0;
+    virtual void accumulate(const TileSamples &samples) = 0;
+
+    /* Saves the sums of the samples and the tiles done by the current pass, which may
+     * still be rendering, replacing the file atomically. Resuming, before the first
+     * pass and with the same scene and settings, continues the render with the same
+     * images as if it had never stopped. */
+    virtual bool checkpoint(const std::string &path) = 0;
+    virtual bool resume(const std::string &path) = 0;
 };
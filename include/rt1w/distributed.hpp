@@ -0,0 +1,34 @@
+#pragma once
+
+#include "rt1w/sptr.hpp"
+
+#include <functional>
+#include <string>
+
+struct Render;
+
+/* What a worker needs to create the same Render as the coordinator */
+struct RenderSetup {
+    std::string file;
+    uint32_t quality;
+    uint32_t aovs;
+};
+
+/* Addresses are either "unix:<path>" for a Unix domain socket, or "<host>:<port>"
+ * for TCP. */
+struct Coordinator : Object {
+    static sptr<Coordinator> create(const std::string &address);
+
+    /* Hands out the tiles of the passes to the workers as they connect, and
+     * accumulates the samples they send back in render. The tiles of the workers
+     * that are lost are handed out again. Fails if no worker is connected for too
+     * long. */
+    virtual bool render(const sptr<Render> &render,
+                        const RenderSetup &setup,
+                        uint32_t passes) = 0;
+};
+
+/* Connects to the coordinator, creates the Render from the setup it sends, with
+ * the same AOVs, then renders the tiles it's given until the coordinator is done. */
+bool RenderWorker(const std::string &address,
+                  const std::function<sptr<Render>(const RenderSetup &)> &create);
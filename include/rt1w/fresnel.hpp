@@ -3,6 +3,7 @@
 #include "rt1w/geometry.hpp"
 #include "rt1w/sptr.hpp"
 
+struct Arena;
 struct Spectrum;
 
 struct Fresnel : Object {
@@ -10,11 +11,12 @@ struct Fresnel : Object {
 };
 
 struct FresnelDielectric : Fresnel {
-    static uptr<FresnelDielectric> create(float etaI, float etaT);
+    static FresnelDielectric *create(Arena &arena, float etaI, float etaT);
 };
 
 struct FresnelConductor : Fresnel {
-    static uptr<FresnelConductor> create(const Spectrum &etaI,
-                                         const Spectrum &etaT,
-                                         const Spectrum &k);
+    static FresnelConductor *create(Arena &arena,
+                                    const Spectrum &etaI,
+                                    const Spectrum &etaT,
+                                    const Spectrum &k);
 };
@@ -19,4 +19,13 @@ int32_t image_write_png(const char *filename,
                         size_t bpr);
 
 int32_t image_read_png(const char *filename, struct buffer *buf);
+
+/* Portable float map of 1 or 3 float channels per pixel, for the passes that don't
+ * fit in 8 bits */
+int32_t image_write_pfm(const char *filename,
+                        uint32_t w,
+                        uint32_t h,
+                        uint32_t channels,
+                        const void *data,
+                        size_t bpr);
 __END_DECLS
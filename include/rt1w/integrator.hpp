@@ -6,13 +6,18 @@
 #include "rt1w/task.hpp"
 
 #include <string>
+#include <vector>
 
+struct AOVSample;
+struct BSDF;
 struct Interaction;
 struct Ray;
 struct Sampler;
 struct Scene;
 
+/* Direct lighting at a vertex from one of the lights, picked at random */
 Spectrum UniformSampleOneLight(const Interaction &isect,
+                               const BSDF &bsdf,
                                const sptr<Scene> &scene,
                                const sptr<Sampler> &sampler);
 
@@ -26,13 +31,18 @@ struct Integrator : Object {
                         const sptr<Scene> &scene,
                         const sptr<Sampler> &sampler,
                         size_t depth,
-                        v3f *N = nullptr,
-                        Spectrum *A = nullptr) const = 0;
+                        AOVSample *aov = nullptr) const = 0;
 };
 
+/* Traces many paths together, stage by stage */
 struct IntegratorAsync : Integrator {
     using Integrator::Li;
+
+    /* The random numbers of each path only depend on its seed, not on the other
+     * paths of the batch. The AOVs, if any, are recorded in aovs, which must have
+     * one entry per ray and outlive the batch. */
     virtual sptr<Batch<Spectrum>> Li(const std::vector<Ray> &rays,
+                                     const std::vector<uint64_t> &seeds,
                                      const sptr<Scene> &scene,
-                                     const sptr<Sampler> &sampler) const = 0;
+                                     std::vector<AOVSample> *aovs = nullptr) const = 0;
 };
@@ -7,6 +7,9 @@
 struct Material;
 struct Primitive;
 
+/* Index of a primitive without material, e.g. of an area light */
+constexpr uint32_t NoMaterial = UINT32_MAX;
+
 struct Interaction {
     Interaction() = default;
     Interaction(v3f p) : p(p) {}
@@ -25,6 +28,8 @@ struct Interaction {
         v3f dpdv;
     } shading;
     sptr<Material> mat;
+    /* Of the material in the MaterialTable of the scene */
+    uint32_t matIndex = NoMaterial;
     sptr<Primitive> prim;
 };
 
@@ -23,6 +23,8 @@ struct VisibilityTester {
     }
 
     bool visible(const sptr<Scene> &scene) const;
+    /* The shadow ray tested by visible(), to test it with others */
+    Ray ray() const;
 
 private:
     Interaction m_p0;
@@ -55,9 +57,15 @@ struct PointLight : Light {
 };
 
 struct AreaLight : Light {
+    using Light::pdf_Li;
+
     static sptr<AreaLight> create(const sptr<Shape> &s, const Spectrum &Lemit);
     static sptr<AreaLight> create(const sptr<Params> &p);
 
+    /* pdf of sampling the point isect on the light, already found by
+     * intersecting a ray leaving ref */
+    virtual float pdf_Li(const Interaction &ref, const Interaction &isect) const = 0;
+
     virtual Spectrum L(const Interaction &isect, const v3f &w) const = 0;
     virtual sptr<Shape> shape() const = 0;
 };
@@ -3,16 +3,36 @@
 #include "rt1w/geometry.hpp"
 #include "rt1w/sptr.hpp"
 
+#include <vector>
+
+struct Arena;
 struct BSDF;
+struct Image;
 struct Ray;
 struct Interaction;
+struct MaterialTable;
 struct Params;
+struct Primitive;
 struct Spectrum;
 struct Texture;
+struct TextureRecord;
+
+#pragma mark - Flattened materials
 
-#pragma mark - Interaction
+enum MaterialOp : uint32_t {
+    MATERIAL_MATTE,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+};
 
-sptr<BSDF> ComputeBSDF(const Interaction &isect);
+/* A material flattened in a MaterialTable */
+struct MaterialRecord {
+    MaterialOp op;
+    /* Kd of the matte, albedo of the metal */
+    uint32_t texture;
+    /* Fuzz of the metal, index of refraction of the dielectric */
+    float param;
+};
 
 #pragma mark - Material Interface
 
@@ -20,7 +40,9 @@ struct Material : Object {
     static sptr<Material> create(const sptr<Params> &p);
 
     virtual Spectrum f(const Interaction &isect, const v3f &wo, const v3f &wi) const = 0;
-    virtual sptr<BSDF> computeBsdf(const Interaction &isect) const = 0;
+
+    /* Its record, after adding the ones of its textures to the table */
+    virtual MaterialRecord flatten(MaterialTable &table) const = 0;
 };
 
 struct Lambertian : Material {
@@ -37,3 +59,31 @@ struct Dielectric : Material {
     static sptr<Dielectric> create(float ri);
     static sptr<Dielectric> create(const sptr<Params> &params);
 };
+
+#pragma mark - Material Table
+
+/* The materials and textures of the primitives of a scene flattened into arrays of
+ * records, evaluated by a switch on their type instead of virtual calls. Each
+ * primitive is given the index of its material in the table, which the hits carry in
+ * Interaction::matIndex. */
+struct MaterialTable : Object {
+    static sptr<MaterialTable> create(const sptr<Primitive> &world);
+
+    /* While flattening, the index of a texture, added once, and of new records */
+    virtual uint32_t add(const sptr<Texture> &texture) = 0;
+    virtual uint32_t add(const TextureRecord &record) = 0;
+    virtual uint32_t add(const sptr<Image> &image) = 0;
+
+    virtual const std::vector<MaterialRecord> &materials() const = 0;
+    virtual const std::vector<TextureRecord> &textures() const = 0;
+
+    /* Built in the arena, nullptr without a material */
+    virtual BSDF *computeBsdf(const Interaction &isect, Arena &arena) const = 0;
+    /* Same for n hits on the material of the given index, its record is read once and
+     * each kind of material is built in its own loop */
+    virtual void computeBsdfs(uint32_t material,
+                              const Interaction *const *isects,
+                              size_t n,
+                              Arena &arena,
+                              BSDF **bsdfs) const = 0;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+/*!
+ * @brief Calls func(begin, end) for the ranges of at most grain indices that cover
+ * [0, count), on the threads of the work queue and on the calling thread, and
+ * returns once they have all returned. The calling thread takes its share of the
+ * ranges instead of only waiting, so it can be one of the threads of the queue.
+ */
+void parallel_for(size_t count,
+                  size_t grain,
+                  const std::function<void(size_t, size_t)> &func);
+
+/*!
+ * @brief Reduces the values func(begin, end) of the ranges of parallel_for() with
+ * reduce(a, b), starting from identity. The values are reduced in the order of the
+ * ranges, so the result doesn't depend on the threads that computed them.
+ */
+template <typename T, typename F, typename R>
+T parallel_reduce(size_t count,
+                  size_t grain,
+                  const T &identity,
+                  const F &func,
+                  const R &reduce)
+{
+    if (count <= grain) {
+        return count > 0 ? reduce(identity, func(0, count)) : identity;
+    }
+
+    size_t n = (count + grain - 1) / grain;
+    std::unique_ptr<T[]> values(new T[n]);
+    parallel_for(count, grain, [&](size_t begin, size_t end) {
+        values[begin / grain] = func(begin, end);
+    });
+
+    T result = identity;
+    for (size_t i = 0; i < n; ++i) {
+        result = reduce(result, values[i]);
+    }
+    return result;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "rt1w/sptr.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* Free blocks of one size and alignment, recycled instead of going back to the
+ * system. Each thread caches a few of them and trades them by batches with a shared
+ * list, since the jobs and events of the work queue are mostly freed by another
+ * thread than the one that allocated them. */
+template <size_t Size, size_t Align>
+struct BlockPool {
+    static void *allocate()
+    {
+        Cache &c = cache();
+        if (c.blocks.empty()) {
+            Shared &s = shared();
+            std::lock_guard<std::mutex> lock(s.lock);
+            auto n = (ptrdiff_t)std::min(s.blocks.size(), BatchSize);
+            c.blocks.insert(c.blocks.end(), s.blocks.end() - n, s.blocks.end());
+            s.blocks.resize(s.blocks.size() - (size_t)n);
+        }
+        if (c.blocks.empty()) {
+            return ::operator new(Size, std::align_val_t(Align));
+        }
+        void *block = c.blocks.back();
+        c.blocks.pop_back();
+        return block;
+    }
+
+    static void deallocate(void *block)
+    {
+        Cache &c = cache();
+        c.blocks.push_back(block);
+        if (c.blocks.size() > CacheSize) {
+            Shared &s = shared();
+            std::lock_guard<std::mutex> lock(s.lock);
+            auto n = (ptrdiff_t)BatchSize;
+            s.blocks.insert(s.blocks.end(), c.blocks.end() - n, c.blocks.end());
+            c.blocks.resize(c.blocks.size() - BatchSize);
+        }
+    }
+
+private:
+    static constexpr size_t CacheSize = 256;
+    static constexpr size_t BatchSize = 64;
+
+    struct Shared {
+        std::mutex lock;
+        std::vector<void *> blocks;
+    };
+
+    struct Cache {
+        Cache() { blocks.reserve(CacheSize + 1); }
+        ~Cache()
+        {
+            Shared &s = shared();
+            std::lock_guard<std::mutex> lock(s.lock);
+            s.blocks.insert(s.blocks.end(), blocks.begin(), blocks.end());
+        }
+
+        std::vector<void *> blocks;
+    };
+
+    /* Never destroyed, the threads still running at exit give their blocks back */
+    static Shared &shared()
+    {
+        static auto *s = new Shared;
+        return *s;
+    }
+
+    static Cache &cache()
+    {
+        static thread_local Cache c;
+        return c;
+    }
+};
+
+/* Allocates the objects one at a time from a BlockPool, e.g. for allocate_shared() */
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &)
+    {}
+
+    T *allocate(size_t n)
+    {
+        if (n == 1) {
+            return (T *)BlockPool<sizeof(T), alignof(T)>::allocate();
+        }
+        return (T *)::operator new(n * sizeof(T), std::align_val_t(alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n == 1) {
+            BlockPool<sizeof(T), alignof(T)>::deallocate(p);
+            return;
+        }
+        ::operator delete(p, std::align_val_t(alignof(T)));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const
+    {
+        return false;
+    }
+};
+
+/* Same as make_shared(), with the object and its reference counts in a pooled block */
+template <typename T, typename... Args>
+inline sptr<T> make_pooled(Args &&...args)
+{
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
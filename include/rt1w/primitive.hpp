@@ -25,6 +25,13 @@ struct Primitive : Object {
 
     virtual bounds3f bounds() const = 0;
     virtual sptr<AreaLight> light() const = 0;
+    virtual sptr<Material> material() const = 0;
+    /* Edits the material without rebuilding the accelerators holding the primitive.
+     * Only while nothing is being rendered. */
+    virtual void setMaterial(const sptr<Material> &material) = 0;
+    /* Index of its material in the MaterialTable of the scene, set when the table is
+     * created */
+    virtual void setMaterialIndex(uint32_t index) = 0;
 
     virtual bool intersect(const Ray &r, Interaction &isect) const = 0;
     virtual bool qIntersect(const Ray &r) const = 0;
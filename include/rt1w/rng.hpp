@@ -3,8 +3,25 @@
 constexpr float OneMinusEpsilon_f32 = 0.99999994f;
 constexpr double OneMinusEpsilon_f64 = 0.99999999999999989;
 
+/* The state of an RNG by value, for arrays of generators with one per path. It draws
+ * the same numbers as the RNG created with the same seed. */
+struct RNGState {
+    RNGState(uint64_t seed = 0);
+
+    uint32_t u32();
+    float f32();
+
+    uint32_t u32(uint32_t bound);
+    float f32(float bound);
+
+    uint64_t s[4];
+};
+
 struct RNG : Object {
     static uptr<RNG> create();
+    static uptr<RNG> create(uint64_t seed);
+
+    virtual void seed(uint64_t seed) = 0;
 
     virtual uint32_t u32() = 0;
     virtual float f32() = 0;
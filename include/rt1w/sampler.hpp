@@ -9,6 +9,10 @@ struct Sampler : Object {
 
     virtual uint64_t samplesPerPixel() const = 0;
     virtual sptr<Sampler> clone() const = 0;
+    /* The samples of the clone only depend on the seed and on the pixel */
+    virtual sptr<Sampler> clone(uint64_t seed) const = 0;
+    /* Same samples as a clone with this seed from now on, without allocating */
+    virtual void seed(uint64_t seed) = 0;
 
     virtual float sample1D() = 0;
     virtual v2f sample2D() = 0;
@@ -6,6 +6,19 @@ v2f UniformSampleDisk(const v2f &u);
 v3f UniformSampleSphere(const v2f &u);
 v2f UniformSampleTriangle(const v2f &u);
 
+v3f UniformSampleCone(const v2f &u, float cosThetaMax);
+float UniformConePdf(float cosThetaMax);
+
+/* Solid angle subtended by the spherical triangle of unit vectors a, b & c */
+float SphericalTriangleArea(const v3f &a, const v3f &b, const v3f &c);
+
+/* Arvo's uniform sampling of the solid angle subtended by triangle v as seen from p.
+ * Returns the barycentric coordinates of the sampled point and sets pdf (1/sr),
+ * pdf is 0 if the triangle is degenerate as seen from p. */
+v3f SampleSphericalTriangle(const v3f v[3], const v3f &p, const v2f &u, float &pdf);
+/* Whether the pdf set by SampleSphericalTriangle() is positive */
+bool CanSampleSphericalTriangle(const v3f v[3], const v3f &p);
+
 v3f CosineSampleHemisphere(const v2f &u);
 float CosineHemispherePdf(float cosTheta);
 
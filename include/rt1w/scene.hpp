@@ -2,7 +2,9 @@
 
 #include "rt1w/geometry.hpp"
 #include "rt1w/sptr.hpp"
+#include "rt1w/task.hpp"
 
+#include <string>
 #include <vector>
 
 template <typename T>
@@ -10,22 +12,40 @@ struct Batch;
 struct Camera;
 struct Interaction;
 struct Light;
+struct MaterialTable;
 struct MeshData;
 struct Params;
 struct Primitive;
 struct Ray;
 
-struct RenderDescription : Object {
+/* Scheduling a description loads what its textures read from, which isn't needed
+ * before rendering, e.g. the images are still decoded while the accelerator is
+ * built. */
+struct RenderDescription : Task {
     static sptr<RenderDescription> create(const std::vector<sptr<Primitive>> &primitives,
                                           const std::vector<sptr<Light>> &lights,
                                           const sptr<Camera> &camera,
                                           const sptr<Params> &options);
+    /* The textures, shapes and primitives are loaded in parallel on the work queue,
+     * each primitive as soon as its shape is. Returns once the primitives are
+     * created, the images of the textures are decoded in the meantime. */
     static sptr<RenderDescription> load(const std::string &path);
 
     virtual const std::vector<sptr<Primitive>> &primitives() const = 0;
     virtual const std::vector<sptr<Light>> &lights() const = 0;
     virtual sptr<Camera> camera() const = 0;
     virtual sptr<const Params> options() const = 0;
+
+    /* Camera of each frame of the sequence, empty unless the scene has one */
+    virtual const std::vector<sptr<Camera>> &cameras() const = 0;
+
+    /* Edits, given as JSON in the format of the scene files: the camera object, a
+     * material replacing the one of the same name in the primitives, or the list of
+     * lights, whose area lights replace the previous ones in the primitives. Invalid
+     * edits leave the description unchanged. Only while nothing is being rendered. */
+    virtual bool setCamera(const std::string &json) = 0;
+    virtual bool setMaterial(const std::string &json) = 0;
+    virtual bool setLights(const std::string &json) = 0;
 };
 
 struct Scene : Object {
@@ -35,9 +55,18 @@ struct Scene : Object {
     virtual bounds3f bounds() const = 0;
     virtual const std::vector<sptr<Light>> &lights() const = 0;
 
+    /* The materials of the primitives, flattened when the scene is created and again
+     * by updateMaterials() once they were edited. Only while nothing is being
+     * rendered. */
+    virtual const MaterialTable &materials() const = 0;
+    virtual void updateMaterials() = 0;
+
     virtual bool intersect(const Ray &r, Interaction &isect) const = 0;
     virtual bool qIntersect(const Ray &r) const = 0;
 
+    /* The rays are intersected in parallel on the work queue once the batch is
+     * scheduled. Rays that miss keep the default t of -Infinity. qIntersect() only
+     * sets t, to 0 for the rays that are occluded. */
     virtual sptr<Batch<Interaction>> intersect(const std::vector<Ray> &rays) const = 0;
     virtual sptr<Batch<Interaction>> qIntersect(const std::vector<Ray> &rays) const = 0;
 };
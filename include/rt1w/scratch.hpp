@@ -0,0 +1,36 @@
+#pragma once
+
+#include "rt1w/sptr.hpp"
+#include "rt1w/types.h"
+
+struct Arena;
+struct Sampler;
+
+/* Work done by the threads */
+struct ScratchStats {
+    uint64_t tiles = 0;
+    uint64_t samples = 0;
+    /* Samplers allocated, the others were reused */
+    uint64_t samplers = 0;
+};
+
+/* State kept by each thread across the jobs it executes, e.g. by a worker of the work
+ * queue for all the tiles it renders, rather than set up again by each job. Only used
+ * from its own thread. */
+struct Scratch : Object {
+    /* The one of the calling thread */
+    static Scratch &get();
+
+    /* Sums of the counters of all the threads, including the ones that exited */
+    static ScratchStats stats();
+
+    /* A sampler like the prototype, seeded as by clone(seed). The same one is
+     * returned each time for the same prototype, until another is requested. */
+    virtual const sptr<Sampler> &sampler(const sptr<const Sampler> &prototype,
+                                         uint64_t seed) = 0;
+
+    /* Arena::local(), for the temporary allocations of a sample, reset after each */
+    virtual Arena &arena() = 0;
+
+    virtual void count(uint64_t tiles, uint64_t samples) = 0;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "rt1w/sptr.hpp"
+
+#include <functional>
+#include <string>
+
+struct Render;
+struct RenderDescription;
+struct Scene;
+
+/* Keeps a scene loaded, with its accelerator built, across the edits of a look-dev
+ * session. The commands, one per line, with their JSON on the same line, are:
+ *   camera <object>      replaces the camera
+ *   material <object>    replaces the material of the same name
+ *   lights <array>       replaces the lights
+ *   render [<passes>]    renders one or more passes, added to the previous ones
+ *   write <path>         writes the image as PNG
+ *   quit
+ * An edit restarts the render, only the lights with a shape rebuild the accelerator.
+ */
+struct RenderServer : Object {
+    /* create makes the Render of the scene with the camera of the description */
+    static sptr<RenderServer> create(
+        const sptr<RenderDescription> &desc,
+        const std::function<sptr<Render>(const sptr<RenderDescription> &,
+                                         const sptr<Scene> &)> &create);
+
+    /* Returns the reply, "ok" or "error" followed by details */
+    virtual std::string execute(const std::string &command) = 0;
+    virtual bool done() const = 0;
+
+    virtual sptr<Scene> scene() const = 0;
+    virtual sptr<Render> render() = 0;
+};
+
+/* Runs the commands read from in, replying to out, until "quit" or the end of the
+ * input */
+void Serve(const sptr<RenderServer> &server, int in, int out);
+
+/* Runs the commands of the clients connecting to the Unix domain socket at the
+ * address, unix:<path>, one after the other until one sends "quit" */
+bool Serve(const sptr<RenderServer> &server, const std::string &address);
@@ -25,6 +25,10 @@ struct Shape : Object {
 
     virtual Interaction sample(const Interaction &ref, const v2f &u) const = 0;
     virtual float pdf(const Interaction &ref, const v3f &wi) const = 0;
+
+    /* Same as pdf(ref, wi), with isect being the point where the ray leaving ref
+     * along wi hits the shape. It saves intersecting the shape again. */
+    virtual float pdf(const Interaction &ref, const Interaction &isect) const = 0;
 };
 
 struct Group : Shape {
@@ -1,14 +1,48 @@
 #pragma once
 
 #include "rt1w/geometry.hpp"
+#include "rt1w/spectrum.hpp"
 #include "rt1w/sptr.hpp"
+#include "rt1w/task.hpp"
 #include "rt1w/types.h"
 
+#include <vector>
+
 struct Image;
+struct MaterialTable;
 struct Params;
-struct Spectrum;
 
-struct Texture : Object {
+#pragma mark - Flattened textures
+
+enum TextureOp : uint32_t {
+    TEXTURE_CONSTANT,
+    TEXTURE_CHECKER,
+    TEXTURE_IMAGE,
+};
+
+/* A texture flattened in a MaterialTable, which refers to the textures and images
+ * it reads from by their index in the table */
+struct TextureRecord {
+    TextureOp op;
+    uint32_t odd;
+    uint32_t even;
+    uint32_t image;
+    Spectrum color;
+    rect_t rect;
+};
+
+/* Value of the texture at index in the records, the checkers are followed in a loop
+ * down to a constant or an image */
+Spectrum EvaluateTexture(const std::vector<TextureRecord> &textures,
+                         const std::vector<sptr<Image>> &images,
+                         uint32_t index,
+                         float u,
+                         float v);
+
+#pragma mark - Texture
+
+/* Scheduling a texture loads what it reads from, e.g. decodes its image */
+struct Texture : Task {
     static sptr<Texture> create(const sptr<Params> &params);
 
     static sptr<Texture> create_color(const Spectrum &s);
@@ -16,4 +50,7 @@ struct Texture : Object {
     static sptr<Texture> create_image(const sptr<Image> &img, rect_t r);
 
     virtual Spectrum value(float u, float v, const v3f &p) const = 0;
+
+    /* Adds its record to the table, after the ones of the textures it reads from */
+    virtual uint32_t flatten(MaterialTable &table) const = 0;
 };
@@ -3,21 +3,136 @@
 #include "rt1w/sptr.hpp"
 #include "rt1w/types.h"
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 struct workq;
 struct Event;
 
 typedef void (*workq_func)(const sptr<Object> &, const sptr<Object> &);
+typedef void (*workq_func_n)(const sptr<Object> &, size_t);
+
+/* Indices [begin, end) handled by one of the jobs of workq_execute_ranges() */
+struct WorkRange : Object {
+    WorkRange(size_t begin, size_t end) : begin(begin), end(end) {}
+
+    size_t begin;
+    size_t end;
+};
+
+/* The threads start the interactive jobs queued before the batch ones */
+enum workq_priority {
+    WORKQ_PRIORITY_BATCH = 0,
+    WORKQ_PRIORITY_INTERACTIVE,
+    WORKQ_PRIORITIES
+};
+
+/* Shared by the jobs of some work, e.g. a preview, that may be given up on */
+struct CancelToken : Object {
+    void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> m_cancelled{ false };
+};
+
+/* Priority and token of the jobs submitted by a thread. A job is executed in the
+ * context it was submitted in, and so are the continuations of an event in the
+ * context they were added in, so the work they submit in turn inherits it. */
+struct workq_context {
+    workq_priority priority = WORKQ_PRIORITY_BATCH;
+    sptr<CancelToken> token;
+};
+
+/* Setup of the threads of the queue returned by workq_get_queue() */
+struct workq_config {
+    /* Number of threads, zero for one per CPU allowed */
+    uint32_t threads = 0;
+
+    /* CPUs the threads are pinned to, one each in turn, as a list like "0-3,8",
+     * or empty for any */
+    std::string cpus;
+
+    /* NUMA node whose CPUs run the threads, or -1 for any */
+    int32_t node = -1;
+};
+
+/*!
+ * @brief Sets up the threads of the queue returned by workq_get_queue(), which
+ * must not have been called yet. The calling thread is moved to the CPUs of the
+ * queue too, so the memory it first touches, e.g. while loading the scene and
+ * building the BVH, is local to the threads. Pinning is only supported on Linux.
+ * @returns false if the setup is invalid or the queue is already running.
+ */
+bool workq_configure(const workq_config &config);
+
+/*!
+ * @brief Creates a work queue with its own threads, set up as in workq_configure()
+ * except for the calling thread, which is left alone.
+ * @returns NULL if the setup is invalid.
+ */
+struct workq *workq_create(const workq_config &config);
+
+/*!
+ * @brief Waits for the jobs left to be executed, then stops the threads of a
+ * queue returned by workq_create() and frees it. Nothing may be submitted to the
+ * queue meanwhile.
+ */
+void workq_destroy(struct workq *workq);
+
+/*!
+ * @brief Returns the number of NUMA nodes of the machine.
+ */
+uint32_t workq_numa_nodes();
 
 /*!
  * @brief Returns an unspecified work queue.
  */
 struct workq *workq_get_queue();
 
+/*!
+ * @brief Returns the number of threads executing the jobs of the work queue.
+ */
+uint32_t workq_concurrency(struct workq *workq);
+
+/*!
+ * @brief Returns, for each thread of the work queue, the number of seconds
+ * spent executing jobs since the queue was created. The difference between
+ * two calls and the time elapsed in between gives the idle time of each thread.
+ */
+std::vector<double> workq_busy_times(struct workq *workq);
+
+/*!
+ * @brief Sets the context of the jobs submitted by the calling thread from now on.
+ * @returns The previous context, to be restored once the work is submitted.
+ */
+workq_context workq_set_context(const workq_context &context);
+
+/*!
+ * @brief Returns the context of the calling thread, which is the one of the job
+ * being executed when called from a job.
+ */
+workq_context workq_get_context();
+
+/*!
+ * @brief Returns true if the token of the calling thread's context was cancelled.
+ * Long jobs check it from time to time to return early.
+ */
+bool workq_cancelled();
+
 /*!
  * @brief Request the function func to be called on the specified
  * work queue. If workq is NULL then the function will be called
  * immediately on the current thread. Both obj & arg are retained
- * until the command is executed.
+ * until the command is executed. When called from one of the threads of
+ * the queue, e.g. by a job, the job is pushed to the thread's own deque:
+ * the thread executes it next, unless an idle thread steals it first.
+ * The jobs submitted from other threads are started in order. The jobs of
+ * higher priority are started first, see workq_context. A job whose token is
+ * cancelled before it starts isn't executed, but its event is still signaled,
+ * and so are the events depending on it. The function is always called when
+ * workq is NULL.
  * @param wqeue The work queue on which the function will be executed.
  * @param func The function to execute: func(obj, arg).
  * @param obj The first argument to func.
@@ -33,3 +148,28 @@ void workq_execute(struct workq *workq,
                    workq_func func,
                    const sptr<Object> &obj,
                    const sptr<Object> &arg);
+
+/*!
+ * @brief Splits the indices [0, count) in ranges of at most grain indices, and
+ * requests func(obj, range) to be called for each range, a WorkRange, on the
+ * specified work queue.
+ * @returns An event that signals once func has returned for all the ranges.
+ */
+sptr<Event> workq_execute_ranges(struct workq *workq,
+                                 size_t count,
+                                 size_t grain,
+                                 workq_func func,
+                                 const sptr<Object> &obj);
+
+/*!
+ * @brief Requests func(obj, i) to be called for each index i in [0, count) on
+ * the specified work queue, or on the current thread if workq is NULL. The
+ * indices are claimed in order by one job per thread of the queue, so nothing
+ * is allocated per index. The function is called for all the indices even once
+ * cancelled, it checks workq_cancelled() to skip its work.
+ * @returns An event that signals once func has returned for all the indices.
+ */
+sptr<Event> workq_execute_n(struct workq *workq,
+                            size_t count,
+                            workq_func_n func,
+                            const sptr<Object> &obj);
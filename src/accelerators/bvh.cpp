@@ -51,6 +51,9 @@ struct _BVHAccelerator : BVHAccelerator {
     bool qIntersect(const Ray &r) const override;
     bounds3f bounds() const override { return m_bounds; }
     sptr<AreaLight> light() const override;
+    sptr<Material> material() const override;
+    void setMaterial(const sptr<Material> &) override;
+    void setMaterialIndex(uint32_t) override;
 
     const std::vector<sptr<Primitive>> &primitives() const override { return m_prims; }
 
@@ -67,6 +70,21 @@ sptr<AreaLight> _BVHAccelerator::light() const
     trap("BVHAccelerator::light() should never be called");
 }
 
+sptr<Material> _BVHAccelerator::material() const
+{
+    trap("BVHAccelerator::material() should never be called");
+}
+
+void _BVHAccelerator::setMaterial(const sptr<Material> &)
+{
+    trap("BVHAccelerator::setMaterial() should never be called");
+}
+
+void _BVHAccelerator::setMaterialIndex(uint32_t)
+{
+    trap("BVHAccelerator::setMaterialIndex() should never be called");
+}
+
 void _BVHAccelerator::init(const std::vector<sptr<Primitive>> &prims)
 {
     auto builder = BVHBuilder(prims);
@@ -2,14 +2,41 @@
 
 #include "rt1w/arena.hpp"
 #include "rt1w/error.h"
+#include "rt1w/parallel.hpp"
 #include "rt1w/primitive.hpp"
 
+/* Primitives handled by each job when computing their bounds in parallel */
+constexpr size_t BoundsGrain = 4096;
+
 struct BVHPrimInfo {
     size_t index;
     bounds3f bounds;
     v3f center;
 };
 
+struct BVHNodeBounds {
+    bounds3f bounds;
+    bounds3f centers;
+};
+
+/* Bounds of the primitives [bgn, end) and of their centers, computed in parallel for
+ * the nodes at the top of the tree */
+static BVHNodeBounds ComputeBounds(const BVHPrimInfo *info, size_t bgn, size_t end)
+{
+    auto range = [&](size_t b, size_t e) {
+        BVHNodeBounds r;
+        for (size_t i = bgn + b; i < bgn + e; i++) {
+            r.bounds = Union(r.bounds, info[i].bounds);
+            r.centers = Union(r.centers, info[i].center);
+        }
+        return r;
+    };
+    auto unite = [](const BVHNodeBounds &a, const BVHNodeBounds &b) {
+        return BVHNodeBounds{ Union(a.bounds, b.bounds), Union(a.centers, b.centers) };
+    };
+    return parallel_reduce(end - bgn, BoundsGrain, BVHNodeBounds(), range, unite);
+}
+
 static BVHBuildNode *BuildNode(Arena *arena,
                                const std::vector<sptr<Primitive>> &prims,
                                BVHPrimInfo *info,
@@ -23,11 +50,14 @@ BVHBuilder::BVHBuilder(const std::vector<sptr<Primitive>> &prims)
     m_arena = Arena::create();
 
     /* Get info for each primtive */
-    BVHPrimInfo *info = (BVHPrimInfo *)m_arena->alloc(prims.size() * sizeof(*info));
-    for (size_t i = 0; i < prims.size(); ++i) {
-        bounds3f b = prims[i]->bounds();
-        info[i] = { i, b, b.center() };
-    }
+    void *mem = m_arena->alloc(prims.size() * sizeof(BVHPrimInfo), alignof(BVHPrimInfo));
+    auto *info = static_cast<BVHPrimInfo *>(mem);
+    parallel_for(prims.size(), BoundsGrain, [&](size_t bgn, size_t end) {
+        for (size_t i = bgn; i < end; ++i) {
+            bounds3f b = prims[i]->bounds();
+            new (&info[i]) BVHPrimInfo{ i, b, b.center() };
+        }
+    });
 
     /* Build tree structure */
     size_t count = 0;
@@ -45,14 +75,12 @@ BVHBuildNode *BuildNode(Arena *arena,
                         size_t &node_count,
                         std::vector<sptr<Primitive>> &ordered)
 {
-    BVHBuildNode *node = (BVHBuildNode *)arena->alloc(sizeof(*node));
+    auto *node = arena->make<BVHBuildNode>();
     node_count += 1;
 
     /* Calculate bounds for the primitives */
-    bounds3f bounds;
-    for (size_t i = bgn; i < end; i++) {
-        bounds = Union(bounds, info[i].bounds);
-    }
+    BVHNodeBounds nb = ComputeBounds(info, bgn, end);
+    const bounds3f &bounds = nb.bounds;
 
     /* Build a leaf node if there's only one primitive */
     size_t n = end - bgn;
@@ -66,10 +94,7 @@ BVHBuildNode *BuildNode(Arena *arena,
         return node;
     }
 
-    bounds3f centerBounds;
-    for (size_t i = bgn; i < end; i++) {
-        centerBounds = Union(centerBounds, info[i].center);
-    }
+    const bounds3f &centerBounds = nb.centers;
     auto axis = (size_t)centerBounds.maxAxis();
 
     /* Partition the primitives into two subsets using the SAH heuristic */
@@ -92,6 +92,9 @@ struct _QBVHAccelerator : QBVHAccelerator {
     bool qIntersect(const Ray &r) const override;
     bounds3f bounds() const override { return m_bounds; }
     sptr<AreaLight> light() const override;
+    sptr<Material> material() const override;
+    void setMaterial(const sptr<Material> &) override;
+    void setMaterialIndex(uint32_t) override;
 
     const std::vector<sptr<Primitive>> &primitives() const override { return m_prims; }
 
@@ -120,6 +123,21 @@ sptr<AreaLight> _QBVHAccelerator::light() const
     trap("QBVHAccelerator::light() should never be called");
 }
 
+sptr<Material> _QBVHAccelerator::material() const
+{
+    trap("QBVHAccelerator::material() should never be called");
+}
+
+void _QBVHAccelerator::setMaterial(const sptr<Material> &)
+{
+    trap("QBVHAccelerator::setMaterial() should never be called");
+}
+
+void _QBVHAccelerator::setMaterialIndex(uint32_t)
+{
+    trap("QBVHAccelerator::setMaterialIndex() should never be called");
+}
+
 void _QBVHAccelerator::flattenBVH(const BVHBuildNode *root)
 {
     ASSERT(root);
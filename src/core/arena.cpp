@@ -2,77 +2,127 @@
 
 #include "rt1w/error.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 constexpr size_t cache_line_size = 64;
 constexpr size_t extra_alloc_size = 256 * 1024;
 
-struct hdr {
-    struct hdr *prev;
-    uint8_t *next;
-    uint8_t *limit;
+struct block {
+    uint8_t *mem;
+    size_t size;
 };
 
+static inline uint8_t *Align(uint8_t *p, size_t align)
+{
+    return (uint8_t *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
 struct _Arena : Arena {
-    _Arena();
     ~_Arena() override;
 
-    void *alloc(size_t n) override;
+    using Arena::alloc;
+    void *alloc(size_t n, size_t align) override;
+
+    Mark mark() const override;
+    void rewind(const Mark &mark) override;
+    void reset() override;
+
+    ArenaStats stats() const override;
+
+    void next(size_t n);
 
-    struct hdr *m_hdr;
-    struct {
-        size_t count = 0;
-        size_t allocated = 0;
-        size_t used = 0;
-    } m_info;
+    std::vector<block> m_blocks;
+    size_t m_block = 0;
+    uint8_t *m_next = nullptr;
+    uint8_t *m_limit = nullptr;
+
+    size_t m_allocated = 0;
+    size_t m_used = 0;
+    size_t m_peak = 0;
 };
 
-_Arena::_Arena()
+_Arena::~_Arena()
 {
-    m_hdr = (struct hdr *)malloc(sizeof(*m_hdr));
-    m_hdr->prev = nullptr;
-    m_hdr->next = nullptr;
-    m_hdr->limit = nullptr;
+    for (const block &b : m_blocks) {
+        ::operator delete(b.mem, std::align_val_t(cache_line_size));
+    }
 }
 
-_Arena::~_Arena()
+/* Moves to the block after the current one, a new one unless the next one is large
+ * enough. The blocks start on a cache line, large enough for n bytes aligned on one. */
+void _Arena::next(size_t n)
 {
-    struct hdr *h = m_hdr;
-    while (h) {
-        struct hdr *tmp = h->prev;
-        free(h);
-        h = tmp;
+    size_t size = n + cache_line_size;
+    size_t i = m_blocks.empty() ? 0 : m_block + 1;
+    if (i == m_blocks.size() || m_blocks[i].size < size) {
+        size = std::max(size, extra_alloc_size);
+        auto *mem = (uint8_t *)::operator new(size, std::align_val_t(cache_line_size));
+        m_blocks.insert(m_blocks.begin() + (ptrdiff_t)i, { mem, size });
+        m_allocated += size;
     }
+    m_block = i;
+    m_next = m_blocks[i].mem;
+    m_limit = m_next + m_blocks[i].size;
 }
 
-void *_Arena::alloc(size_t n)
+void *_Arena::alloc(size_t n, size_t align)
 {
-    /* Round up n so it's 16-byte aligned */
-    n = ((n + 15) & (size_t)(~15));
+    ASSERT(align > 0 && (align & (align - 1)) == 0);
 
-    if (!(m_hdr->next && m_hdr->limit) || size_t(m_hdr->limit - m_hdr->next) < n) {
-        size_t s = n + extra_alloc_size;
-        struct hdr *p = (struct hdr *)malloc(sizeof(*p) + s);
-
-        /* Keep track of allocations */
-        m_info.count += 1;
-        m_info.allocated += s;
+    if (!m_next || (uintptr_t)Align(m_next, align) + n > (uintptr_t)m_limit) {
+        next(n + align);
+    }
+    uint8_t *p = Align(m_next, align);
+    m_used += (size_t)(p + n - m_next);
+    m_peak = std::max(m_peak, m_used);
+    m_next = p + n;
+    return p;
+}
 
-        /* Align usable memory after the header */
-        void *aligned = (void *)(p + 1);
-        std::align(cache_line_size, s, aligned, s);
+Arena::Mark _Arena::mark() const
+{
+    if (m_blocks.empty()) {
+        return { 0, 0, 0 };
+    }
+    return { m_block, (size_t)(m_next - m_blocks[m_block].mem), m_used };
+}
 
-        *p = *m_hdr;
-        m_hdr->prev = p;
-        m_hdr->next = (uint8_t *)aligned;
-        m_hdr->limit = m_hdr->next + s;
+void _Arena::rewind(const Mark &mark)
+{
+    if (m_blocks.empty()) {
+        return;
     }
-    void *p = m_hdr->next;
-    m_hdr->next += n;
-    m_info.used += n;
+    ASSERT(mark.block < m_blocks.size());
+    m_block = mark.block;
+    m_next = m_blocks[m_block].mem + mark.offset;
+    m_limit = m_blocks[m_block].mem + m_blocks[m_block].size;
+    m_used = mark.used;
+}
 
-    return p;
+void _Arena::reset()
+{
+    rewind({ 0, 0, 0 });
+}
+
+ArenaStats _Arena::stats() const
+{
+    ArenaStats s;
+    s.blocks = m_blocks.size();
+    s.allocated = m_allocated;
+    s.used = m_used;
+    s.peak = m_peak;
+    return s;
 }
 
 uptr<Arena> Arena::create()
 {
     return std::make_unique<_Arena>();
 }
+
+Arena &Arena::local()
+{
+    static thread_local _Arena arena;
+    return arena;
+}
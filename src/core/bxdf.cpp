@@ -1,5 +1,7 @@
 #include "rt1w/bxdf.hpp"
 
+#include "rt1w/arena.hpp"
+#include "rt1w/error.h"
 #include "rt1w/fresnel.hpp"
 #include "rt1w/interaction.hpp"
 #include "rt1w/rng.hpp"
@@ -7,8 +9,6 @@
 #include "rt1w/spectrum.hpp"
 #include "rt1w/utils.hpp"
 
-#include <vector>
-
 bool Refract(const v3f &wi, const v3f &n, float eta, v3f &wt)
 {
     float cosThetaI = Dot(wi, n);
@@ -32,12 +32,11 @@ inline bool SameHemisphere(const v3f &w, const v3f &wp)
 #pragma mark - BSDF
 
 struct _BSDF : BSDF {
-    _BSDF(const Interaction &i, const std::vector<sptr<BxDF>> &bxdfs) :
+    _BSDF(const Interaction &i) :
         m_ng(i.n),
         m_ns(i.shading.n),
         m_ss(Normalize(i.shading.dpdu)),
-        m_ts(Cross(m_ns, m_ss)),
-        m_bxdfs(bxdfs)
+        m_ts(Cross(m_ns, m_ss))
     {
         ASSERT(!HasNaN(m_ng));
         ASSERT(!HasNaN(m_ns));
@@ -45,6 +44,7 @@ struct _BSDF : BSDF {
         ASSERT(!HasNaN(m_ts));
     }
 
+    void add(const BxDF *bxdf) override;
     Spectrum f(const v3f &woW, const v3f &wiW, BxDFType flags) const override;
     Spectrum sample_f(const v3f &woW,
                       const v2f &u,
@@ -59,9 +59,16 @@ struct _BSDF : BSDF {
 
     v3f m_ng;
     v3f m_ns, m_ss, m_ts;
-    std::vector<sptr<BxDF>> m_bxdfs;
+    size_t m_count = 0;
+    const BxDF *m_bxdfs[MaxBxDFs];
 };
 
+void _BSDF::add(const BxDF *bxdf)
+{
+    ASSERT(m_count < MaxBxDFs);
+    m_bxdfs[m_count++] = bxdf;
+}
+
 Spectrum _BSDF::f(const v3f &woW, const v3f &wiW, BxDFType flags) const
 {
     /* Convert woW and wiW from world to local coordinates */
@@ -74,7 +81,8 @@ Spectrum _BSDF::f(const v3f &woW, const v3f &wiW, BxDFType flags) const
     bool reflect = Dot(woW, m_ng) * Dot(wiW, m_ng) > .0f;
 
     Spectrum f;
-    for (const auto &bxdf : m_bxdfs) {
+    for (size_t i = 0; i < m_count; ++i) {
+        const BxDF *bxdf = m_bxdfs[i];
         BxDFType type = bxdf->type();
         if (bxdf->matchesFlags(flags)
             && ((reflect && (type & BSDF_REFLECTION))
@@ -96,21 +104,21 @@ Spectrum _BSDF::sample_f(const v3f &woW,
     v3f wo = worldToLocal(woW);
 
     /* Get bxdfs matching flags */
-    std::vector<sptr<BxDF>> v;
-    for (const auto &bxdf : m_bxdfs) {
-        if (bxdf->matchesFlags(flags)) {
-            v.push_back(bxdf);
+    const BxDF *v[MaxBxDFs];
+    size_t n = 0;
+    for (size_t i = 0; i < m_count; ++i) {
+        if (m_bxdfs[i]->matchesFlags(flags)) {
+            v[n++] = m_bxdfs[i];
         }
     }
-    if (v.empty()) {
+    if (n == 0) {
         pdf = .0f;
         return {};
     }
 
     /* Randomly chose a BxDF to sample */
-    size_t n = v.size();
     size_t ix = std::min((size_t)std::floor(u.x * n), n - 1);
-    sptr<BxDF> bxdf = v[ix];
+    const BxDF *bxdf = v[ix];
 
     /* Remap u */
     v2f uRemap = { u.x * n - ix, u.y };
@@ -126,16 +134,17 @@ Spectrum _BSDF::sample_f(const v3f &woW,
     wiW = localToWorld(wi);
     if (!(bxdf->type() & BSDF_SPECULAR) && n > 1) {
         /* Compute pdf */
-        for (const auto &other : v) {
-            if (bxdf != other) {
-                pdf += other->pdf(wo, wi);
+        for (size_t i = 0; i < n; ++i) {
+            if (v[i] != bxdf) {
+                pdf += v[i]->pdf(wo, wi);
             }
         }
         pdf /= n;
 
         /* Compute f */
         bool reflect = Dot(woW, m_ng) * Dot(wiW, m_ng) > .0f;
-        for (const auto &other : m_bxdfs) {
+        for (size_t i = 0; i < m_count; ++i) {
+            const BxDF *other = m_bxdfs[i];
             BxDFType type = other->type();
             if (other != bxdf && other->matchesFlags(flags)
                 && ((reflect && (type & BSDF_REFLECTION))
@@ -150,7 +159,7 @@ Spectrum _BSDF::sample_f(const v3f &woW,
 
 float _BSDF::pdf(const v3f &woW, const v3f &wiW, BxDFType flags) const
 {
-    if (m_bxdfs.empty()) {
+    if (m_count == 0) {
         return .0f;
     }
     v3f wo = worldToLocal(woW);
@@ -162,10 +171,10 @@ float _BSDF::pdf(const v3f &woW, const v3f &wiW, BxDFType flags) const
 
     float pdf = .0f;
     int32_t n = 0;
-    for (const auto &bxdf : m_bxdfs) {
-        if (bxdf->matchesFlags(flags)) {
+    for (size_t i = 0; i < m_count; ++i) {
+        if (m_bxdfs[i]->matchesFlags(flags)) {
             ++n;
-            pdf += bxdf->pdf(wo, wi);
+            pdf += m_bxdfs[i]->pdf(wo, wi);
         }
     }
     return n > 0 ? pdf / n : .0f;
@@ -185,9 +194,9 @@ v3f _BSDF::worldToLocal(const v3f &v) const
     return { Dot(v, m_ss), Dot(v, m_ts), Dot(v, m_ns) };
 }
 
-sptr<BSDF> BSDF::create(const Interaction &i, const std::vector<sptr<BxDF>> &bxdfs)
+BSDF *BSDF::create(Arena &arena, const Interaction &i)
 {
-    return std::make_shared<_BSDF>(i, bxdfs);
+    return arena.make<_BSDF>(i);
 }
 
 #pragma mark - BxDF
@@ -245,18 +254,18 @@ float _LambertianReflection::pdf(const v3f &wo, const v3f &wi) const
     return SameHemisphere(wo, wi) ? (float)(AbsCosTheta(wi) * InvPi) : .0f;
 }
 
-sptr<LambertianReflection> LambertianReflection::create(const Spectrum &R)
+LambertianReflection *LambertianReflection::create(Arena &arena, const Spectrum &R)
 {
-    return std::make_shared<_LambertianReflection>(R);
+    return arena.make<_LambertianReflection>(R);
 }
 
 #pragma mark - Specular Reflection
 
 struct _SpecularReflection : SpecularReflection {
-    _SpecularReflection(const Spectrum &R, uptr<Fresnel> fresnel) :
+    _SpecularReflection(const Spectrum &R, const Fresnel *fresnel) :
         m_type(BxDFType(BSDF_REFLECTION | BSDF_SPECULAR)),
         m_R(R),
-        m_fresnel(std::move(fresnel))
+        m_fresnel(fresnel)
     {}
 
     BxDFType type() const override { return m_type; }
@@ -271,7 +280,7 @@ struct _SpecularReflection : SpecularReflection {
 
     BxDFType m_type;
     Spectrum m_R;
-    uptr<Fresnel> m_fresnel;
+    const Fresnel *m_fresnel;
 };
 
 Spectrum _SpecularReflection::sample_f(const v3f &wo,
@@ -288,21 +297,25 @@ Spectrum _SpecularReflection::sample_f(const v3f &wo,
     return m_fresnel->eval(CosTheta(wi)) * m_R / AbsCosTheta(wi);
 }
 
-sptr<SpecularReflection> SpecularReflection::create(const Spectrum &R,
-                                                    uptr<Fresnel> fresnel)
+SpecularReflection *SpecularReflection::create(Arena &arena,
+                                               const Spectrum &R,
+                                               const Fresnel *fresnel)
 {
-    return std::make_shared<_SpecularReflection>(R, std::move(fresnel));
+    return arena.make<_SpecularReflection>(R, fresnel);
 }
 
 #pragma mark - Specular Transmission
 
 struct _SpecularTransmission : SpecularTransmission {
-    _SpecularTransmission(const Spectrum &T, float etaA, float etaB) :
+    _SpecularTransmission(const Spectrum &T,
+                          float etaA,
+                          float etaB,
+                          const Fresnel *fresnel) :
         m_type(BxDFType(BSDF_TRANSMISSION | BSDF_SPECULAR)),
         m_T(T),
         m_etaA(etaA),
         m_etaB(etaB),
-        m_fresnel(FresnelDielectric::create(etaA, etaB))
+        m_fresnel(fresnel)
     {}
 
     BxDFType type() const override { return m_type; }
@@ -319,7 +332,7 @@ struct _SpecularTransmission : SpecularTransmission {
     Spectrum m_T;
     float m_etaA;
     float m_etaB;
-    uptr<Fresnel> m_fresnel;
+    const Fresnel *m_fresnel;
 };
 
 Spectrum _SpecularTransmission::sample_f(const v3f &wo,
@@ -345,23 +358,29 @@ Spectrum _SpecularTransmission::sample_f(const v3f &wo,
     return {};
 }
 
-sptr<SpecularTransmission> SpecularTransmission::create(const Spectrum &T,
-                                                        float etaA,
-                                                        float etaB)
+SpecularTransmission *SpecularTransmission::create(Arena &arena,
+                                                   const Spectrum &T,
+                                                   float etaA,
+                                                   float etaB)
 {
-    return std::make_shared<_SpecularTransmission>(T, etaA, etaB);
+    const Fresnel *fresnel = FresnelDielectric::create(arena, etaA, etaB);
+    return arena.make<_SpecularTransmission>(T, etaA, etaB, fresnel);
 }
 
 #pragma mark - Fresnel Specular
 
 struct _FresnelSpecular : FresnelSpecular {
-    _FresnelSpecular(const Spectrum &R, const Spectrum &T, float etaA, float etaB) :
+    _FresnelSpecular(const Spectrum &R,
+                     const Spectrum &T,
+                     float etaA,
+                     float etaB,
+                     const Fresnel *fresnel) :
         m_type(BxDFType(BSDF_REFLECTION | BSDF_TRANSMISSION | BSDF_SPECULAR)),
         m_R(R),
         m_T(T),
         m_etaA(etaA),
         m_etaB(etaB),
-        m_fresnel(FresnelDielectric::create(etaA, etaB))
+        m_fresnel(fresnel)
     {}
 
     BxDFType type() const override { return m_type; }
@@ -379,7 +398,7 @@ struct _FresnelSpecular : FresnelSpecular {
     Spectrum m_T;
     float m_etaA;
     float m_etaB;
-    uptr<Fresnel> m_fresnel;
+    const Fresnel *m_fresnel;
 };
 
 static float schlick(float cos, float ri)
@@ -417,10 +436,12 @@ Spectrum _FresnelSpecular::sample_f(const v3f &wo,
     return ft / AbsCosTheta(wi);
 }
 
-sptr<FresnelSpecular> FresnelSpecular::create(const Spectrum &R,
-                                              const Spectrum &T,
-                                              float etaA,
-                                              float etaB)
+FresnelSpecular *FresnelSpecular::create(Arena &arena,
+                                         const Spectrum &R,
+                                         const Spectrum &T,
+                                         float etaA,
+                                         float etaB)
 {
-    return std::make_shared<_FresnelSpecular>(R, T, etaA, etaB);
+    const Fresnel *fresnel = FresnelDielectric::create(arena, etaA, etaB);
+    return arena.make<_FresnelSpecular>(R, T, etaA, etaB, fresnel);
 }
@@ -1,29 +1,149 @@
 #include "rt1w/context.hpp"
 
+#include "rt1w/aov.hpp"
+#include "rt1w/arena.hpp"
 #include "rt1w/camera.hpp"
+#include "rt1w/error.h"
 #include "rt1w/event.hpp"
 #include "rt1w/image.hpp"
 #include "rt1w/integrator.hpp"
+#include "rt1w/pool.hpp"
+#include "rt1w/primitive.hpp"
 #include "rt1w/ray.hpp"
 #include "rt1w/sampler.hpp"
 #include "rt1w/scene.hpp"
+#include "rt1w/scratch.hpp"
+#include "rt1w/sync.h"
+#include "rt1w/task.hpp"
 #include "rt1w/workq.hpp"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
 #include <vector>
 
-constexpr uint32_t TileSize = 32;
+#include <unistd.h>
 
-static void Progress(const sptr<Object> &, const sptr<Object> &);
+constexpr uint32_t DefaultTileSize = 32;
+
+/* The last tiles of a pass are split in sub-tiles, down to this size, so that all
+ * the threads keep working until the end */
+constexpr uint32_t MinTileSize = 8;
+
+/* Tiles traced at once by an IntegratorAsync. Their stages already run in parallel,
+ * this bounds the memory taken by the states of the paths. */
+constexpr uint32_t MaxWavefronts = 4;
+
+/* Variance estimates from a single pass, or a few samples, are too noisy to
+ * stop a pixel on */
+constexpr uint32_t MinAdaptivePasses = 2;
+constexpr uint32_t MinAdaptiveSamples = 8;
+
+static const char CheckpointMagic[8] = { 'r', 't', '1', 'w', 'c', 'k', 'p', 't' };
+constexpr uint32_t CheckpointVersion = 2;
+
+/* Followed by the per-pixel sums, counts, convergence flags, last passes and AOVs,
+ * then by the last pass done by each tile. The header must match the Render's one for
+ * the checkpoint to be resumed. */
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t samplesPerPixel;
+    uint32_t tileSize;
+    uint32_t tileOrder;
+    uint32_t ntiles;
+    uint32_t aovs;
+    float threshold;
+    /* Last pass started, the samplers are seeded with the pass */
+    uint32_t pass;
+};
+
+struct ImageTile;
+struct RenderPass;
+struct RenderingContext;
+
+static inline bool Converged(const v3f &, float, uint32_t, float);
+static void OrderTiles(std::vector<rect_t> &, uint32_t, const v2u &, TileOrder);
+static void Progress(const sptr<RenderPass> &);
 static void RenderTile(const sptr<Object> &, const sptr<Object> &);
+static void SplitRect(const rect_t &, uint32_t, std::vector<rect_t> &);
+static void StartTile(const sptr<Object> &, size_t);
+static void TileDone(const sptr<RenderingContext> &, const sptr<ImageTile> &);
+static void WavefrontDone(const sptr<Object> &, const sptr<Object> &);
+
+static inline uint8_t *PixelPtr(const buffer_t &b, int32_t x, int32_t y)
+{
+    return (uint8_t *)b.data + y * (ptrdiff_t)b.bpr + x * (ptrdiff_t)b.format.size;
+}
+
+static inline v3f ApproxGammaCorrection(const v3f &c)
+{
+    return { std::min(1.f, std::sqrt(c.x)),
+             std::min(1.f, std::sqrt(c.y)),
+             std::min(1.f, std::sqrt(c.z)) };
+}
+
+/* One pass of samplesPerPixel() samples over every tile of the image */
+struct RenderPass : Object {
+    RenderPass(uint32_t index, size_t ntiles, bool report = true) :
+        m_index(index),
+        m_ntiles(ntiles),
+        m_report(report),
+        m_event(Event::create((int32_t)ntiles)),
+        m_started(0),
+        m_progress(1)
+    {}
 
+    uint32_t m_index;
+    size_t m_ntiles;
+    bool m_report;
+    sptr<Event> m_event;
+    std::atomic<size_t> m_started;
+    std::atomic<int32_t> m_progress;
+};
+
+/* A tile, or a part of a split one, which is done once its parts are. The index of
+ * the tiles rendered out of a full pass is past the end of m_tiles. */
 struct ImageTile : Object {
-    ImageTile(const rect_t &rect) : m_rect(rect) {}
+    ImageTile(const rect_t &rect,
+              size_t index,
+              const sptr<RenderPass> &pass,
+              const sptr<ImageTile> &parent,
+              bool split) :
+        m_rect(rect),
+        m_index(index),
+        m_pass(pass),
+        m_parent(parent),
+        m_split(split)
+    {}
 
     rect_t m_rect;
+    size_t m_index;
+    sptr<RenderPass> m_pass;
+    sptr<ImageTile> m_parent;
+    std::atomic<uint32_t> m_parts{ 0 };
+    bool m_split;
+};
+
+/* Tiles of a pass, started in order by StartTile() */
+struct PassTiles : Object {
+    sptr<RenderingContext> m_ctx;
+    sptr<RenderPass> m_pass;
+    std::vector<rect_t> m_rects;
+    /* Index of each tile in m_tiles, past its end if the tiles aren't the pass's */
+    std::vector<size_t> m_indices;
+    bool m_split = false;
+    /* Tile the tiles are the parts of, if split */
+    sptr<ImageTile> m_parent;
 };
 
 struct RenderingContext : Object, std::enable_shared_from_this<RenderingContext> {
@@ -34,86 +154,595 @@ struct RenderingContext : Object, std::enable_shared_from_this<RenderingContext>
         m_scene(scene),
         m_camera(camera),
         m_integrator(integrator),
+        m_async(std::dynamic_pointer_cast<IntegratorAsync>(integrator)),
         m_func(func),
+        m_tileSize(DefaultTileSize),
+        m_tileOrder(TileOrder::Center),
+        m_aovs(0),
+        m_passes(0),
+        m_threshold(.0f),
+        m_active(0),
+        m_samples(0),
         m_scheduled(0)
     {}
 
     ~RenderingContext() override
     {
-        if (m_image.data) {
-            free(m_image.data);
-        }
-        if (m_normals.data) {
-            free(m_normals.data);
-        }
-        if (m_albedo.data) {
-            free(m_albedo.data);
+        for (buffer_t *b : { &m_image, &m_normals, &m_albedo, &m_depth, &m_primitive,
+                             &m_material }) {
+            if (b->data) {
+                free(b->data);
+            }
         }
     }
     sptr<Event> schedule();
+    sptr<Event> schedulePass();
+
+    void setAOVs(uint32_t aovs, const std::vector<sptr<Primitive>> &primitives);
+    void number(const sptr<Primitive> &primitive, uint32_t id);
+
+    void init();
+    void prepare();
+    sptr<Event> launchPass();
+
+    TileSamples renderRegion(const rect_t &rect, uint32_t index);
+    void accumulate(const TileSamples &samples);
+    void commit(const TileSamples &samples, uint32_t pass);
+    void resolve(int32_t x, int32_t y);
+
+    CheckpointHeader checkpointHeader() const;
+    bool checkpoint(const std::string &path);
+    bool resume(const std::string &path);
 
     sptr<Scene> m_scene;
     sptr<Camera> m_camera;
     sptr<Integrator> m_integrator;
+    /* Null unless the integrator traces the rays of a tile together */
+    sptr<IntegratorAsync> m_async;
 
-    size_t m_ntiles;
+    std::vector<rect_t> m_tiles;
     workq_func m_func;
 
-    buffer_t m_image;
-    buffer_t m_normals;
-    buffer_t m_albedo;
+    uint32_t m_tileSize;
+    TileOrder m_tileOrder;
+
+    /* Nanoseconds spent rendering each tile during the last pass */
+    std::vector<uint64_t> m_cost;
+
+    /* AOV_* passes rendered along with the image, and the numbers of the primitives
+     * and materials for the ID passes */
+    uint32_t m_aovs;
+    std::unordered_map<const Primitive *, uint32_t> m_primitiveIDs;
+    std::unordered_map<const Material *, uint32_t> m_materialIDs;
+
+    /* Only allocated for the requested passes */
+    buffer_t m_image = {};
+    buffer_t m_normals = {};
+    buffer_t m_albedo = {};
+    buffer_t m_depth = {};
+    buffer_t m_primitive = {};
+    buffer_t m_material = {};
+
+    /* Sum of the samples rendered by all the passes, and their count, per pixel.
+     * The sum of the squared luminances gives the variance of the estimate. The
+     * AOVs are empty unless requested. */
+    struct {
+        std::vector<v3f> L;
+        std::vector<v3f> N;
+        std::vector<v3f> A;
+        std::vector<float> Y2;
+        std::vector<uint32_t> count;
+        std::vector<uint8_t> converged;
+        /* Last pass that sampled the pixel, skipped when that pass is resumed */
+        std::vector<uint32_t> pass;
+        /* Nearest hit of all the samples */
+        std::vector<float> depth;
+        std::vector<uint32_t> primitive;
+        std::vector<uint32_t> material;
+    } m_acc;
+
+    /* Last pass that rendered the whole of each tile */
+    std::vector<uint32_t> m_done;
 
+    /* Held while the samples of a tile are added, so that checkpoints never save a
+     * part of a tile only */
+    std::mutex m_lock;
+
+    /* Under m_lock, the tiles being traced by the IntegratorAsync and the ones
+     * waiting for them */
+    uint32_t m_wavefronts = 0;
+    std::deque<sptr<ImageTile>> m_pending;
+
+    uint32_t m_passes;
+    float m_threshold;
+    std::atomic<size_t> m_active;
+    std::atomic<uint64_t> m_samples;
     sptr<Event> m_event;
     std::atomic<int32_t> m_scheduled;
 };
 
-sptr<Event> RenderingContext::schedule()
+void RenderingContext::setAOVs(uint32_t aovs,
+                               const std::vector<sptr<Primitive>> &primitives)
+{
+    m_aovs = aovs;
+    m_primitiveIDs.clear();
+    m_materialIDs.clear();
+
+    uint32_t id = 0;
+    for (const auto &p : primitives) {
+        number(p, ++id);
+    }
+}
+
+/* The primitives of an aggregate, e.g. the triangles of a mesh, share its number */
+void RenderingContext::number(const sptr<Primitive> &primitive, uint32_t id)
+{
+    if (sptr<Aggregate> agg = std::dynamic_pointer_cast<Aggregate>(primitive)) {
+        for (const auto &p : agg->primitives()) {
+            number(p, id);
+        }
+        return;
+    }
+    m_primitiveIDs.emplace(primitive.get(), id);
+    if (sptr<Material> m = primitive->material()) {
+        auto next = (uint32_t)m_materialIDs.size() + 1;
+        m_materialIDs.emplace(m.get(), next);
+    }
+}
+
+void RenderingContext::init()
 {
+    v2u size = m_camera->resolution();
+    auto alloc = [&](buffer_t &b, buffer_order_t order) {
+        buffer_format_t fmt = buffer_format_init(TYPE_FLOAT32, order);
+        size_t bpr = size.x * fmt.size;
+        size_t bsize = size.y * bpr;
+
+        ASSERT(bpr > 0);
+        ASSERT(bsize > 0);
+
+        b = { malloc(bsize), bpr, { { 0, 0 }, { size.x, size.y } }, fmt };
+    };
+
+    size_t npixels = (size_t)size.x * size.y;
+    alloc(m_image, ORDER_RGB);
+    m_acc.L.resize(npixels);
+    m_acc.Y2.resize(npixels);
+    m_acc.count.resize(npixels);
+    m_acc.converged.resize(npixels);
+    m_acc.pass.resize(npixels);
+    m_active = npixels;
+
+    if (m_aovs & AOV_NORMALS) {
+        alloc(m_normals, ORDER_RGB);
+        m_acc.N.resize(npixels);
+    }
+    if (m_aovs & AOV_ALBEDO) {
+        alloc(m_albedo, ORDER_RGB);
+        m_acc.A.resize(npixels);
+    }
+    if (m_aovs & AOV_NEAREST) {
+        m_acc.depth.resize(npixels, (float)Infinity);
+    }
+    if (m_aovs & AOV_DEPTH) {
+        alloc(m_depth, ORDER_R);
+    }
+    if (m_aovs & AOV_PRIMITIVE_ID) {
+        alloc(m_primitive, ORDER_R);
+        m_acc.primitive.resize(npixels);
+    }
+    if (m_aovs & AOV_MATERIAL_ID) {
+        alloc(m_material, ORDER_R);
+        m_acc.material.resize(npixels);
+    }
+
+    /* Divide in tiles */
+    SplitRect({ { 0, 0 }, { size.x, size.y } }, m_tileSize, m_tiles);
+    OrderTiles(m_tiles, m_tileSize, size, m_tileOrder);
+    m_cost.resize(m_tiles.size());
+    m_done.resize(m_tiles.size());
+}
+
+sptr<Event> RenderingContext::launchPass()
+{
+    /* Tiles done before the render was resumed aren't rendered again */
+    std::vector<size_t> order;
+    for (size_t i = 0; i < m_tiles.size(); ++i) {
+        if (m_done[i] <= m_passes) {
+            order.push_back(i);
+        }
+    }
+
+    /* The previous pass is done, start with its most expensive tiles */
+    if (m_passes > 0) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return m_cost[a] > m_cost[b];
+        });
+        std::fill(m_cost.begin(), m_cost.end(), 0);
+    }
+
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        index = ++m_passes;
+    }
+    auto pass = std::make_shared<RenderPass>(index, order.size());
+    std::atomic_store(&m_event, pass->m_event);
+
+    auto tiles = std::make_shared<PassTiles>();
+    tiles->m_ctx = shared_from_this();
+    tiles->m_pass = pass;
+    for (size_t i : order) {
+        tiles->m_rects.push_back(m_tiles[i]);
+    }
+    tiles->m_indices = std::move(order);
+    workq_execute_n(workq_get_queue(), tiles->m_rects.size(), StartTile, tiles);
+    return pass->m_event;
+}
+
+/* Allocates the buffers without rendering a pass, for the samples that come from
+ * renderRegion() or accumulate() */
+void RenderingContext::prepare()
+{
+    int32_t expected = 0;
+    if (m_scheduled.compare_exchange_strong(expected, -1)) {
+        init();
+        std::atomic_store(&m_event, Event::create(0));
+        m_scheduled.store(1);
+    }
     while (m_scheduled.load() != 1) {
-        int32_t expected = 0;
-        if (m_scheduled.compare_exchange_strong(expected, -1)) {
-            buffer_format_t fmt = buffer_format_init(TYPE_FLOAT32, ORDER_RGB);
-            v2u size = m_camera->resolution();
-            size_t bpr = size.x * fmt.size;
-            size_t bsize = size.y * bpr;
-
-            ASSERT(bpr > 0);
-            ASSERT(bsize > 0);
-
-            m_image = { malloc(bsize), bpr, { { 0, 0 }, { size.x, size.y } }, fmt };
-            m_normals = { malloc(bsize), bpr, { { 0, 0 }, { size.x, size.y } }, fmt };
-            m_albedo = { malloc(bsize), bpr, { { 0, 0 }, { size.x, size.y } }, fmt };
-
-            /* Divide in tiles */
-            uint32_t ntx = size.x / TileSize + 1;
-            uint32_t nty = size.y / TileSize + 1;
-
-            std::vector<sptr<ImageTile>> tiles;
-            for (size_t i = 0; i < ntx; ++i) {
-                for (size_t j = 0; j < nty; ++j) {
-                    rect_t r;
-                    r.org.x = (int32_t)(i * TileSize);
-                    r.org.y = (int32_t)(j * TileSize);
-                    r.size.x = i < ntx - 1 ? TileSize
-                                           : TileSize - (ntx * TileSize - size.x);
-                    r.size.y = j < nty - 1 ? TileSize
-                                           : TileSize - (nty * TileSize - size.y);
-
-                    tiles.emplace_back(std::make_shared<ImageTile>(r));
+    }
+}
+
+TileSamples RenderingContext::renderRegion(const rect_t &rect, uint32_t index)
+{
+    prepare();
+
+    /* Clear the region so that it only holds the samples of this pass */
+    size_t width = m_camera->resolution().x;
+    auto ox = (size_t)rect.org.x;
+    auto oy = (size_t)rect.org.y;
+    for (uint32_t y = 0; y < rect.size.y; ++y) {
+        for (uint32_t x = 0; x < rect.size.x; ++x) {
+            size_t ix = (oy + y) * width + ox + x;
+            m_acc.L[ix] = {};
+            m_acc.Y2[ix] = .0f;
+            m_acc.count[ix] = 0;
+            m_acc.pass[ix] = 0;
+            if (m_aovs & AOV_NORMALS) {
+                m_acc.N[ix] = {};
+            }
+            if (m_aovs & AOV_ALBEDO) {
+                m_acc.A[ix] = {};
+            }
+            if (m_aovs & AOV_NEAREST) {
+                m_acc.depth[ix] = (float)Infinity;
+            }
+        }
+    }
+
+    /* Render small tiles so that all the threads share the region */
+    std::vector<rect_t> tiles;
+    SplitRect(rect, MinTileSize, tiles);
+
+    auto pass = std::make_shared<RenderPass>(index, tiles.size(), false);
+    auto parts = std::make_shared<PassTiles>();
+    parts->m_ctx = shared_from_this();
+    parts->m_pass = pass;
+    parts->m_indices.assign(tiles.size(), SIZE_MAX);
+    parts->m_rects = std::move(tiles);
+    parts->m_split = true;
+    workq_execute_n(workq_get_queue(), parts->m_rects.size(), StartTile, parts);
+    pass->m_event->wait();
+
+    TileSamples samples;
+    samples.rect = rect;
+    for (uint32_t y = 0; y < rect.size.y; ++y) {
+        for (uint32_t x = 0; x < rect.size.x; ++x) {
+            size_t ix = (oy + y) * width + ox + x;
+            samples.L.push_back(m_acc.L[ix]);
+            samples.Y2.push_back(m_acc.Y2[ix]);
+            samples.count.push_back(m_acc.count[ix]);
+            if (m_aovs & AOV_NORMALS) {
+                samples.N.push_back(m_acc.N[ix]);
+            }
+            if (m_aovs & AOV_ALBEDO) {
+                samples.A.push_back(m_acc.A[ix]);
+            }
+            if (m_aovs & AOV_NEAREST) {
+                samples.depth.push_back(m_acc.depth[ix]);
+            }
+            if (m_aovs & AOV_PRIMITIVE_ID) {
+                samples.primitive.push_back(m_acc.primitive[ix]);
+            }
+            if (m_aovs & AOV_MATERIAL_ID) {
+                samples.material.push_back(m_acc.material[ix]);
+            }
+        }
+    }
+    return samples;
+}
+
+void RenderingContext::accumulate(const TileSamples &samples)
+{
+    prepare();
+    commit(samples, 0);
+}
+
+/* Adds the sums of the pixels sampled by the pass to the previous ones, then
+ * updates the images */
+void RenderingContext::commit(const TileSamples &samples, uint32_t pass)
+{
+    const rect_t &rect = samples.rect;
+    size_t width = m_camera->resolution().x;
+    auto ox = (size_t)rect.org.x;
+    auto oy = (size_t)rect.org.y;
+
+    bool adaptive = m_threshold > .0f && pass >= MinAdaptivePasses;
+    uint64_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (uint32_t y = 0; y < rect.size.y; ++y) {
+            for (uint32_t x = 0; x < rect.size.x; ++x) {
+                size_t i = y * rect.size.x + x;
+                if (samples.count[i] == 0) {
+                    continue;
+                }
+                size_t ix = (oy + y) * width + ox + x;
+                m_acc.L[ix] += samples.L[i];
+                m_acc.Y2[ix] += samples.Y2[i];
+                m_acc.count[ix] += samples.count[i];
+                m_acc.pass[ix] = pass;
+                count += samples.count[i];
+
+                if (m_aovs & AOV_NORMALS) {
+                    m_acc.N[ix] += samples.N[i];
+                }
+                if (m_aovs & AOV_ALBEDO) {
+                    m_acc.A[ix] += samples.A[i];
+                }
+                if ((m_aovs & AOV_NEAREST) && samples.depth[i] < m_acc.depth[ix]) {
+                    m_acc.depth[ix] = samples.depth[i];
+                    if (m_aovs & AOV_PRIMITIVE_ID) {
+                        m_acc.primitive[ix] = samples.primitive[i];
+                    }
+                    if (m_aovs & AOV_MATERIAL_ID) {
+                        m_acc.material[ix] = samples.material[i];
+                    }
+                }
+
+                if (adaptive
+                    && Converged(m_acc.L[ix],
+                                 m_acc.Y2[ix],
+                                 m_acc.count[ix],
+                                 m_threshold)) {
+                    m_acc.converged[ix] = 1;
+                    m_active.fetch_sub(1, std::memory_order_relaxed);
                 }
             }
-            m_event = Event::create((int32_t)tiles.size());
-            m_ntiles = tiles.size();
+        }
+    }
+    m_samples.fetch_add(count, std::memory_order_relaxed);
 
-            sptr<RenderingContext> ctx = shared_from_this();
-            for (const auto &t : tiles) {
-                sptr<Event> e = workq_execute(workq_get_queue(), m_func, ctx, t);
-                e->notify(nullptr, Progress, ctx, sptr<Object>());
+    for (uint32_t y = 0; y < rect.size.y; ++y) {
+        for (uint32_t x = 0; x < rect.size.x; ++x) {
+            if (samples.count[y * rect.size.x + x]) {
+                resolve(rect.org.x + (int32_t)x, rect.org.y + (int32_t)y);
             }
+        }
+    }
+}
+
+sptr<Event> RenderingContext::schedule()
+{
+    while (m_scheduled.load() != 1) {
+        int32_t expected = 0;
+        if (m_scheduled.compare_exchange_strong(expected, -1)) {
+            init();
+            launchPass();
             m_scheduled.store(1);
         }
     }
-    return m_event;
+    return std::atomic_load(&m_event);
+}
+
+sptr<Event> RenderingContext::schedulePass()
+{
+    /* Nothing was rendered yet, this is the pass started by schedule() */
+    int32_t expected = 0;
+    if (m_scheduled.compare_exchange_strong(expected, -1)) {
+        init();
+        sptr<Event> e = launchPass();
+        m_scheduled.store(1);
+        return e;
+    }
+
+    /* Passes accumulate in the same buffers, the previous one must be done */
+    schedule()->wait();
+    return launchPass();
+}
+
+/* Writes the average of the samples of the pixel to the images */
+void RenderingContext::resolve(int32_t x, int32_t y)
+{
+    size_t ix = (size_t)y * m_camera->resolution().x + (size_t)x;
+    float ns_inv = 1.0f / m_acc.count[ix];
+
+    v3f Li = ApproxGammaCorrection(m_acc.L[ix] * ns_inv);
+    memcpy(PixelPtr(m_image, x, y), &Li.x, m_image.format.size);
+
+    if (m_aovs & AOV_NORMALS) {
+        v3f N = m_acc.N[ix];
+        if (!(FloatEqual(N.x, .0f) && FloatEqual(N.y, .0f) && FloatEqual(N.z, .0f))) {
+            N *= ns_inv;
+            N += { 1.f, 1.f, 1.f };
+            N /= 2.f;
+        }
+        v3f n = ApproxGammaCorrection(N);
+        memcpy(PixelPtr(m_normals, x, y), &n.x, m_normals.format.size);
+    }
+    if (m_aovs & AOV_ALBEDO) {
+        v3f a = ApproxGammaCorrection(m_acc.A[ix] * ns_inv);
+        memcpy(PixelPtr(m_albedo, x, y), &a.x, m_albedo.format.size);
+    }
+
+    if (m_aovs & AOV_DEPTH) {
+        /* Zero where no sample hit anything */
+        float d = std::isinf(m_acc.depth[ix]) ? .0f : m_acc.depth[ix];
+        memcpy(PixelPtr(m_depth, x, y), &d, m_depth.format.size);
+    }
+    if (m_aovs & AOV_PRIMITIVE_ID) {
+        auto id = (float)m_acc.primitive[ix];
+        memcpy(PixelPtr(m_primitive, x, y), &id, m_primitive.format.size);
+    }
+    if (m_aovs & AOV_MATERIAL_ID) {
+        auto id = (float)m_acc.material[ix];
+        memcpy(PixelPtr(m_material, x, y), &id, m_material.format.size);
+    }
+}
+
+#pragma mark - Checkpoints
+
+template <typename T>
+static bool WriteVector(FILE *fp, const std::vector<T> &v)
+{
+    return v.empty() || fwrite(v.data(), sizeof(T), v.size(), fp) == v.size();
+}
+
+template <typename T>
+static bool ReadVector(FILE *fp, std::vector<T> &v)
+{
+    return v.empty() || fread(v.data(), sizeof(T), v.size(), fp) == v.size();
+}
+
+CheckpointHeader RenderingContext::checkpointHeader() const
+{
+    CheckpointHeader h = {};
+    memcpy(h.magic, CheckpointMagic, sizeof(CheckpointMagic));
+    h.version = CheckpointVersion;
+    h.width = m_camera->resolution().x;
+    h.height = m_camera->resolution().y;
+    h.samplesPerPixel = (uint32_t)m_integrator->sampler()->samplesPerPixel();
+    h.tileSize = m_tileSize;
+    h.tileOrder = (uint32_t)m_tileOrder;
+    h.ntiles = (uint32_t)m_tiles.size();
+    h.aovs = m_aovs;
+    h.threshold = m_threshold;
+    return h;
+}
+
+/* Can be called while a pass renders, the tiles that aren't done yet are rendered
+ * again when resuming */
+bool RenderingContext::checkpoint(const std::string &path)
+{
+    prepare();
+
+    CheckpointHeader h = checkpointHeader();
+    decltype(m_acc) acc;
+    std::vector<uint32_t> done;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        h.pass = m_passes;
+        acc = m_acc;
+        done = m_done;
+    }
+
+    /* Written aside then renamed, so that the previous checkpoint stays whole until
+     * this one is */
+    std::string tmp = std::string(path).append(".tmp");
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        ERROR("Couldn't open \"%s\" for writing", tmp.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && WriteVector(fp, acc.L)
+              && WriteVector(fp, acc.N) && WriteVector(fp, acc.A)
+              && WriteVector(fp, acc.Y2) && WriteVector(fp, acc.count)
+              && WriteVector(fp, acc.converged) && WriteVector(fp, acc.pass)
+              && WriteVector(fp, acc.depth) && WriteVector(fp, acc.primitive)
+              && WriteVector(fp, acc.material) && WriteVector(fp, done)
+              && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+
+    ok = fclose(fp) == 0 && ok;
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        ERROR("Couldn't write \"%s\"", path.c_str());
+        unlink(tmp.c_str());
+    }
+    return ok;
+}
+
+bool RenderingContext::resume(const std::string &path)
+{
+    prepare();
+
+    if (m_passes > 0) {
+        ERROR("Renders can only be resumed before their first pass");
+        return false;
+    }
+
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        ERROR("Couldn't open \"%s\"", path.c_str());
+        return false;
+    }
+
+    CheckpointHeader h;
+    if (fread(&h, sizeof(h), 1, fp) != 1
+        || memcmp(h.magic, CheckpointMagic, sizeof(CheckpointMagic)) != 0
+        || h.version != CheckpointVersion) {
+        ERROR("\"%s\" isn't a checkpoint", path.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    CheckpointHeader expected = checkpointHeader();
+    expected.pass = h.pass;
+    if (memcmp(&h, &expected, sizeof(h)) != 0) {
+        ERROR("\"%s\" was saved with another scene or settings", path.c_str());
+        fclose(fp);
+        return false;
+    }
+
+    /* The buffers are left alone if the file is truncated */
+    decltype(m_acc) acc = m_acc;
+    std::vector<uint32_t> done(m_done.size());
+    bool ok = ReadVector(fp, acc.L) && ReadVector(fp, acc.N) && ReadVector(fp, acc.A)
+              && ReadVector(fp, acc.Y2) && ReadVector(fp, acc.count)
+              && ReadVector(fp, acc.converged) && ReadVector(fp, acc.pass)
+              && ReadVector(fp, acc.depth) && ReadVector(fp, acc.primitive)
+              && ReadVector(fp, acc.material) && ReadVector(fp, done) && fgetc(fp) == EOF;
+    fclose(fp);
+    if (!ok) {
+        ERROR("Couldn't read \"%s\"", path.c_str());
+        return false;
+    }
+    m_acc = std::move(acc);
+    m_done = std::move(done);
+
+    /* The last pass was stopped midway, it's started again for the remaining tiles */
+    bool complete = std::all_of(m_done.begin(), m_done.end(), [&](uint32_t pass) {
+        return pass >= h.pass;
+    });
+    m_passes = complete ? h.pass : h.pass - 1;
+
+    uint64_t samples = 0;
+    size_t active = 0;
+    v2u size = m_camera->resolution();
+    for (uint32_t y = 0; y < size.y; ++y) {
+        for (uint32_t x = 0; x < size.x; ++x) {
+            size_t ix = (size_t)y * size.x + x;
+            samples += m_acc.count[ix];
+            active += !m_acc.converged[ix];
+            if (m_acc.count[ix]) {
+                resolve((int32_t)x, (int32_t)y);
+            }
+        }
+    }
+    m_samples = samples;
+    m_active = active;
+    return true;
 }
 
 #pragma mark - Image from RenderingContext
@@ -148,17 +777,79 @@ struct _Render : Render {
         m_ctx(std::make_shared<RenderingContext>(scene, camera, integrator, RenderTile)),
         m_image(ImageFromCtx::create(m_ctx, &m_ctx->m_image)),
         m_normals(ImageFromCtx::create(m_ctx, &m_ctx->m_normals)),
-        m_albedo(ImageFromCtx::create(m_ctx, &m_ctx->m_albedo))
+        m_albedo(ImageFromCtx::create(m_ctx, &m_ctx->m_albedo)),
+        m_depth(ImageFromCtx::create(m_ctx, &m_ctx->m_depth)),
+        m_primitiveIDs(ImageFromCtx::create(m_ctx, &m_ctx->m_primitive)),
+        m_materialIDs(ImageFromCtx::create(m_ctx, &m_ctx->m_material))
     {}
 
+    void setAOVs(uint32_t aovs, const std::vector<sptr<Primitive>> &primitives) override
+    {
+        m_ctx->setAOVs(aovs, primitives);
+    }
+    uint32_t aovs() const override { return m_ctx->m_aovs; }
+
     sptr<Image> image() const override { return m_image; }
-    sptr<Image> normals() const override { return m_normals; }
-    sptr<Image> albedo() const override { return m_albedo; }
+    sptr<Image> normals() const override { return pass(AOV_NORMALS, m_normals); }
+    sptr<Image> albedo() const override { return pass(AOV_ALBEDO, m_albedo); }
+    sptr<Image> depth() const override { return pass(AOV_DEPTH, m_depth); }
+    sptr<Image> primitiveIDs() const override
+    {
+        return pass(AOV_PRIMITIVE_ID, m_primitiveIDs);
+    }
+    sptr<Image> materialIDs() const override
+    {
+        return pass(AOV_MATERIAL_ID, m_materialIDs);
+    }
+    sptr<Image> pass(uint32_t aov, const sptr<Image> &image) const
+    {
+        return (m_ctx->m_aovs & aov) ? image : nullptr;
+    }
+
+    sptr<Event> schedulePass() override { return m_ctx->schedulePass(); }
+    uint32_t passes() const override { return m_ctx->m_passes; }
+
+    void setAdaptiveThreshold(float threshold) override
+    {
+        m_ctx->m_threshold = threshold;
+    }
+    size_t activePixels() const override { return m_ctx->m_active; }
+    uint64_t samples() const override { return m_ctx->m_samples; }
+
+    void setTiles(uint32_t size, TileOrder order) override
+    {
+        ASSERT(size > 0);
+        m_ctx->m_tileSize = size;
+        m_ctx->m_tileOrder = order;
+    }
+    std::vector<rect_t> tiles() override
+    {
+        m_ctx->prepare();
+        return m_ctx->m_tiles;
+    }
+
+    TileSamples renderRegion(const rect_t &rect, uint32_t pass) override
+    {
+        return m_ctx->renderRegion(rect, pass);
+    }
+    void accumulate(const TileSamples &samples) override
+    {
+        m_ctx->accumulate(samples);
+    }
+
+    bool checkpoint(const std::string &path) override
+    {
+        return m_ctx->checkpoint(path);
+    }
+    bool resume(const std::string &path) override { return m_ctx->resume(path); }
 
     sptr<RenderingContext> m_ctx;
     sptr<Image> m_image;
     sptr<Image> m_normals;
     sptr<Image> m_albedo;
+    sptr<Image> m_depth;
+    sptr<Image> m_primitiveIDs;
+    sptr<Image> m_materialIDs;
 };
 
 #pragma mark - Static constructor
@@ -172,89 +863,472 @@ sptr<Render> Render::create(const sptr<Scene> &scene,
 
 #pragma mark - Static functions
 
-static inline uint8_t *PixelPtr(const buffer_t &b, int32_t x, int32_t y)
+/* Index of the cell (x, y) along the Hilbert curve covering an n x n grid,
+ * with n a power of two */
+static uint64_t HilbertIndex(uint32_t n, uint32_t x, uint32_t y)
 {
-    return (uint8_t *)b.data + y * (ptrdiff_t)b.bpr + x * (ptrdiff_t)b.format.size;
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+
+        /* Rotate the quadrant so that the curve is continuous */
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
 }
 
-static inline v3f ApproxGammaCorrection(const v3f &c)
+static void OrderTiles(std::vector<rect_t> &tiles,
+                       uint32_t tileSize,
+                       const v2u &size,
+                       TileOrder order)
 {
-    return { std::min(1.f, std::sqrt(c.x)),
-             std::min(1.f, std::sqrt(c.y)),
-             std::min(1.f, std::sqrt(c.z)) };
+    std::vector<uint64_t> keys;
+    if (order == TileOrder::Center) {
+        /* Squared distance between the centers of the tile and of the image */
+        for (const auto &r : tiles) {
+            int64_t dx = 2 * (int64_t)r.org.x + r.size.x - size.x;
+            int64_t dy = 2 * (int64_t)r.org.y + r.size.y - size.y;
+            keys.push_back((uint64_t)(dx * dx + dy * dy));
+        }
+    }
+    else if (order == TileOrder::Hilbert) {
+        uint32_t n = 1;
+        while (n * tileSize < std::max(size.x, size.y)) {
+            n *= 2;
+        }
+        for (const auto &r : tiles) {
+            auto x = (uint32_t)r.org.x / tileSize;
+            auto y = (uint32_t)r.org.y / tileSize;
+            keys.push_back(HilbertIndex(n, x, y));
+        }
+    }
+    else {
+        return;
+    }
+
+    std::vector<size_t> indices(tiles.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
+        return keys[a] < keys[b];
+    });
+
+    std::vector<rect_t> sorted;
+    for (size_t i : indices) {
+        sorted.push_back(tiles[i]);
+    }
+    tiles = std::move(sorted);
+}
+
+/* Appends the tiles covering the rectangle, column by column */
+static void SplitRect(const rect_t &rect, uint32_t tileSize, std::vector<rect_t> &tiles)
+{
+    uint32_t ntx = (rect.size.x + tileSize - 1) / tileSize;
+    uint32_t nty = (rect.size.y + tileSize - 1) / tileSize;
+
+    for (uint32_t i = 0; i < ntx; ++i) {
+        for (uint32_t j = 0; j < nty; ++j) {
+            rect_t r;
+            r.org.x = rect.org.x + (int32_t)(i * tileSize);
+            r.org.y = rect.org.y + (int32_t)(j * tileSize);
+            r.size.x = std::min(tileSize, rect.size.x - i * tileSize);
+            r.size.y = std::min(tileSize, rect.size.y - j * tileSize);
+
+            tiles.push_back(r);
+        }
+    }
+}
+
+static void StartTile(const sptr<Object> &obj, size_t i)
+{
+    auto tiles = std::static_pointer_cast<PassTiles>(obj);
+    auto t = make_pooled<ImageTile>(tiles->m_rects[i],
+                                    tiles->m_indices[i],
+                                    tiles->m_pass,
+                                    tiles->m_parent,
+                                    tiles->m_split);
+    tiles->m_ctx->m_func(tiles->m_ctx, t);
+}
+
+/* Splits the tile in up to four sub-tiles, rendered by other threads, the tile is
+ * done once they all are. Small tiles aren't split. */
+static bool SplitTile(const sptr<RenderingContext> &ctx, const sptr<ImageTile> &tile)
+{
+    rect_t rect = tile->m_rect;
+    uint32_t nx = rect.size.x >= 2 * MinTileSize ? 2 : 1;
+    uint32_t ny = rect.size.y >= 2 * MinTileSize ? 2 : 1;
+    if (nx * ny == 1) {
+        return false;
+    }
+
+    auto parts = make_pooled<PassTiles>();
+    parts->m_ctx = ctx;
+    parts->m_pass = tile->m_pass;
+    parts->m_split = true;
+    for (uint32_t i = 0; i < nx; ++i) {
+        for (uint32_t j = 0; j < ny; ++j) {
+            uint32_t w = rect.size.x / nx;
+            uint32_t h = rect.size.y / ny;
+
+            rect_t r;
+            r.org.x = rect.org.x + (int32_t)(i * w);
+            r.org.y = rect.org.y + (int32_t)(j * h);
+            r.size.x = i < nx - 1 ? w : rect.size.x - i * w;
+            r.size.y = j < ny - 1 ? h : rect.size.y - j * h;
+            parts->m_rects.push_back(r);
+        }
+    }
+    parts->m_indices.assign(parts->m_rects.size(), tile->m_index);
+    parts->m_parent = tile;
+
+    tile->m_parts = nx * ny;
+    workq_execute_n(workq_get_queue(), parts->m_rects.size(), StartTile, parts);
+    return true;
+}
+
+static inline float Luminance(const v3f &c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+/* Compares the standard error of the pixel's mean luminance to the mean itself.
+ * Dark pixels are compared to a floor so that they can converge too. */
+static inline bool Converged(const v3f &L, float Y2, uint32_t n, float threshold)
+{
+    if (n < MinAdaptiveSamples) {
+        return false;
+    }
+    float mean = Luminance(L) / n;
+    float var = std::max(.0f, (Y2 - mean * mean * n) / (n - 1));
+    return std::sqrt(var / n) <= threshold * std::max(mean, 1e-2f);
+}
+
+/* Number of the primitive or material for the ID passes, 0 if unknown */
+template <typename T>
+static uint32_t LookupID(const std::unordered_map<const T *, uint32_t> &ids, const T *p)
+{
+    auto it = ids.find(p);
+    return it != ids.end() ? it->second : 0;
+}
+
+/* Pixels left out have no sample */
+static TileSamples CreateTileSamples(const rect_t &rect, uint32_t aovs)
+{
+    TileSamples samples;
+    size_t npixels = (size_t)rect.size.x * rect.size.y;
+    samples.rect = rect;
+    samples.L.resize(npixels);
+    samples.Y2.resize(npixels);
+    samples.count.resize(npixels);
+    if (aovs & AOV_NORMALS) {
+        samples.N.resize(npixels);
+    }
+    if (aovs & AOV_ALBEDO) {
+        samples.A.resize(npixels);
+    }
+    if (aovs & AOV_NEAREST) {
+        samples.depth.resize(npixels, (float)Infinity);
+    }
+    if (aovs & AOV_PRIMITIVE_ID) {
+        samples.primitive.resize(npixels);
+    }
+    if (aovs & AOV_MATERIAL_ID) {
+        samples.material.resize(npixels);
+    }
+    return samples;
+}
+
+/* Keeps the nearest hit of the samples of pixel i */
+static void RecordNearest(const sptr<RenderingContext> &ctx,
+                          TileSamples &samples,
+                          size_t i,
+                          const AOVSample &aov)
+{
+    if (!(aov.requested & AOV_NEAREST) || !(aov.depth < samples.depth[i])) {
+        return;
+    }
+    samples.depth[i] = aov.depth;
+    if (aov.requested & AOV_PRIMITIVE_ID) {
+        samples.primitive[i] = LookupID(ctx->m_primitiveIDs, aov.primitive);
+    }
+    if (aov.requested & AOV_MATERIAL_ID) {
+        samples.material[i] = LookupID(ctx->m_materialIDs, aov.material);
+    }
+}
+
+/* Accumulates the samples with the previous passes, then signals the tile. The
+ * samples of a cancelled tile may be partial, they are dropped. */
+static void FinishTile(const sptr<RenderingContext> &ctx,
+                       const sptr<ImageTile> &tile,
+                       const TileSamples &samples,
+                       std::chrono::steady_clock::time_point start)
+{
+    if (workq_cancelled()) {
+        TileDone(ctx, tile);
+        return;
+    }
+    ctx->commit(samples, tile->m_pass->m_index);
+
+    if (tile->m_index < ctx->m_cost.size()) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+        sync_add_u64(&ctx->m_cost[tile->m_index], (uint64_t)cost.count());
+    }
+
+    TileDone(ctx, tile);
+}
+
+/* The paths of the samples of a tile, traced together by an IntegratorAsync */
+struct TileWavefront : Object {
+    sptr<ImageTile> m_tile;
+    std::chrono::steady_clock::time_point m_start;
+    /* Index of the pixel in the tile, per path */
+    std::vector<uint32_t> m_pixels;
+    std::vector<AOVSample> m_aovs;
+    sptr<Batch<Spectrum>> m_batch;
+};
+
+/* Two dimensions of the sample, so that the paths don't depend on the tiles */
+static inline uint64_t PathSeed(const sptr<Sampler> &sampler)
+{
+    auto hi = (uint64_t)(sampler->sample1D() * 0x1p32);
+    auto lo = (uint64_t)(sampler->sample1D() * 0x1p32);
+    return hi << 32 | lo;
+}
+
+static void StartWavefront(const sptr<RenderingContext> &ctx, const sptr<ImageTile> &tile)
+{
+    auto wavefront = std::make_shared<TileWavefront>();
+    wavefront->m_tile = tile;
+    wavefront->m_start = std::chrono::steady_clock::now();
+
+    rect_t rect = tile->m_rect;
+    size_t width = ctx->m_camera->resolution().x;
+    const sptr<RenderPass> &pass = tile->m_pass;
+
+    /* Camera rays of all the samples of the tile */
+    Scratch &scratch = Scratch::get();
+    const sptr<Sampler> &sampler =
+        scratch.sampler(ctx->m_integrator->sampler(), pass->m_index);
+    std::vector<Ray> rays;
+    std::vector<uint64_t> seeds;
+    for (uint32_t y = 0; y < rect.size.y; ++y) {
+        for (uint32_t x = 0; x < rect.size.x; ++x) {
+            int32_t px = rect.org.x + (int32_t)x;
+            int32_t py = rect.org.y + (int32_t)y;
+            size_t ix = (size_t)py * width + (size_t)px;
+            if (ctx->m_acc.converged[ix] || ctx->m_acc.pass[ix] >= pass->m_index) {
+                continue;
+            }
+
+            sampler->startPixel({ px, py });
+            do {
+                CameraSample cs = sampler->cameraSample();
+                rays.push_back(ctx->m_camera->generateRay(cs));
+                seeds.push_back(PathSeed(sampler));
+                wavefront->m_pixels.push_back(y * rect.size.x + x);
+            } while (sampler->startNextSample());
+        }
+    }
+    scratch.count(1, rays.size());
+
+    std::vector<AOVSample> *aovs = nullptr;
+    if (ctx->m_aovs) {
+        wavefront->m_aovs.assign(rays.size(), AOVSample(ctx->m_aovs));
+        aovs = &wavefront->m_aovs;
+    }
+    wavefront->m_batch = ctx->m_async->Li(rays, seeds, ctx->m_scene, aovs);
+    wavefront->m_batch->schedule()->notify(nullptr, WavefrontDone, ctx, wavefront);
+}
+
+static void WavefrontDone(const sptr<Object> &obj, const sptr<Object> &arg)
+{
+    sptr<RenderingContext> ctx = std::static_pointer_cast<RenderingContext>(obj);
+    sptr<TileWavefront> wavefront = std::static_pointer_cast<TileWavefront>(arg);
+
+    uint32_t aovs = ctx->m_aovs;
+    TileSamples samples = CreateTileSamples(wavefront->m_tile->m_rect, aovs);
+
+    const std::vector<Spectrum> &L = wavefront->m_batch->content();
+    for (size_t j = 0; j < L.size(); ++j) {
+        size_t i = wavefront->m_pixels[j];
+        v3f c = L[j].rgb();
+        float Y = Luminance(c);
+        samples.L[i] += c;
+        samples.Y2[i] += Y * Y;
+        samples.count[i]++;
+        if (aovs) {
+            const AOVSample &aov = wavefront->m_aovs[j];
+            if (aovs & AOV_NORMALS) {
+                samples.N[i] += aov.N;
+            }
+            if (aovs & AOV_ALBEDO) {
+                samples.A[i] += aov.A.rgb();
+            }
+            RecordNearest(ctx, samples, i, aov);
+        }
+    }
+
+    /* Trace the next tile waiting */
+    sptr<ImageTile> next;
+    {
+        std::lock_guard<std::mutex> lock(ctx->m_lock);
+        if (!ctx->m_pending.empty()) {
+            next = ctx->m_pending.front();
+            ctx->m_pending.pop_front();
+        }
+        else {
+            ctx->m_wavefronts--;
+        }
+    }
+
+    FinishTile(ctx, wavefront->m_tile, samples, wavefront->m_start);
+    if (next) {
+        StartWavefront(ctx, next);
+    }
 }
+
 static void RenderTile(const sptr<Object> &obj, const sptr<Object> &arg)
 {
     sptr<RenderingContext> ctx = std::static_pointer_cast<RenderingContext>(obj);
     sptr<ImageTile> tile = std::static_pointer_cast<ImageTile>(arg);
 
+    /* The stages of the wavefronts are shared by all the threads already */
+    if (ctx->m_async) {
+        {
+            std::lock_guard<std::mutex> lock(ctx->m_lock);
+            if (ctx->m_wavefronts >= MaxWavefronts) {
+                ctx->m_pending.push_back(tile);
+                return;
+            }
+            ctx->m_wavefronts++;
+        }
+        StartWavefront(ctx, tile);
+        return;
+    }
+
+    /* Fewer tiles than threads remain, share the work of this one */
+    const sptr<RenderPass> &pass = tile->m_pass;
+    if (!tile->m_split) {
+        size_t started = pass->m_started.fetch_add(1, std::memory_order_relaxed);
+        if (started + workq_concurrency(workq_get_queue()) >= pass->m_ntiles
+            && SplitTile(ctx, tile)) {
+            return;
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
     rect_t rect = tile->m_rect;
     int32_t orgx = rect.org.x;
     int32_t orgy = rect.org.y;
     int32_t maxx = orgx + (int32_t)rect.size.x;
     int32_t maxy = orgy + (int32_t)rect.size.y;
 
-    buffer_t image = ctx->m_image;
-    buffer_t normals = ctx->m_normals;
-    buffer_t albedo = ctx->m_albedo;
+    size_t width = ctx->m_camera->resolution().x;
 
-    sptr<Sampler> sampler = ctx->m_integrator->sampler()->clone();
-    float ns_inv = 1.0f / sampler->samplesPerPixel();
+    /* Seeded by the pass, so that tiles rendered anywhere give the same samples */
+    Scratch &scratch = Scratch::get();
+    const sptr<Sampler> &sampler =
+        scratch.sampler(ctx->m_integrator->sampler(), pass->m_index);
+    auto ns = (uint32_t)sampler->samplesPerPixel();
+    uint64_t rendered = 0;
 
-    for (int32_t y = orgy; y < maxy; ++y) {
-        uint8_t *idp = PixelPtr(image, orgx, y);
-        uint8_t *ndp = PixelPtr(normals, orgx, y);
-        uint8_t *adp = PixelPtr(albedo, orgx, y);
+    uint32_t aovs = ctx->m_aovs;
+    TileSamples samples = CreateTileSamples(rect, aovs);
 
+    for (int32_t y = orgy; y < maxy && !workq_cancelled(); ++y) {
         for (int32_t x = orgx; x < maxx; ++x) {
+            size_t ix = (size_t)y * width + (size_t)x;
+            if (ctx->m_acc.converged[ix] || ctx->m_acc.pass[ix] >= pass->m_index) {
+                continue;
+            }
+
             Spectrum c;
             Spectrum A;
             v3f N;
+            float Y2 = .0f;
+            AOVSample nearest(aovs);
             sampler->startPixel({ x, y });
             do {
-                v3f Nsmp;
-                Spectrum Asmp;
+                AOVSample aov(aovs);
 
                 CameraSample cs = sampler->cameraSample();
                 Ray r = ctx->m_camera->generateRay(cs);
-                c += ctx->m_integrator->Li(r, ctx->m_scene, sampler, 0, &Nsmp, &Asmp);
-                N += Nsmp;
-                A += Asmp;
+                Spectrum L = ctx->m_integrator->Li(r,
+                                                   ctx->m_scene,
+                                                   sampler,
+                                                   0,
+                                                   aovs ? &aov : nullptr);
+                scratch.arena().reset();
+                float Y = Luminance(L.rgb());
+                c += L;
+                Y2 += Y * Y;
+                N += aov.N;
+                A += aov.A;
+                if (aov.depth < nearest.depth) {
+                    nearest = aov;
+                }
             } while (sampler->startNextSample());
 
-            if (!(FloatEqual(N.x, .0f) && FloatEqual(N.y, .0f) && FloatEqual(N.z, .0f))) {
-                N *= ns_inv;
-                N += { 1.f, 1.f, 1.f };
-                N /= 2.f;
+            rendered += ns;
+            auto i = (size_t)(y - orgy) * rect.size.x + (size_t)(x - orgx);
+            samples.L[i] = c.rgb();
+            samples.Y2[i] = Y2;
+            samples.count[i] = ns;
+            if (aovs & AOV_NORMALS) {
+                samples.N[i] = N;
             }
+            if (aovs & AOV_ALBEDO) {
+                samples.A[i] = A.rgb();
+            }
+            RecordNearest(ctx, samples, i, nearest);
+        }
+    }
 
-            v3f Li = ApproxGammaCorrection((c * ns_inv).rgb());
-            v3f a = ApproxGammaCorrection((A * ns_inv).rgb());
-            v3f n = ApproxGammaCorrection(N);
-
-            memcpy(idp, &Li.x, image.format.size);
-            memcpy(ndp, &n.x, normals.format.size);
-            memcpy(adp, &a.x, albedo.format.size);
+    scratch.count(1, rendered);
+    FinishTile(ctx, tile, samples, start);
+}
 
-            idp += image.format.size;
-            ndp += normals.format.size;
-            adp += albedo.format.size;
+static void TileDone(const sptr<RenderingContext> &ctx, const sptr<ImageTile> &tile)
+{
+    /* A split tile is done with its last part */
+    if (tile->m_parent) {
+        if (tile->m_parent->m_parts.fetch_sub(1) == 1) {
+            TileDone(ctx, tile->m_parent);
         }
+        return;
+    }
+
+    /* A cancelled tile isn't saved as done by the checkpoints */
+    const sptr<RenderPass> &pass = tile->m_pass;
+    if (tile->m_index < ctx->m_done.size() && !workq_cancelled()) {
+        std::lock_guard<std::mutex> lock(ctx->m_lock);
+        ctx->m_done[tile->m_index] = pass->m_index;
+    }
+    if (pass->m_report) {
+        Progress(pass);
     }
-    ctx->m_event->signal();
+    pass->m_event->signal();
 }
 
-static void Progress(const sptr<Object> &obj, const sptr<Object> &)
+static void Progress(const sptr<RenderPass> &pass)
 {
-    static std::atomic<int32_t> progress(1);
+    int32_t done = pass->m_progress.fetch_add(1, std::memory_order_relaxed);
 
-    int32_t done = progress.fetch_add(1, std::memory_order_relaxed);
-    sptr<RenderingContext> ctx = std::static_pointer_cast<RenderingContext>(obj);
-    ASSERT(ctx);
-
-    float p = (float)done / ctx->m_ntiles * 100.f;
+    float p = (float)done / pass->m_ntiles * 100.f;
     char buf[256];
     auto offset = (size_t)snprintf(buf, 256, "\r%.1f%% [", p);
+    if (pass->m_index > 1) {
+        offset = (size_t)snprintf(buf, 256, "\rPass %u: %.1f%% [", pass->m_index, p);
+    }
     int64_t n = std::lrint(std::floor(p)) / 2;
     for (int32_t i = 0; i < 50; i++) {
         char c = i <= n ? '#' : ' ';
@@ -263,7 +1337,7 @@ static void Progress(const sptr<Object> &obj, const sptr<Object> &)
     }
     snprintf(&buf[offset], 256 - offset, "]");
     fprintf(stderr, "%s", buf);
-    if ((uint32_t)done == ctx->m_ntiles) {
+    if ((uint32_t)done == pass->m_ntiles) {
         fprintf(stderr, "\nDone!\n");
     }
     fflush(stderr);
@@ -0,0 +1,554 @@
+#include "rt1w/distributed.hpp"
+
+#include "rt1w/context.hpp"
+#include "rt1w/error.h"
+
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Time the coordinator waits for a worker when none is connected */
+constexpr int ConnectTimeout = 30000;
+
+/* A worker connecting before the coordinator listens retries for a while */
+constexpr int ConnectRetries = 100;
+constexpr useconds_t ConnectRetryDelay = 100000;
+
+/* Tiles sent ahead to each worker, so they never wait for the next one */
+constexpr size_t MaxTilesInFlight = 2;
+
+#pragma mark - Protocol
+
+/* Messages are a header followed by size bytes, in the native byte order */
+enum MessageType : uint32_t {
+    MESSAGE_SETUP = 1, /* Coordinator to worker: SetupMessage then the file path */
+    MESSAGE_TILE,      /* Coordinator to worker: TileMessage */
+    MESSAGE_SAMPLES,   /* Worker to coordinator: TileMessage then PixelSamples */
+    MESSAGE_DONE       /* Coordinator to worker: empty */
+};
+
+struct MessageHeader {
+    uint32_t type;
+    uint32_t size;
+};
+
+struct SetupMessage {
+    uint32_t quality;
+    uint32_t aovs;
+};
+
+struct TileMessage {
+    uint32_t pass;
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+/* The AOVs that weren't requested are zero */
+struct PixelSamples {
+    v3f L;
+    v3f N;
+    v3f A;
+    float Y2;
+    uint32_t count;
+    float depth;
+    uint32_t primitive;
+    uint32_t material;
+};
+static_assert(sizeof(PixelSamples) == 14 * sizeof(float), "Unexpected padding");
+
+/* Largest message accepted, a 1024 x 1024 tile */
+constexpr size_t MaxMessageSize = sizeof(TileMessage)
+                                  + 1024 * 1024 * sizeof(PixelSamples);
+
+static bool WriteAll(int fd, const void *data, size_t size)
+{
+    const auto *p = (const uint8_t *)data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool ReadAll(int fd, void *data, size_t size)
+{
+    auto *p = (uint8_t *)data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool WriteMessage(int fd, MessageType type, const std::vector<uint8_t> &payload)
+{
+    MessageHeader h = { type, (uint32_t)payload.size() };
+    return WriteAll(fd, &h, sizeof(h)) && WriteAll(fd, payload.data(), payload.size());
+}
+
+template <typename T>
+static void Append(std::vector<uint8_t> &payload, const T *data, size_t count = 1)
+{
+    size_t offset = payload.size();
+    payload.resize(offset + count * sizeof(T));
+    if (count > 0) {
+        memcpy(&payload[offset], data, count * sizeof(T));
+    }
+}
+
+/* Value of an AOV, zero if it wasn't requested */
+template <typename T>
+static T At(const std::vector<T> &v, size_t i)
+{
+    return i < v.size() ? v[i] : T();
+}
+
+static TileMessage TileFromRect(const rect_t &rect, uint32_t pass)
+{
+    return { pass, rect.org.x, rect.org.y, rect.size.x, rect.size.y };
+}
+
+static rect_t RectFromTile(const TileMessage &t)
+{
+    return { { t.x, t.y }, { t.width, t.height } };
+}
+
+#pragma mark - Sockets
+
+static bool ParseAddress(const std::string &address, std::string &host, std::string &port)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) {
+        ERROR("Invalid address \"%s\", expected <host>:<port> or unix:<path>",
+              address.c_str());
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+static bool UnixAddress(const std::string &address, sockaddr_un &sun)
+{
+    std::string path = address.substr(5);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(sun.sun_path)) {
+        ERROR("Invalid socket path \"%s\"", path.c_str());
+        return false;
+    }
+    memcpy(sun.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+static bool IsUnixAddress(const std::string &address)
+{
+    return address.compare(0, 5, "unix:") == 0;
+}
+
+static int Listen(const std::string &address)
+{
+    if (IsUnixAddress(address)) {
+        sockaddr_un sun;
+        if (!UnixAddress(address, sun)) {
+            return -1;
+        }
+        unlink(sun.sun_path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (sockaddr *)&sun, sizeof(sun)) != 0
+            || listen(fd, 64) != 0) {
+            ERROR("Couldn't listen on \"%s\": %s", address.c_str(), strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    std::string host, port;
+    if (!ParseAddress(address, host, port)) {
+        return -1;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *ai = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &ai)) {
+        ERROR("Couldn't resolve \"%s\"", address.c_str());
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *p = ai; p && fd < 0; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(fd, p->ai_addr, p->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+
+    ERROR_IF(fd < 0, "Couldn't listen on \"%s\"", address.c_str());
+    return fd;
+}
+
+static int ConnectOnce(const std::string &address)
+{
+    if (IsUnixAddress(address)) {
+        sockaddr_un sun;
+        if (!UnixAddress(address, sun)) {
+            return -1;
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr *)&sun, sizeof(sun)) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    std::string host, port;
+    if (!ParseAddress(address, host, port)) {
+        return -1;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *ai = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai)) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo *p = ai; p && fd < 0; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd >= 0 && connect(fd, p->ai_addr, p->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+#pragma mark - Coordinator
+
+struct Assignment {
+    rect_t rect;
+    uint32_t pass;
+};
+
+struct Peer {
+    Peer(int fd) : m_fd(fd) {}
+    ~Peer() { close(m_fd); }
+
+    int m_fd;
+    std::deque<Assignment> m_inflight;
+    std::vector<uint8_t> m_buffer;
+};
+
+struct _Coordinator : Coordinator {
+    _Coordinator(int fd, const std::string &address) : m_fd(fd), m_address(address) {}
+    ~_Coordinator() override
+    {
+        close(m_fd);
+        if (IsUnixAddress(m_address)) {
+            unlink(m_address.c_str() + 5);
+        }
+    }
+
+    bool render(const sptr<Render> &render,
+                const RenderSetup &setup,
+                uint32_t passes) override;
+
+    bool receive(Peer &peer, const sptr<Render> &render, size_t &done);
+
+    int m_fd;
+    std::string m_address;
+};
+
+/* Reads what's available and accumulates the complete messages, returns false
+ * once the worker is lost or misbehaves */
+bool _Coordinator::receive(Peer &peer, const sptr<Render> &render, size_t &done)
+{
+    uint8_t data[65536];
+    ssize_t n = read(peer.m_fd, data, sizeof(data));
+    if (n <= 0) {
+        return false;
+    }
+    Append(peer.m_buffer, data, (size_t)n);
+
+    size_t offset = 0;
+    while (peer.m_buffer.size() - offset >= sizeof(MessageHeader)) {
+        MessageHeader h;
+        memcpy(&h, &peer.m_buffer[offset], sizeof(h));
+        if (h.type != MESSAGE_SAMPLES || h.size > MaxMessageSize
+            || h.size < sizeof(TileMessage)) {
+            ERROR("Unexpected message from worker");
+            return false;
+        }
+        if (peer.m_buffer.size() - offset - sizeof(h) < h.size) {
+            break;
+        }
+        const uint8_t *payload = &peer.m_buffer[offset + sizeof(h)];
+        offset += sizeof(h) + h.size;
+
+        /* Workers render the tiles in the order they are sent */
+        TileMessage t;
+        memcpy(&t, payload, sizeof(t));
+        size_t npixels = (size_t)t.width * t.height;
+        if (peer.m_inflight.empty()
+            || h.size != sizeof(t) + npixels * sizeof(PixelSamples)) {
+            ERROR("Unexpected samples from worker");
+            return false;
+        }
+        const Assignment &a = peer.m_inflight.front();
+        if (t.pass != a.pass || t.x != a.rect.org.x || t.y != a.rect.org.y
+            || t.width != a.rect.size.x || t.height != a.rect.size.y) {
+            ERROR("Unexpected samples from worker");
+            return false;
+        }
+
+        TileSamples samples;
+        samples.rect = a.rect;
+        const uint8_t *p = payload + sizeof(t);
+        for (size_t i = 0; i < npixels; ++i, p += sizeof(PixelSamples)) {
+            PixelSamples ps;
+            memcpy(&ps, p, sizeof(ps));
+            samples.L.push_back(ps.L);
+            samples.N.push_back(ps.N);
+            samples.A.push_back(ps.A);
+            samples.Y2.push_back(ps.Y2);
+            samples.count.push_back(ps.count);
+            samples.depth.push_back(ps.depth);
+            samples.primitive.push_back(ps.primitive);
+            samples.material.push_back(ps.material);
+        }
+        render->accumulate(samples);
+        peer.m_inflight.pop_front();
+        done++;
+    }
+    std::vector<uint8_t>(peer.m_buffer.begin() + (ssize_t)offset, peer.m_buffer.end())
+        .swap(peer.m_buffer);
+    return true;
+}
+
+bool _Coordinator::render(const sptr<Render> &render,
+                          const RenderSetup &setup,
+                          uint32_t passes)
+{
+    std::deque<Assignment> pending;
+    for (uint32_t pass = 1; pass <= passes; ++pass) {
+        for (const auto &r : render->tiles()) {
+            pending.push_back({ r, pass });
+        }
+    }
+
+    std::vector<uint8_t> hello;
+    SetupMessage sm = { setup.quality, setup.aovs };
+    Append(hello, &sm);
+    Append(hello, setup.file.data(), setup.file.size());
+
+    std::vector<uptr<Peer>> peers;
+    size_t total = pending.size();
+    size_t done = 0;
+
+    while (done < total) {
+        std::vector<pollfd> fds;
+        fds.push_back({ m_fd, POLLIN, 0 });
+        for (const auto &peer : peers) {
+            fds.push_back({ peer->m_fd, POLLIN, 0 });
+        }
+
+        int n = poll(fds.data(), fds.size(), peers.empty() ? ConnectTimeout : -1);
+        if (n < 0 && errno != EINTR) {
+            ERROR("poll: %s", strerror(errno));
+            return false;
+        }
+        if (n == 0) {
+            ERROR("No worker connected");
+            return false;
+        }
+
+        /* New worker */
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(m_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                auto peer = std::make_unique<Peer>(fd);
+                if (WriteMessage(fd, MESSAGE_SETUP, hello)) {
+                    peers.push_back(std::move(peer));
+                }
+            }
+        }
+
+        /* Samples from the workers, or lost ones */
+        std::vector<uptr<Peer>> alive;
+        for (size_t i = 0; i < peers.size(); ++i) {
+            uptr<Peer> &peer = peers[i];
+            bool ok = true;
+            if (i + 1 < fds.size() && fds[i + 1].revents) {
+                ok = receive(*peer, render, done);
+            }
+
+            /* Keep the worker busy */
+            while (ok && peer->m_inflight.size() < MaxTilesInFlight && !pending.empty()) {
+                Assignment a = pending.front();
+                std::vector<uint8_t> payload;
+                TileMessage t = TileFromRect(a.rect, a.pass);
+                Append(payload, &t);
+
+                ok = WriteMessage(peer->m_fd, MESSAGE_TILE, payload);
+                if (ok) {
+                    pending.pop_front();
+                    peer->m_inflight.push_back(a);
+                }
+            }
+
+            if (ok) {
+                alive.push_back(std::move(peer));
+            }
+            else {
+                WARNING("Lost a worker, %lu tiles to render again",
+                        peer->m_inflight.size());
+                pending.insert(pending.begin(),
+                               peer->m_inflight.begin(),
+                               peer->m_inflight.end());
+            }
+        }
+        peers = std::move(alive);
+
+        fprintf(stderr,
+                "\r%.1f%% [%lu workers]",
+                (float)done / total * 100.f,
+                peers.size());
+        fflush(stderr);
+    }
+    fprintf(stderr, "\nDone!\n");
+
+    for (const auto &peer : peers) {
+        WriteMessage(peer->m_fd, MESSAGE_DONE, {});
+    }
+    return true;
+}
+
+#pragma mark - Worker
+
+bool RenderWorker(const std::string &address,
+                  const std::function<sptr<Render>(const RenderSetup &)> &create)
+{
+    int fd = -1;
+    for (int i = 0; i < ConnectRetries && fd < 0; ++i) {
+        fd = ConnectOnce(address);
+        if (fd < 0) {
+            usleep(ConnectRetryDelay);
+        }
+    }
+    if (fd < 0) {
+        ERROR("Couldn't connect to \"%s\"", address.c_str());
+        return false;
+    }
+
+    sptr<Render> render;
+    bool ok = true;
+    while (ok) {
+        MessageHeader h;
+        if (!ReadAll(fd, &h, sizeof(h)) || h.size > MaxMessageSize) {
+            ERROR("Lost the coordinator");
+            ok = false;
+            break;
+        }
+        std::vector<uint8_t> payload(h.size);
+        if (!ReadAll(fd, payload.data(), payload.size())) {
+            ERROR("Lost the coordinator");
+            ok = false;
+            break;
+        }
+
+        if (h.type == MESSAGE_DONE) {
+            break;
+        }
+        if (h.type == MESSAGE_SETUP && !render && h.size >= sizeof(SetupMessage)) {
+            SetupMessage sm;
+            memcpy(&sm, payload.data(), sizeof(sm));
+
+            RenderSetup setup;
+            setup.quality = sm.quality;
+            setup.aovs = sm.aovs;
+            setup.file.assign(payload.begin() + sizeof(sm), payload.end());
+
+            render = create(setup);
+            ok = render != nullptr;
+            if (ok && render->aovs() != setup.aovs) {
+                ERROR("The worker doesn't render the coordinator's AOVs");
+                ok = false;
+            }
+        }
+        else if (h.type == MESSAGE_TILE && render && h.size == sizeof(TileMessage)) {
+            TileMessage t;
+            memcpy(&t, payload.data(), sizeof(t));
+            TileSamples samples = render->renderRegion(RectFromTile(t), t.pass);
+
+            std::vector<uint8_t> reply;
+            Append(reply, &t);
+            for (size_t i = 0; i < samples.count.size(); ++i) {
+                PixelSamples ps = { samples.L[i],
+                                    At(samples.N, i),
+                                    At(samples.A, i),
+                                    samples.Y2[i],
+                                    samples.count[i],
+                                    At(samples.depth, i),
+                                    At(samples.primitive, i),
+                                    At(samples.material, i) };
+                Append(reply, &ps);
+            }
+            ok = WriteMessage(fd, MESSAGE_SAMPLES, reply);
+        }
+        else {
+            ERROR("Unexpected message from the coordinator");
+            ok = false;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+#pragma mark - Static constructor
+
+sptr<Coordinator> Coordinator::create(const std::string &address)
+{
+    int fd = Listen(address);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return std::make_shared<_Coordinator>(fd, address);
+}
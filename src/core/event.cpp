@@ -1,30 +1,108 @@
 #include "rt1w/event.hpp"
 
 #include "rt1w/error.h"
-#include "rt1w/sync.h"
+#include "rt1w/pool.hpp"
 #include "rt1w/workq.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <memory>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
 #include <mutex>
+#endif
 
-struct token {
-    void *foo;
-};
+/* The counter of an event holds the signals it still waits for, and this bit once
+ * a thread sleeps on it */
+constexpr uint32_t Sleepers = 1u << 31;
+constexpr uint32_t CountMask = Sleepers - 1;
 
-struct _lock {
-    _lock(std::mutex *mutex) : m_mutex(mutex), m_next(nullptr) {}
-    ~_lock() { m_mutex->unlock(); }
+/* Bounds of the number of times a thread checks an event before sleeping */
+constexpr uint32_t MinSpins = 16;
+constexpr uint32_t MaxSpins = 1024;
 
-    std::mutex *m_mutex;
-    uptr<_lock> m_next;
+#pragma mark - Futex
+
+#ifdef __linux__
+static void FutexWait(std::atomic<uint32_t> *addr, uint32_t value)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t> *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+/* Elsewhere, the threads sleep on a condition variable picked from the address */
+struct _bucket {
+    std::mutex lock;
+    std::condition_variable cv;
 };
 
-static uptr<_lock> create_lock(std::mutex *mutex)
+static _bucket &Bucket(const void *addr)
+{
+    static _bucket buckets[64];
+    return buckets[((uintptr_t)addr >> 6) % 64];
+}
+
+static void FutexWait(std::atomic<uint32_t> *addr, uint32_t value)
+{
+    _bucket &b = Bucket(addr);
+    std::unique_lock<std::mutex> lock(b.lock);
+    if (addr->load() == value) {
+        b.cv.wait(lock);
+    }
+}
+
+static void FutexWake(std::atomic<uint32_t> *addr)
 {
-    return std::make_unique<_lock>(mutex);
+    _bucket &b = Bucket(addr);
+    std::lock_guard<std::mutex> lock(b.lock);
+    b.cv.notify_all();
 }
+#endif
 
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/* Spins of the calling thread, doubled when they were enough for the last event it
+ * waited for and halved when it had to sleep. No spinning on a single CPU, where it
+ * only delays the thread that signals. */
+static uint32_t &SpinBudget()
+{
+    static const bool spin = std::thread::hardware_concurrency() > 1;
+    static thread_local uint32_t budget = spin ? MinSpins : 0;
+    return budget;
+}
+
+#pragma mark - Event
+
+/* Recycled, as most jobs are continuations of an event. Submitted in the context
+ * they were added in, so that cancelling the work also cancels its continuations. */
 struct _notif {
+    static void *operator new(size_t)
+    {
+        return BlockPool<sizeof(_notif), alignof(_notif)>::allocate();
+    }
+    static void operator delete(void *p)
+    {
+        BlockPool<sizeof(_notif), alignof(_notif)>::deallocate(p);
+    }
+
     _notif(workq *q,
            const sptr<Event> &e,
            workq_func f,
@@ -34,27 +112,37 @@ struct _notif {
         m_event(e),
         m_func(f),
         m_obj(obj),
-        m_arg(arg)
+        m_arg(arg),
+        m_context(workq_get_context())
     {}
-    ~_notif() { workq_execute(m_queue, m_event, m_func, m_obj, m_arg); }
+
+    void run()
+    {
+        workq_context previous = workq_set_context(m_context);
+        workq_execute(m_queue, m_event, m_func, m_obj, m_arg);
+        workq_set_context(previous);
+    }
 
     workq *m_queue;
     sptr<Event> m_event;
     workq_func m_func;
     sptr<Object> m_obj;
     sptr<Object> m_arg;
-    uptr<_notif> m_next = nullptr;
+    workq_context m_context;
+    _notif *m_next = nullptr;
 };
 
-struct _Event : Event, std::enable_shared_from_this<Event> {
-    _Event(int32_t n) : m_counter(n), m_token(n > 0 ? new token : nullptr) {}
+/* Ends the list of continuations of the signaled events */
+static int closed;
+static _notif *const Closed = reinterpret_cast<_notif *>(&closed);
+
+struct _Event : Event {
+    _Event(int32_t n) :
+        m_counter(n > 0 ? (uint32_t)n : 0),
+        m_notifs(n > 0 ? nullptr : Closed)
+    {}
+    ~_Event() override;
 
-    ~_Event() override
-    {
-        if (m_token) {
-            delete (token *)m_token;
-        }
-    }
     sptr<Event> notify(workq *,
                        workq_func,
                        const sptr<Object> &,
@@ -63,81 +151,98 @@ struct _Event : Event, std::enable_shared_from_this<Event> {
     bool test() const override;
     int32_t wait() override;
 
-    uptr<_lock> m_lock = nullptr;
-    uptr<_notif> m_notif;
-    int32_t volatile m_counter;
-    void *volatile m_token;
+    std::atomic<uint32_t> m_counter;
+    std::atomic<_notif *> m_notifs;
 };
 
+_Event::~_Event()
+{
+    /* Never signaled, its continuations won't run */
+    _notif *notif = m_notifs.load(std::memory_order_relaxed);
+    while (notif && notif != Closed) {
+        _notif *next = notif->m_next;
+        delete notif;
+        notif = next;
+    }
+}
+
 sptr<Event> _Event::notify(workq *workq,
                            workq_func func,
                            const sptr<Object> &obj,
                            const sptr<Object> &arg)
 {
-    if (m_token) {
-        void *token = sync_lock_ptr(&m_token);
-        if (token) {
-            auto event = Event::create(1);
-            auto notif = std::make_unique<_notif>(workq, event, func, obj, arg);
-            notif->m_next = std::move(m_notif);
-            m_notif = std::move(notif);
-            notif.reset();
-            sync_unlock_ptr(&m_token, token);
+    /* Nothing to wait for */
+    if (test()) {
+        return workq_execute(workq, func, obj, arg);
+    }
+
+    auto event = Event::create(1);
+    auto notif = new _notif(workq, event, func, obj, arg);
+    _notif *head = m_notifs.load(std::memory_order_acquire);
+    do {
+        if (head == Closed) {
+            /* Signaled since */
+            notif->run();
+            delete notif;
             return event;
         }
-        m_token = nullptr;
-    }
-    return workq_execute(workq, func, obj, arg);
+        notif->m_next = head;
+    } while (!m_notifs.compare_exchange_weak(head,
+                                             notif,
+                                             std::memory_order_release,
+                                             std::memory_order_acquire));
+    return event;
 }
 
 int32_t _Event::signal()
 {
-    ASSERT(m_counter > 0);
-    if (sync_add_i32(&m_counter, -1) == 0) {
-        /* Delete token which marks the event as completed.
-         * Release the locks which will unlock the mutexes
-         * and return from the wait functions
-         */
-        void *tkn = sync_lock_ptr(&m_token);
-        m_token = nullptr;
-        delete (token *)tkn;
-        m_notif.reset();
-        m_lock.reset();
+    uint32_t counter = m_counter.fetch_sub(1, std::memory_order_acq_rel);
+    ASSERT((counter & CountMask) > 0);
+    if ((counter & CountMask) == 1) {
+        /* Closes the list, the continuations added from now on run right away */
+        _notif *notif = m_notifs.exchange(Closed, std::memory_order_acq_rel);
+        while (notif) {
+            _notif *next = notif->m_next;
+            notif->run();
+            delete notif;
+            notif = next;
+        }
+        if (counter & Sleepers) {
+            FutexWake(&m_counter);
+        }
     }
     return 0;
 }
 
 bool _Event::test() const
 {
-    return m_token == nullptr;
+    return (m_counter.load(std::memory_order_acquire) & CountMask) == 0;
 }
 
 int32_t _Event::wait()
 {
-    if (m_token) {
-        void *token = sync_lock_ptr(&m_token);
-        if (token) {
-            uptr<_lock> lock;
-            std::mutex mutex;
-
-            mutex.lock();
-            lock = create_lock(&mutex);
-
-            /* Add the lock to the list */
-            lock->m_next = std::move(m_lock);
-            m_lock = std::move(lock);
-            lock.reset();
-
-            sync_unlock_ptr(&m_token, token);
+    if (test()) {
+        return 0;
+    }
 
-            /* Exit when the mutex has been unlocked,
-               i.e. lock is destroyed */
-            mutex.lock();
-        }
-        else {
-            m_token = nullptr;
+    /* Most events are signaled shortly after, check them a little before sleeping */
+    uint32_t &budget = SpinBudget();
+    for (uint32_t i = 0; i < budget; ++i) {
+        CpuRelax();
+        if (test()) {
+            budget = std::min(budget * 2, MaxSpins);
+            return 0;
         }
     }
+    if (budget) {
+        budget = std::max(budget / 2, MinSpins);
+    }
+
+    uint32_t counter = m_counter.fetch_or(Sleepers, std::memory_order_acquire) | Sleepers;
+    while (counter & CountMask) {
+        FutexWait(&m_counter, counter);
+        counter = m_counter.load(std::memory_order_acquire);
+    }
     return 0;
 }
 
@@ -152,7 +257,7 @@ static void signal_event(const sptr<Object> &obj, const sptr<Object> &)
 
 sptr<Event> Event::create(int32_t n)
 {
-    return std::make_shared<_Event>(n);
+    return make_pooled<_Event>(n);
 }
 
 sptr<Event> Event::create(const std::vector<sptr<Event>> &events)
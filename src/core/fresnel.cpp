@@ -1,5 +1,6 @@
 #include "rt1w/fresnel.hpp"
 
+#include "rt1w/arena.hpp"
 #include "rt1w/spectrum.hpp"
 
 #pragma mark - Fresnel Dielectric
@@ -43,9 +44,9 @@ Spectrum _FresnelDielectric::eval(float cosThetaI) const
     return (Rparl * Rparl + Rperp * Rperp) / 2 * Spectrum(1.f);
 }
 
-uptr<FresnelDielectric> FresnelDielectric::create(float etaI, float etaT)
+FresnelDielectric *FresnelDielectric::create(Arena &arena, float etaI, float etaT)
 {
-    return std::make_unique<_FresnelDielectric>(etaI, etaT);
+    return arena.make<_FresnelDielectric>(etaI, etaT);
 }
 
 #pragma mark - Fresnel Conductor
@@ -89,9 +90,10 @@ Spectrum _FresnelConductor::eval(float cosThetaI) const
     return 0.5f * (Rp + Rs);
 }
 
-uptr<FresnelConductor> FresnelConductor::create(const Spectrum &etaI,
-                                                const Spectrum &etaT,
-                                                const Spectrum &k)
+FresnelConductor *FresnelConductor::create(Arena &arena,
+                                           const Spectrum &etaI,
+                                           const Spectrum &etaT,
+                                           const Spectrum &k)
 {
-    return std::make_unique<_FresnelConductor>(etaI, etaT, k);
+    return arena.make<_FresnelConductor>(etaI, etaT, k);
 }
@@ -3,15 +3,18 @@
 #include "rt1w/error.h"
 #include "rt1w/event.hpp"
 #include "rt1w/imageio.h"
+#include "rt1w/parallel.hpp"
 #include "rt1w/params.hpp"
+#include "rt1w/workq.hpp"
 
 #include <atomic>
 #include <cstring>
+#include <mutex>
 
 #pragma mark - Image File
 
-struct ImageFile : Image {
-    ImageFile(const std::string &filename);
+struct ImageFile : Image, std::enable_shared_from_this<ImageFile> {
+    ImageFile(const std::string &filename) : m_filename(filename) {}
     ~ImageFile() override
     {
         if (m_buffer.data) {
@@ -19,30 +22,61 @@ struct ImageFile : Image {
         }
     }
 
-    buffer_t buffer() override { return m_buffer; }
-    sptr<Event> schedule() override { return sptr<Event>(); }
-    v2u size() const override { return m_size; }
+    buffer_t buffer() override
+    {
+        start(nullptr)->wait();
+        return m_buffer;
+    }
+    sptr<Event> schedule() override { return start(workq_get_queue()); }
+    v2u size() const override
+    {
+        const_cast<ImageFile *>(this)->start(nullptr)->wait();
+        return m_size;
+    }
+
+    /* The file is decoded on the queue the first time it's scheduled, or by the
+     * first thread that needs the pixels */
+    sptr<Event> start(workq *queue);
+    static void Decode(const sptr<Object> &obj, const sptr<Object> &);
 
     std::string m_filename;
-    buffer_t m_buffer;
-    v2u m_size;
+    buffer_t m_buffer = {};
+    v2u m_size = {};
+    std::once_flag m_started;
+    sptr<Event> m_event;
 };
 
-ImageFile::ImageFile(const std::string &filename)
+sptr<Event> ImageFile::start(workq *queue)
 {
-    m_filename = filename;
-    int32_t err = image_read_png(filename.c_str(), &m_buffer);
+    std::call_once(m_started, [&]() {
+        /* Shared by all the readers, never cancelled with the work that needs it */
+        workq_context context = workq_get_context();
+        context.token = nullptr;
+        workq_context previous = workq_set_context(context);
+        m_event = workq_execute(queue, Decode, shared_from_this(), {});
+        workq_set_context(previous);
+    });
+    return m_event;
+}
+
+void ImageFile::Decode(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto img = std::static_pointer_cast<ImageFile>(obj);
+    int32_t err = image_read_png(img->m_filename.c_str(), &img->m_buffer);
 
     if (!err) {
-        m_size = { m_buffer.rect.size.x, m_buffer.rect.size.y };
+        img->m_size = { img->m_buffer.rect.size.x, img->m_buffer.rect.size.y };
     }
     else {
-        WARNING("Couldn't load image at \"%s\"", filename.c_str());
+        WARNING("Couldn't load image at \"%s\"", img->m_filename.c_str());
     }
 }
 
 #pragma mark - Image Convert
 
+/* Rows converted by each job */
+constexpr size_t ConvertGrain = 16;
+
 template <typename T, typename U>
 float Scale();
 
@@ -63,6 +97,50 @@ template <> float Scale<float, uint8_t>()    { return 1.f / 255.f; }
 template <> float Scale<float, uint16_t>()   { return 1.f / 65535.f; }
 // clang-format on
 
+/* Converts the rows [bgn, end) of b to the format of dst */
+static void ConvertRows(const buffer_t &b,
+                        const buffer_t &dst,
+                        size_t nx,
+                        size_t bgn,
+                        size_t end)
+{
+    buffer_type_t srcType = b.format.type;
+    buffer_type_t dstType = dst.format.type;
+
+    for (size_t y = bgn; y < end; ++y) {
+        const uint8_t *sp = (const uint8_t *)b.data + y * b.bpr;
+        uint8_t *dp = (uint8_t *)dst.data + y * dst.bpr;
+        for (size_t x = 0; x < nx; ++x) {
+            if (srcType == TYPE_UINT8) {
+                if (dstType == TYPE_UINT16) {
+                    ConvertPixel<uint16_t, uint8_t>((void *)dp, (const void *)sp);
+                }
+                else if (dstType == TYPE_FLOAT32) {
+                    ConvertPixel<float, uint8_t>((void *)dp, (const void *)sp);
+                }
+            }
+            else if (srcType == TYPE_UINT16) {
+                if (dstType == TYPE_UINT8) {
+                    ConvertPixel<uint8_t, uint16_t>((void *)dp, (const void *)sp);
+                }
+                else if (dstType == TYPE_FLOAT32) {
+                    ConvertPixel<float, uint16_t>((void *)dp, (const void *)sp);
+                }
+            }
+            else if (srcType == TYPE_FLOAT32) {
+                if (dstType == TYPE_UINT8) {
+                    ConvertPixel<uint8_t, float>((void *)dp, (const void *)sp);
+                }
+                else if (dstType == TYPE_UINT16) {
+                    ConvertPixel<uint16_t, float>((void *)dp, (const void *)sp);
+                }
+            }
+            dp += dst.format.size;
+            sp += b.format.size;
+        }
+    }
+}
+
 struct ImageConvert : Image {
     ImageConvert(const sptr<Image> &image, buffer_format_t fmt) :
         m_img(image),
@@ -113,49 +191,11 @@ sptr<Event> ImageConvert::schedule()
             }
             else {
                 /* Convert */
-                buffer_type_t srcType = b.format.type;
-                buffer_type_t dstType = m_buffer.format.type;
                 size_t nx = m_img->size().x;
                 size_t ny = m_img->size().y;
-
-                for (size_t y = 0; y < ny; ++y) {
-                    const uint8_t *sp = (const uint8_t *)b.data + y * b.bpr;
-                    uint8_t *dp = (uint8_t *)m_buffer.data + y * m_buffer.bpr;
-                    for (size_t x = 0; x < nx; ++x) {
-                        if (srcType == TYPE_UINT8) {
-                            if (dstType == TYPE_UINT16) {
-                                ConvertPixel<uint16_t, uint8_t>((void *)dp,
-                                                                (const void *)sp);
-                            }
-                            else if (dstType == TYPE_FLOAT32) {
-                                ConvertPixel<float, uint8_t>((void *)dp,
-                                                             (const void *)sp);
-                            }
-                        }
-                        else if (srcType == TYPE_UINT16) {
-                            if (dstType == TYPE_UINT8) {
-                                ConvertPixel<uint8_t, uint16_t>((void *)dp,
-                                                                (const void *)sp);
-                            }
-                            else if (dstType == TYPE_FLOAT32) {
-                                ConvertPixel<float, uint16_t>((void *)dp,
-                                                              (const void *)sp);
-                            }
-                        }
-                        else if (srcType == TYPE_FLOAT32) {
-                            if (dstType == TYPE_UINT8) {
-                                ConvertPixel<uint8_t, float>((void *)dp,
-                                                             (const void *)sp);
-                            }
-                            else if (dstType == TYPE_UINT16) {
-                                ConvertPixel<uint16_t, float>((void *)dp,
-                                                              (const void *)sp);
-                            }
-                        }
-                        dp += m_buffer.format.size;
-                        sp += b.format.size;
-                    }
-                }
+                parallel_for(ny, ConvertGrain, [&](size_t bgn, size_t end) {
+                    ConvertRows(b, m_buffer, nx, bgn, end);
+                });
             }
             m_event = Event::create(0);
             m_scheduled.store(1);
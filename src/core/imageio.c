@@ -207,3 +207,34 @@ clean:
 
     return err;
 }
+
+int32_t image_write_pfm(const char *filename,
+                        uint32_t w,
+                        uint32_t h,
+                        uint32_t channels,
+                        const void *data,
+                        size_t bpr)
+{
+    assert(filename);
+    assert(w > 0);
+    assert(h > 0);
+    assert(channels == 1 || channels == 3);
+    assert(data);
+    assert(bpr > 0);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        return 1;
+    }
+
+    /* A negative scale means little endian, the rows go from the bottom up */
+    int32_t err = fprintf(fp, "%s\n%u %u\n-1.0\n", channels == 3 ? "PF" : "Pf", w, h) < 0;
+    for (uint32_t i = h; i > 0 && !err; i--) {
+        const uint8_t *sp = (const uint8_t *)data + (i - 1) * bpr;
+        err = fwrite(sp, sizeof(float) * channels, w, fp) != w;
+    }
+    if (fclose(fp) != 0) {
+        err = 1;
+    }
+    return err;
+}
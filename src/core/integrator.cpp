@@ -1,8 +1,10 @@
 #include "rt1w/integrator.hpp"
 
 #include "integrators/path.hpp"
+#include "integrators/wavefront.hpp"
 #include "integrators/whitted.hpp"
 
+#include "rt1w/aov.hpp"
 #include "rt1w/bxdf.hpp"
 #include "rt1w/error.h"
 #include "rt1w/interaction.hpp"
@@ -13,10 +15,12 @@
 #include "rt1w/sampler.hpp"
 #include "rt1w/sampling.hpp"
 #include "rt1w/scene.hpp"
+#include "rt1w/shape.hpp"
 
 #pragma mark - Light Sampling
 
 static Spectrum EstimateDirect(const Interaction &isect,
+                               const BSDF &bsdf,
                                const v2f &uScaterring,
                                const sptr<Light> &light,
                                const v2f &uLight,
@@ -31,12 +35,11 @@ static Spectrum EstimateDirect(const Interaction &isect,
     v3f wi;
     VisibilityTester vis;
     float lPdf;
-    sptr<BSDF> bsdf = ComputeBSDF(isect);
     Spectrum Li = light->sample_Li(isect, uLight, wi, lPdf, vis);
 
     if (!Li.isBlack() && lPdf > .0f) {
-        Spectrum f = bsdf->f(isect.wo, wi, bsdfFlags) * AbsDot(wi, isect.shading.n);
-        float sPdf = bsdf->pdf(isect.wo, wi, bsdfFlags);
+        Spectrum f = bsdf.f(isect.wo, wi, bsdfFlags) * AbsDot(wi, isect.shading.n);
+        float sPdf = bsdf.pdf(isect.wo, wi, bsdfFlags);
 
         if (!f.isBlack()) {
             if (!vis.visible(scene)) {
@@ -57,29 +60,44 @@ static Spectrum EstimateDirect(const Interaction &isect,
         float sPdf;
         BxDFType sampledType;
         Spectrum f =
-            bsdf->sample_f(isect.wo, uScaterring, wi, sPdf, bsdfFlags, &sampledType)
+            bsdf.sample_f(isect.wo, uScaterring, wi, sPdf, bsdfFlags, &sampledType)
             * AbsDot(wi, isect.shading.n);
         if (!f.isBlack() && sPdf > .0f) {
-            float weight = 1.f;
-            if (!(sampledType & BSDF_SPECULAR)) {
-                lPdf = light->pdf_Li(isect, wi);
-                if (FloatEqual(lPdf, .0f)) {
+            Ray r = SpawnRay(isect, wi);
+
+            /* Cheap rejection of rays that can't reach a finite area light, before
+             * paying for the scene intersection */
+            if (light->type() == LIGHT_AREA) {
+                const auto *area = static_cast<const AreaLight *>(light.get());
+                if (!area->shape()->qIntersect(r)) {
                     return L;
                 }
-                weight = PowerHeuristic(1, sPdf, 1, lPdf);
             }
+
+            /* The light pdf is computed from the hit found by the scene intersection,
+             * instead of intersecting the light's shape a second time */
             Interaction lIsect;
-            Ray r = SpawnRay(isect, wi);
             Li = {};
+            lPdf = .0f;
             if (scene->intersect(r, lIsect)) {
-                if (lIsect.prim->light() == light) {
+                sptr<AreaLight> area = lIsect.prim->light();
+                if (area && area == light) {
                     Li = LightEmitted(lIsect, -wi);
+                    lPdf = area->pdf_Li(isect, lIsect);
                 }
             }
             else {
                 Li = light->Le(r);
+                lPdf = light->pdf_Li(isect, wi);
             }
             if (!Li.isBlack()) {
+                float weight = 1.f;
+                if (!(sampledType & BSDF_SPECULAR)) {
+                    if (FloatEqual(lPdf, .0f)) {
+                        return L;
+                    }
+                    weight = PowerHeuristic(1, sPdf, 1, lPdf);
+                }
                 L += f * Li * weight / sPdf;
             }
         }
@@ -88,6 +106,7 @@ static Spectrum EstimateDirect(const Interaction &isect,
 }
 
 Spectrum UniformSampleOneLight(const Interaction &isect,
+                               const BSDF &bsdf,
                                const sptr<Scene> &scene,
                                const sptr<Sampler> &sampler)
 {
@@ -106,12 +125,31 @@ Spectrum UniformSampleOneLight(const Interaction &isect,
 
     return n
            * EstimateDirect(isect,
+                            bsdf,
                             sampler->sample2D(),
                             light,
                             sampler->sample2D(),
                             scene);
 }
 
+#pragma mark - AOVs
+
+void AOVSample::record(const Interaction &isect)
+{
+    if (requested & AOV_NORMALS) {
+        N = isect.n;
+    }
+    if (requested & AOV_NEAREST) {
+        depth = isect.t;
+    }
+    if (requested & AOV_PRIMITIVE_ID) {
+        primitive = isect.prim.get();
+    }
+    if (requested & AOV_MATERIAL_ID) {
+        material = isect.mat.get();
+    }
+}
+
 #pragma mark - Static Constructor
 
 sptr<Integrator> Integrator::create(const std::string &type,
@@ -121,5 +159,8 @@ sptr<Integrator> Integrator::create(const std::string &type,
     if (type == "path") {
         return PathIntegrator::create(sampler, maxDepth);
     }
+    if (type == "wavefront") {
+        return WavefrontIntegrator::create(sampler, maxDepth);
+    }
     return WhittedIntegrator::create(sampler, maxDepth);
 }
@@ -32,6 +32,11 @@ bool VisibilityTester::visible(const sptr<Scene> &scene) const
     return !scene->qIntersect(ray);
 }
 
+Ray VisibilityTester::ray() const
+{
+    return SpawnRayTo(m_p0, m_p1);
+}
+
 #pragma mark - Point Light
 
 struct _PointLight : PointLight {
@@ -98,6 +103,7 @@ struct _AreaLight : AreaLight {
                        VisibilityTester &vis) const override;
     Spectrum Le(const Ray &) const override { return {}; }
     float pdf_Li(const Interaction &isect, const v3f &wi) const override;
+    float pdf_Li(const Interaction &ref, const Interaction &isect) const override;
 
     Spectrum L(const Interaction &isect, const v3f &w) const override;
     sptr<Shape> shape() const override { return m_shape; }
@@ -113,9 +119,9 @@ Spectrum _AreaLight::sample_Li(const Interaction &isect,
                                float &pdf,
                                VisibilityTester &vis) const
 {
-    Interaction it = m_shape->sample(u);
+    Interaction it = m_shape->sample(isect, u);
     wi = Normalize(it.p - isect.p);
-    pdf = m_shape->pdf();
+    pdf = m_shape->pdf(isect, it);
     vis = { it, isect };
     return L(it, -wi);
 }
@@ -125,6 +131,11 @@ float _AreaLight::pdf_Li(const Interaction &isect, const v3f &wi) const
     return m_shape->pdf(isect, wi);
 }
 
+float _AreaLight::pdf_Li(const Interaction &ref, const Interaction &isect) const
+{
+    return m_shape->pdf(ref, isect);
+}
+
 Spectrum _AreaLight::L(const Interaction &isect, const v3f &w) const
 {
     return Dot(isect.n, w) > 0.0f ? m_Lemit : Spectrum();
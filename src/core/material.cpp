@@ -1,26 +1,18 @@
 #include "rt1w/material.hpp"
 
+#include "rt1w/arena.hpp"
 #include "rt1w/bxdf.hpp"
 #include "rt1w/error.h"
 #include "rt1w/fresnel.hpp"
 #include "rt1w/interaction.hpp"
 #include "rt1w/params.hpp"
+#include "rt1w/primitive.hpp"
 #include "rt1w/ray.hpp"
 #include "rt1w/spectrum.hpp"
 #include "rt1w/texture.hpp"
 #include "rt1w/value.hpp"
 
-#include <vector>
-
-#pragma mark - Interaction
-
-sptr<BSDF> ComputeBSDF(const Interaction &isect)
-{
-    if (isect.mat) {
-        return isect.mat->computeBsdf(isect);
-    }
-    return nullptr;
-}
+#include <unordered_map>
 
 #pragma mark - Lambertian
 
@@ -28,7 +20,10 @@ struct _Lambertian : Lambertian {
     _Lambertian(const sptr<Texture> &Kd) : m_Kd(Kd) {}
 
     Spectrum f(const Interaction &isect, const v3f &wo, const v3f &wi) const override;
-    sptr<BSDF> computeBsdf(const Interaction &isect) const override;
+    MaterialRecord flatten(MaterialTable &table) const override
+    {
+        return { MATERIAL_MATTE, table.add(m_Kd), .0f };
+    }
 
     sptr<Texture> m_Kd;
 };
@@ -38,14 +33,6 @@ Spectrum _Lambertian::f(const Interaction &isect, const v3f &, const v3f &) cons
     return m_Kd->value(isect.uv.x, isect.uv.y, isect.p);
 }
 
-sptr<BSDF> _Lambertian::computeBsdf(const Interaction &isect) const
-{
-    Spectrum Kd = m_Kd->value(isect.uv.x, isect.uv.y, isect.p);
-    std::vector<sptr<BxDF>> bxdfs = { LambertianReflection::create(Kd) };
-
-    return BSDF::create(isect, bxdfs);
-}
-
 sptr<Lambertian> Lambertian::create(const sptr<Texture> &Kd)
 {
     return std::make_shared<_Lambertian>(Kd);
@@ -69,7 +56,10 @@ struct _Metal : Metal {
     {
         return {};
     }
-    sptr<BSDF> computeBsdf(const Interaction &isect) const override;
+    MaterialRecord flatten(MaterialTable &table) const override
+    {
+        return { MATERIAL_METAL, table.add(m_albedo), m_fuzz };
+    }
 
     sptr<Texture> m_albedo;
     float m_fuzz;
@@ -81,18 +71,6 @@ _Metal::_Metal(const sptr<Texture> &tex, float f)
     m_fuzz = fminf(1.0f, f);
 }
 
-sptr<BSDF> _Metal::computeBsdf(const Interaction &isect) const
-{
-    Spectrum R = m_albedo->value(isect.uv.x, isect.uv.y, isect.p);
-    Spectrum eta = Spectrum(1.2f);
-    Spectrum k = Spectrum(2.2f);
-    std::vector<sptr<BxDF>> bxdfs = {
-        SpecularReflection::create(R, FresnelConductor::create(Spectrum(1.f), eta, k))
-    };
-
-    return BSDF::create(isect, bxdfs);
-}
-
 #pragma mark - Dieletric
 
 struct _Dielectric : Dielectric {
@@ -102,18 +80,154 @@ struct _Dielectric : Dielectric {
     {
         return {};
     }
-    sptr<BSDF> computeBsdf(const Interaction &isect) const override;
+    MaterialRecord flatten(MaterialTable &) const override
+    {
+        return { MATERIAL_DIELECTRIC, 0, m_eta };
+    }
 
     float m_eta;
 };
 
-sptr<BSDF> _Dielectric::computeBsdf(const Interaction &isect) const
+#pragma mark - Material Table
+
+struct _MaterialTable : MaterialTable {
+    uint32_t add(const sptr<Texture> &texture) override;
+    uint32_t add(const TextureRecord &record) override;
+    uint32_t add(const sptr<Image> &image) override;
+
+    const std::vector<MaterialRecord> &materials() const override { return m_materials; }
+    const std::vector<TextureRecord> &textures() const override { return m_textures; }
+
+    BSDF *computeBsdf(const Interaction &isect, Arena &arena) const override;
+    void computeBsdfs(uint32_t material,
+                      const Interaction *const *isects,
+                      size_t n,
+                      Arena &arena,
+                      BSDF **bsdfs) const override;
+
+    void flatten(const sptr<Primitive> &primitive);
+    Spectrum texture(uint32_t index, const Interaction &isect) const
+    {
+        return EvaluateTexture(m_textures, m_images, index, isect.uv.x, isect.uv.y);
+    }
+
+    std::vector<MaterialRecord> m_materials;
+    std::vector<TextureRecord> m_textures;
+    std::vector<sptr<Image>> m_images;
+
+    /* Only while flattening, the records already added */
+    std::unordered_map<const Material *, uint32_t> m_materialIndices;
+    std::unordered_map<const Texture *, uint32_t> m_textureIndices;
+    std::unordered_map<const Image *, uint32_t> m_imageIndices;
+};
+
+uint32_t _MaterialTable::add(const sptr<Texture> &texture)
+{
+    auto it = m_textureIndices.find(texture.get());
+    if (it != m_textureIndices.end()) {
+        return it->second;
+    }
+    uint32_t index = texture->flatten(*this);
+    m_textureIndices.emplace(texture.get(), index);
+    return index;
+}
+
+uint32_t _MaterialTable::add(const TextureRecord &record)
 {
-    std::vector<sptr<BxDF>> bxdfs = {
-        SpecularReflection::create(Spectrum(1.f), FresnelDielectric::create(1.0f, m_eta))
-    };
+    m_textures.push_back(record);
+    return (uint32_t)m_textures.size() - 1;
+}
 
-    return BSDF::create(isect, bxdfs);
+uint32_t _MaterialTable::add(const sptr<Image> &image)
+{
+    auto it = m_imageIndices.find(image.get());
+    if (it != m_imageIndices.end()) {
+        return it->second;
+    }
+    m_images.push_back(image);
+    auto index = (uint32_t)m_images.size() - 1;
+    m_imageIndices.emplace(image.get(), index);
+    return index;
+}
+
+/* The primitives of an aggregate, e.g. the triangles of a mesh, are numbered one by
+ * one as they may have their own material */
+void _MaterialTable::flatten(const sptr<Primitive> &primitive)
+{
+    if (sptr<Aggregate> agg = std::dynamic_pointer_cast<Aggregate>(primitive)) {
+        for (const auto &p : agg->primitives()) {
+            flatten(p);
+        }
+        return;
+    }
+    sptr<Material> material = primitive->material();
+    if (!material) {
+        primitive->setMaterialIndex(NoMaterial);
+        return;
+    }
+    auto it = m_materialIndices.find(material.get());
+    if (it == m_materialIndices.end()) {
+        MaterialRecord record = material->flatten(*this);
+        m_materials.push_back(record);
+        auto index = (uint32_t)m_materials.size() - 1;
+        it = m_materialIndices.emplace(material.get(), index).first;
+    }
+    primitive->setMaterialIndex(it->second);
+}
+
+BSDF *_MaterialTable::computeBsdf(const Interaction &isect, Arena &arena) const
+{
+    const Interaction *isects[] = { &isect };
+    BSDF *bsdf = nullptr;
+    computeBsdfs(isect.matIndex, isects, 1, arena, &bsdf);
+    return bsdf;
+}
+
+void _MaterialTable::computeBsdfs(uint32_t material,
+                                  const Interaction *const *isects,
+                                  size_t n,
+                                  Arena &arena,
+                                  BSDF **bsdfs) const
+{
+    if (material >= m_materials.size()) {
+        std::fill(bsdfs, bsdfs + n, nullptr);
+        return;
+    }
+
+    /* The BSDFs of the batch share their Fresnel term, built with them in the arena */
+    const MaterialRecord &m = m_materials[material];
+    switch (m.op) {
+    case MATERIAL_MATTE:
+        for (size_t i = 0; i < n; ++i) {
+            Spectrum Kd = texture(m.texture, *isects[i]);
+            bsdfs[i] = BSDF::create(arena, *isects[i]);
+            bsdfs[i]->add(LambertianReflection::create(arena, Kd));
+        }
+        break;
+    case MATERIAL_METAL: {
+        Spectrum eta = Spectrum(1.2f);
+        Spectrum k = Spectrum(2.2f);
+        const Fresnel *fresnel = FresnelConductor::create(arena, Spectrum(1.f), eta, k);
+        for (size_t i = 0; i < n; ++i) {
+            Spectrum R = texture(m.texture, *isects[i]);
+            bsdfs[i] = BSDF::create(arena, *isects[i]);
+            bsdfs[i]->add(SpecularReflection::create(arena, R, fresnel));
+        }
+        break;
+    }
+    case MATERIAL_DIELECTRIC: {
+        const Fresnel *fresnel = FresnelDielectric::create(arena, 1.0f, m.param);
+        for (size_t i = 0; i < n; ++i) {
+            bsdfs[i] = BSDF::create(arena, *isects[i]);
+            bsdfs[i]->add(SpecularReflection::create(arena, Spectrum(1.f), fresnel));
+        }
+        break;
+    }
+    default:
+        ERROR("Unknown material op %u", (unsigned)m.op);
+        std::fill(bsdfs, bsdfs + n, nullptr);
+        break;
+    }
 }
 
 #pragma mark - Static constructors
@@ -152,6 +266,18 @@ sptr<Dielectric> Dielectric::create(const sptr<Params> &p)
     return nullptr;
 }
 
+sptr<MaterialTable> MaterialTable::create(const sptr<Primitive> &world)
+{
+    auto table = std::make_shared<_MaterialTable>();
+    if (world) {
+        table->flatten(world);
+    }
+    table->m_materialIndices.clear();
+    table->m_textureIndices.clear();
+    table->m_imageIndices.clear();
+    return table;
+}
+
 sptr<Material> Material::create(const sptr<Params> &p)
 {
     std::string type = p->string("type");
@@ -0,0 +1,67 @@
+#include "rt1w/parallel.hpp"
+
+#include "rt1w/error.h"
+#include "rt1w/event.hpp"
+#include "rt1w/pool.hpp"
+#include "rt1w/workq.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+/* The ranges of a parallel_for(), claimed in order by the calling thread and the
+ * threads of the queue. The threads that start once all the ranges are claimed
+ * return without calling func, which lives on the stack of the caller. */
+struct _ranges : Object {
+    _ranges(size_t count, size_t grain, const std::function<void(size_t, size_t)> &func) :
+        m_count(count),
+        m_grain(grain),
+        m_n((count + grain - 1) / grain),
+        m_func(&func),
+        m_event(Event::create(1))
+    {}
+
+    size_t m_count;
+    size_t m_grain;
+    size_t m_n;
+    const std::function<void(size_t, size_t)> *m_func;
+    sptr<Event> m_event;
+    std::atomic<size_t> m_next{ 0 };
+    std::atomic<size_t> m_done{ 0 };
+};
+
+static void RunRanges(const sptr<Object> &obj, size_t)
+{
+    auto r = std::static_pointer_cast<_ranges>(obj);
+    size_t done = 0;
+    for (size_t i; (i = r->m_next.fetch_add(1)) < r->m_n;) {
+        size_t begin = i * r->m_grain;
+        (*r->m_func)(begin, std::min(begin + r->m_grain, r->m_count));
+        done++;
+    }
+    if (done && r->m_done.fetch_add(done) + done == r->m_n) {
+        r->m_event->signal();
+    }
+}
+
+void parallel_for(size_t count,
+                  size_t grain,
+                  const std::function<void(size_t, size_t)> &func)
+{
+    ASSERT(grain > 0);
+
+    if (count <= grain) {
+        if (count > 0) {
+            func(0, count);
+        }
+        return;
+    }
+
+    workq *queue = workq_get_queue();
+    auto ranges = make_pooled<_ranges>(count, grain, func);
+    size_t helpers = std::min(ranges->m_n - 1, (size_t)workq_concurrency(queue));
+    workq_execute_n(queue, helpers, RunRanges, ranges);
+
+    /* Only waits for the ranges the other threads are working on */
+    RunRanges(ranges, 0);
+    ranges->m_event->wait();
+}
@@ -17,12 +17,16 @@ struct _Primitive : Primitive, std::enable_shared_from_this<Primitive> {
 
     bounds3f bounds() const override;
     sptr<AreaLight> light() const override { return m_light; }
+    sptr<Material> material() const override { return m_material; }
+    void setMaterial(const sptr<Material> &m) override { m_material = m; }
+    void setMaterialIndex(uint32_t index) override { m_materialIndex = index; }
 
     bool intersect(const Ray &r, Interaction &isect) const override;
     bool qIntersect(const Ray &r) const override;
 
     sptr<Shape> m_shape;
     sptr<Material> m_material;
+    uint32_t m_materialIndex = NoMaterial;
     sptr<AreaLight> m_light;
 };
 
@@ -35,6 +39,7 @@ bool _Primitive::intersect(const Ray &r, Interaction &isect) const
 {
     if (m_shape->intersect(r, isect)) {
         isect.mat = m_material;
+        isect.matIndex = m_materialIndex;
         /* This is ok because Primitive only has const methods */
         isect.prim = std::const_pointer_cast<Primitive>(shared_from_this());
         return true;
@@ -97,7 +102,10 @@ struct _Aggregate : Aggregate {
     bool intersect(const Ray &r, Interaction &isect) const override;
     bool qIntersect(const Ray &r) const override;
     bounds3f bounds() const override { return m_bounds; }
-    sptr<AreaLight> light() const override;
+    [[noreturn]] sptr<AreaLight> light() const override;
+    [[noreturn]] sptr<Material> material() const override;
+    [[noreturn]] void setMaterial(const sptr<Material> &) override;
+    [[noreturn]] void setMaterialIndex(uint32_t) override;
 
     const std::vector<sptr<Primitive>> &primitives() const override
     {
@@ -121,6 +129,21 @@ sptr<AreaLight> _Aggregate::light() const
     trap("Aggregate::light() should never be called");
 }
 
+sptr<Material> _Aggregate::material() const
+{
+    trap("Aggregate::material() should never be called");
+}
+
+void _Aggregate::setMaterial(const sptr<Material> &)
+{
+    trap("Aggregate::setMaterial() should never be called");
+}
+
+void _Aggregate::setMaterialIndex(uint32_t)
+{
+    trap("Aggregate::setMaterialIndex() should never be called");
+}
+
 bool _Aggregate::intersect(const Ray &r, Interaction &isect) const
 {
     bool hit = false;
@@ -19,68 +19,55 @@ static inline uint64_t rotl(const uint64_t x, int k)
     return (x << k) | (x >> (64 - k));
 }
 
-struct xoroshiro256plus {
-    xoroshiro256plus(uint64_t seed)
-    {
-        uint64_t x = seed;
-        for (size_t i = 0; i < 4; i++) {
-            x = splitmix64(x);
-            s[i] = x;
-        }
-    }
-    uint64_t next()
-    {
-        const uint64_t r = s[0] + s[3];
-        const uint64_t t = s[1] << 17;
-
-        s[2] ^= s[0];
-        s[3] ^= s[1];
-        s[1] ^= s[2];
-        s[0] ^= s[3];
+static inline uint64_t next(uint64_t s[4])
+{
+    const uint64_t r = s[0] + s[3];
+    const uint64_t t = s[1] << 17;
 
-        s[2] ^= t;
-        s[3] = rotl(s[3], 45);
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
 
-        return r;
-    }
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
 
-    double uniform_double()
-    {
-        uint64_t x = next();
-        return (x >> 11) * (1. / (UINT64_C(1) << 53));
-    }
-
-    uint64_t s[4];
-};
-
-struct _RNG : RNG {
-    _RNG(uint64_t seed) : m_xs256p(xoroshiro256plus(seed)) {}
+    return r;
+}
 
-    uint32_t u32() override;
-    float f32() override;
+static inline double uniform_double(uint64_t s[4])
+{
+    uint64_t x = next(s);
+    return (x >> 11) * (1. / (UINT64_C(1) << 53));
+}
 
-    uint32_t u32(uint32_t b) override;
-    float f32(float b) override;
+#pragma mark - RNG State
 
-    xoroshiro256plus m_xs256p;
-};
+RNGState::RNGState(uint64_t seed)
+{
+    uint64_t x = seed;
+    for (size_t i = 0; i < 4; i++) {
+        x = splitmix64(x);
+        s[i] = x;
+    }
+}
 
-uint32_t _RNG::u32()
+uint32_t RNGState::u32()
 {
     uint32_t max = std::numeric_limits<uint32_t>::max();
     return (uint32_t)std::floor(f32() * max);
 }
 
-float _RNG::f32()
+float RNGState::f32()
 {
     float f;
     do {
-        f = (float)m_xs256p.uniform_double();
+        f = (float)uniform_double(s);
     } while (f >= 1.0f);
     return f;
 }
 
-uint32_t _RNG::u32(uint32_t b)
+uint32_t RNGState::u32(uint32_t b)
 {
     float f = f32();
     auto v = (uint32_t)std::floor(f * b);
@@ -88,16 +75,36 @@ uint32_t _RNG::u32(uint32_t b)
     return v;
 }
 
-float _RNG::f32(float b)
+float RNGState::f32(float b)
 {
     float v = f32() * b;
     ASSERT(v < b);
     return v;
 }
 
+#pragma mark - RNG
+
+struct _RNG : RNG {
+    _RNG(uint64_t seed) : m_state(seed) {}
+
+    void seed(uint64_t seed) override { m_state = RNGState(seed); }
+    uint32_t u32() override { return m_state.u32(); }
+    float f32() override { return m_state.f32(); }
+
+    uint32_t u32(uint32_t b) override { return m_state.u32(b); }
+    float f32(float b) override { return m_state.f32(b); }
+
+    RNGState m_state;
+};
+
 #pragma mark - Static Constructor
 
 uptr<RNG> RNG::create()
 {
     return std::make_unique<_RNG>(std::random_device()());
 }
+
+uptr<RNG> RNG::create(uint64_t seed)
+{
+    return std::make_unique<_RNG>(seed);
+}
@@ -43,6 +43,13 @@ static void Shuffle(T *smp, size_t n, RNG &rng)
     }
 }
 
+/* Mixes the seed so that consecutive ones don't map to neighbouring pixels */
+static inline uint64_t PixelSeed(uint64_t seed, v2i p)
+{
+    uint64_t h = (seed + 1) * 0x9e3779b97f4a7c15;
+    return h ^ ((uint64_t)(uint32_t)p.y << 32 | (uint32_t)p.x);
+}
+
 struct _Sampler : Sampler {
     _Sampler(uint32_t x, uint32_t y, uint32_t dim, bool jitter) :
         m_spp(x * y),
@@ -50,12 +57,28 @@ struct _Sampler : Sampler {
         m_y(y),
         m_dim(dim),
         m_jitter(jitter),
+        m_seeded(false),
+        m_seed(0),
         m_rng(RNG::create())
     {}
+    /* The seeded samplers reseed their generator at each pixel, no need to draw
+     * from the system's entropy first */
+    _Sampler(const _Sampler *s, uint64_t seed) :
+        m_spp(s->m_spp),
+        m_x(s->m_x),
+        m_y(s->m_y),
+        m_dim(s->m_dim),
+        m_jitter(s->m_jitter),
+        m_seeded(true),
+        m_seed(seed),
+        m_rng(RNG::create(seed))
+    {}
     void init();
 
     uint64_t samplesPerPixel() const override { return m_spp; }
     sptr<Sampler> clone() const override;
+    sptr<Sampler> clone(uint64_t seed) const override;
+    void seed(uint64_t seed) override;
 
     float sample1D() override;
     v2f sample2D() override;
@@ -70,6 +93,9 @@ struct _Sampler : Sampler {
     const uint32_t m_dim;
     const bool m_jitter;
 
+    bool m_seeded;
+    uint64_t m_seed;
+
     v2i m_pixel;    // Current pixel
     size_t m_ix;    // Current sample
 
@@ -94,6 +120,19 @@ sptr<Sampler> _Sampler::clone() const
     return Sampler::create(m_x, m_y, m_dim, m_jitter);
 }
 
+sptr<Sampler> _Sampler::clone(uint64_t seed) const
+{
+    auto sampler = std::make_shared<_Sampler>(this, seed);
+    sampler->init();
+    return sampler;
+}
+
+void _Sampler::seed(uint64_t seed)
+{
+    m_seeded = true;
+    m_seed = seed;
+}
+
 float _Sampler::sample1D()
 {
     if (m_1d_dim < m_samples1D.size()) {
@@ -123,6 +162,9 @@ void _Sampler::startPixel(v2i p)
     m_1d_dim = 0;
     m_2d_dim = 0;
 
+    if (m_seeded) {
+        m_rng->seed(PixelSeed(m_seed, p));
+    }
     for (size_t i = 0; i < m_samples1D.size(); i++) {
         GenerateSamples1D(&m_samples1D[i][0], (size_t)m_spp, *m_rng, m_jitter);
         Shuffle(&m_samples1D[i][0], m_spp, *m_rng);
@@ -25,6 +25,136 @@ v2f UniformSampleTriangle(const v2f &u)
     return { 1.0f - su0, u.y * su0 };
 }
 
+v3f UniformSampleCone(const v2f &u, float cosThetaMax)
+{
+    float cosTheta = (1.f - u.x) + u.x * cosThetaMax;
+    float sinTheta = std::sqrt(std::max(.0f, 1.f - cosTheta * cosTheta));
+    float phi = 2.0f * (float)Pi * u.y;
+
+    return { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+}
+
+float UniformConePdf(float cosThetaMax)
+{
+    return (float)(1. / (2. * Pi * (1. - cosThetaMax)));
+}
+
+float SphericalTriangleArea(const v3f &a, const v3f &b, const v3f &c)
+{
+    float y = Dot(a, Cross(b, c));
+    float x = 1 + Dot(a, b) + Dot(a, c) + Dot(b, c);
+
+    return std::abs(2.f * std::atan2(y, x));
+}
+
+static float AngleBetween(const v3f &v1, const v3f &v2)
+{
+    if (Dot(v1, v2) < 0) {
+        return (float)Pi - 2 * std::asin(std::min(1.f, (v1 + v2).length() / 2));
+    }
+    return 2 * std::asin(std::min(1.f, (v2 - v1).length() / 2));
+}
+
+static v3f GramSchmidt(const v3f &v, const v3f &w)
+{
+    return v - Dot(v, w) * w;
+}
+
+/* Projects triangle v on the unit sphere around p, sets the angles of the spherical
+ * triangle and returns its area, 0 if it's degenerate */
+static float SphericalTriangle(const v3f v[3], const v3f &p, v3f w[3], float angles[3])
+{
+    for (size_t i = 0; i < 3; ++i) {
+        w[i] = Normalize(v[i] - p);
+    }
+
+    /* Normals of the planes containing the spherical triangle edges */
+    v3f nab = Cross(w[0], w[1]);
+    v3f nbc = Cross(w[1], w[2]);
+    v3f nca = Cross(w[2], w[0]);
+    if (FloatEqual(nab.length_sq(), .0f) || FloatEqual(nbc.length_sq(), .0f)
+        || FloatEqual(nca.length_sq(), .0f)) {
+        return .0f;
+    }
+    nab = Normalize(nab);
+    nbc = Normalize(nbc);
+    nca = Normalize(nca);
+
+    angles[0] = AngleBetween(nab, -nca);
+    angles[1] = AngleBetween(nbc, -nab);
+    angles[2] = AngleBetween(nca, -nbc);
+
+    float area = angles[0] + angles[1] + angles[2] - (float)Pi;
+    return area > .0f ? area : .0f;
+}
+
+bool CanSampleSphericalTriangle(const v3f v[3], const v3f &p)
+{
+    v3f w[3];
+    float angles[3];
+    return SphericalTriangle(v, p, w, angles) > .0f;
+}
+
+v3f SampleSphericalTriangle(const v3f v[3], const v3f &p, const v2f &u, float &pdf)
+{
+    pdf = .0f;
+
+    /* Spherical triangle vertices, angles & area */
+    v3f sv[3];
+    float angles[3];
+    float area = SphericalTriangle(v, p, sv, angles);
+    if (!(area > .0f)) {
+        return {};
+    }
+    pdf = 1.f / area;
+
+    const v3f &a = sv[0];
+    const v3f &b = sv[1];
+    const v3f &c = sv[2];
+    float alpha = angles[0];
+    float beta = angles[1];
+    float gamma = angles[2];
+
+    /* Sub-triangle area selected by u.x, find the matching vertex c' on arc ac */
+    float areap = Lerp(u.x, (float)Pi, alpha + beta + gamma);
+    float cosAlpha = std::cos(alpha);
+    float sinAlpha = std::sin(alpha);
+    float sinPhi = std::sin(areap) * cosAlpha - std::cos(areap) * sinAlpha;
+    float cosPhi = std::cos(areap) * cosAlpha + std::sin(areap) * sinAlpha;
+
+    float k1 = cosPhi + cosAlpha;
+    float k2 = sinPhi - sinAlpha * Dot(a, b);
+    float cosBp = (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha)
+                  / ((k2 * sinPhi + k1 * cosPhi) * sinAlpha);
+    cosBp = Clamp(cosBp, -1.f, 1.f);
+    float sinBp = std::sqrt(std::max(.0f, 1.f - cosBp * cosBp));
+    v3f cp = cosBp * a + sinBp * Normalize(GramSchmidt(c, a));
+
+    /* Direction on arc bc' selected by u.y */
+    float cosTheta = 1.f - u.y * (1.f - Dot(cp, b));
+    float sinTheta = std::sqrt(std::max(.0f, 1.f - cosTheta * cosTheta));
+    v3f w = cosTheta * b + sinTheta * Normalize(GramSchmidt(cp, b));
+
+    /* Barycentrics of the point hit by p + w */
+    v3f e1 = v[1] - v[0];
+    v3f e2 = v[2] - v[0];
+    v3f s1 = Cross(w, e2);
+    float divisor = Dot(s1, e1);
+    if (FloatEqual(divisor, .0f)) {
+        return { 1.f / 3.f, 1.f / 3.f, 1.f / 3.f };
+    }
+    float invDivisor = 1.f / divisor;
+    v3f s = p - v[0];
+    float b1 = Clamp(Dot(s, s1) * invDivisor, .0f, 1.f);
+    float b2 = Clamp(Dot(w, Cross(s, e1)) * invDivisor, .0f, 1.f);
+    if (b1 + b2 > 1) {
+        float sum = b1 + b2;
+        b1 /= sum;
+        b2 /= sum;
+    }
+    return { 1.f - b1 - b2, b1, b2 };
+}
+
 v3f CosineSampleHemisphere(const v2f &u)
 {
     v2f d = UniformSampleDisk(u);
@@ -3,15 +3,19 @@
 #include "rt1w/accelerator.hpp"
 #include "rt1w/camera.hpp"
 #include "rt1w/error.h"
+#include "rt1w/event.hpp"
 #include "rt1w/light.hpp"
 #include "rt1w/material.hpp"
 #include "rt1w/params.hpp"
 #include "rt1w/primitive.hpp"
+#include "rt1w/ray.hpp"
 #include "rt1w/shape.hpp"
 #include "rt1w/spectrum.hpp"
+#include "rt1w/task.hpp"
 #include "rt1w/texture.hpp"
 #include "rt1w/transform.hpp"
 #include "rt1w/value.hpp"
+#include "rt1w/workq.hpp"
 
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
@@ -19,8 +23,10 @@
 
 #include <libgen.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #pragma mark Utils
@@ -208,15 +214,57 @@ struct _RenderDesc : RenderDescription {
     const std::vector<sptr<Light>> &lights() const override { return m_lights; }
     sptr<Camera> camera() const override { return m_camera; }
     sptr<const Params> options() const override { return m_options; }
+    const std::vector<sptr<Camera>> &cameras() const override { return m_cameras; }
+    sptr<Event> schedule() override { return Event::create(0); }
+
+    bool setCamera(const std::string &) override { return notEditable(); }
+    bool setMaterial(const std::string &) override { return notEditable(); }
+    bool setLights(const std::string &) override { return notEditable(); }
+
+    bool notEditable() const
+    {
+        ERROR("Only the scenes loaded from a file can be edited");
+        return false;
+    }
 
     std::vector<sptr<Primitive>> m_primitives;
     std::vector<sptr<Light>> m_lights;
     sptr<Camera> m_camera;
     sptr<Params> m_options;
+    std::vector<sptr<Camera>> m_cameras;
 };
 
 #pragma mark - Render From JSON
 
+/* A shape created on the work queue */
+struct _LoadShape : Object {
+    sptr<Params> m_params;
+    sptr<Shape> m_shape;
+    sptr<Event> m_event;
+};
+
+static void LoadShape(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto job = std::static_pointer_cast<_LoadShape>(obj);
+    job->m_shape = Shape::create(job->m_params);
+}
+
+/* A primitive created on the work queue, once its shape is if it has one */
+struct _LoadPrimitive : Object {
+    sptr<Params> m_params;
+    sptr<Primitive> m_primitive;
+    sptr<Event> m_event;
+};
+
+static void LoadPrimitive(const sptr<Object> &obj, const sptr<Object> &arg)
+{
+    auto job = std::static_pointer_cast<_LoadPrimitive>(obj);
+    if (auto shape = std::static_pointer_cast<_LoadShape>(arg)) {
+        job->m_params->insert(job->m_params->string("shape"), shape->m_shape);
+    }
+    job->m_primitive = Primitive::create(job->m_params);
+}
+
 struct _RenderDescFromJSON : RenderDescription {
     _RenderDescFromJSON(const std::string &path) : m_path(path) {}
 
@@ -227,10 +275,20 @@ struct _RenderDescFromJSON : RenderDescription {
     const std::vector<sptr<Light>> &lights() const override { return m_lights; }
     sptr<Camera> camera() const override { return m_camera; }
     sptr<const Params> options() const override { return m_options; }
+    const std::vector<sptr<Camera>> &cameras() const override { return m_cameras; }
+    sptr<Event> schedule() override { return m_textureEvent; }
+
+    bool setCamera(const std::string &json) override;
+    bool setMaterial(const std::string &json) override;
+    bool setLights(const std::string &json) override;
 
     int32_t init();
+    bool parse(const std::string &json, rapidjson::Document &doc) const;
 
     std::vector<sptr<Light>> read_light(const rapidjson::Value &v) const;
+    bool read_lights(const rapidjson::Value &v,
+                     std::vector<sptr<Light>> &lights,
+                     std::vector<sptr<Primitive>> &primitives) const;
     sptr<Material> read_material(const rapidjson::Value &v) const;
     sptr<Shape> read_shape(const rapidjson::Value &v) const;
     sptr<Texture> read_texture(const rapidjson::Value &v) const;
@@ -240,8 +298,10 @@ struct _RenderDescFromJSON : RenderDescription {
     void load_materials();
     void load_options();
     void load_primitives();
+    void load_sequence();
     void load_shapes();
     void load_textures();
+    void wait_primitives();
 
     std::string m_path;
     std::string m_dir;
@@ -253,9 +313,21 @@ struct _RenderDescFromJSON : RenderDescription {
     sptr<Camera> m_camera;
     sptr<Params> m_options;
 
+    std::vector<sptr<Camera>> m_cameras;
+
+    /* The primitives of the area lights come after this many */
+    size_t m_shapePrimitives = 0;
+
     std::map<std::string, sptr<Object>> m_textures;
     std::map<std::string, sptr<Object>> m_materials;
     std::map<std::string, sptr<Object>> m_shapes;
+
+    /* Jobs of the shapes and primitives being loaded */
+    std::map<std::string, sptr<_LoadShape>> m_shapeJobs;
+    std::vector<sptr<_LoadPrimitive>> m_primitiveJobs;
+
+    /* Signaled once the images of the textures are decoded */
+    sptr<Event> m_textureEvent;
 };
 
 int32_t _RenderDescFromJSON::init()
@@ -279,12 +351,17 @@ int32_t _RenderDescFromJSON::init()
     std::string cpy = m_path;
     m_dir = std::string(dirname(&*std::begin(cpy)));
 
+    /* The images, shapes and primitives are loaded on the work queue while the
+     * rest of the file is read */
     load_textures();
     load_materials();
     load_shapes();
+    load_primitives();
     load_camera();
+    load_sequence();
     load_options();
-    load_primitives();
+    wait_primitives();
+    m_shapePrimitives = m_primitives.size();
     load_lights();
 
     LOG("Loaded scene %s, %lu primitives, %lu lights",
@@ -343,6 +420,7 @@ sptr<Texture> _RenderDescFromJSON::read_texture(const rapidjson::Value &v) const
 
 void _RenderDescFromJSON::load_textures()
 {
+    std::vector<sptr<Event>> events;
     auto section = m_doc.FindMember("textures");
     if (section != m_doc.MemberEnd()) {
         for (const auto &v : section->value.GetArray()) {
@@ -353,6 +431,7 @@ void _RenderDescFromJSON::load_textures()
 
                 if (!k.empty() && tex) {
                     m_textures.insert(std::make_pair(k, tex));
+                    events.push_back(tex->schedule());
                 }
                 WARNING_IF(!tex, "Couldn't create texture \"%s\"", k.c_str());
             }
@@ -361,6 +440,7 @@ void _RenderDescFromJSON::load_textures()
             }
         }
     }
+    m_textureEvent = Event::create(events);
 }
 
 void _RenderDescFromJSON::load_materials()
@@ -391,11 +471,10 @@ void _RenderDescFromJSON::load_shapes()
         for (const auto &v : section->value.GetArray()) {
             auto itn = v.FindMember("name");
             if (itn != v.MemberEnd()) {
-                std::string k = itn->value.GetString();
-                sptr<Shape> shape = read_shape(v);
-
-                WARNING_IF(!shape, "Couldn't create shape \"%s\"", k.c_str());
-                m_shapes.insert(std::make_pair(k, shape));
+                auto job = std::make_shared<_LoadShape>();
+                job->m_params = read_params(v, m_dir);
+                job->m_event = workq_execute(workq_get_queue(), LoadShape, job, {});
+                m_shapeJobs.insert(std::make_pair(itn->value.GetString(), job));
             }
         }
     }
@@ -407,26 +486,40 @@ void _RenderDescFromJSON::load_lights()
 {
     auto section = m_doc.FindMember("lights");
     if (section != m_doc.MemberEnd()) {
-        size_t ix = 0;
-        for (const auto &v : section->value.GetArray()) {
-            std::vector<sptr<Light>> lights = read_light(v);
-            if (!lights.empty()) {
-                for (const auto &light : lights) {
-                    m_lights.push_back(light);
-                    /* Area lights need to be added to the scene's primitives so it can be
-                     * part of the interesection test */
-                    if (sptr<AreaLight> area = std::dynamic_pointer_cast<AreaLight>(
-                            light)) {
-                        m_primitives.push_back(
-                            Primitive::create(area->shape(), kNullMaterial, area));
-                    }
+        read_lights(section->value, m_lights, m_primitives);
+    }
+}
+
+bool _RenderDescFromJSON::read_lights(const rapidjson::Value &v,
+                                      std::vector<sptr<Light>> &lights,
+                                      std::vector<sptr<Primitive>> &primitives) const
+{
+    if (!v.IsArray()) {
+        ERROR("\"lights\" must be an array");
+        return false;
+    }
+    bool ok = true;
+    size_t ix = 0;
+    for (const auto &l : v.GetArray()) {
+        std::vector<sptr<Light>> read = read_light(l);
+        if (!read.empty() && read.front()) {
+            for (const auto &light : read) {
+                lights.push_back(light);
+                /* Area lights need to be added to the scene's primitives so it can be
+                 * part of the interesection test */
+                if (sptr<AreaLight> area = std::dynamic_pointer_cast<AreaLight>(light)) {
+                    primitives.push_back(
+                        Primitive::create(area->shape(), kNullMaterial, area));
                 }
             }
-            else {
-                WARNING("Couldn't create light at index %lu", ix);
-            }
         }
+        else {
+            WARNING("Couldn't create light at index %lu", ix);
+            ok = false;
+        }
+        ix++;
     }
+    return ok;
 }
 
 void _RenderDescFromJSON::load_camera()
@@ -441,6 +534,92 @@ void _RenderDescFromJSON::load_camera()
     }
 }
 
+/* Interpolates the numbers, and the arrays of numbers, that differ from b */
+static void interpolate(rapidjson::Value &a, const rapidjson::Value &b, double t)
+{
+    for (auto &m : a.GetObject()) {
+        auto itb = b.FindMember(m.name);
+        if (itb == b.MemberEnd()) {
+            continue;
+        }
+        const rapidjson::Value &vb = itb->value;
+        if (m.value.IsNumber() && vb.IsNumber()) {
+            if (m.value != vb) {
+                m.value.SetDouble(Lerp(t, m.value.GetDouble(), vb.GetDouble()));
+            }
+        }
+        else if (m.value.IsArray() && vb.IsArray() && m.value.Size() == vb.Size()) {
+            for (rapidjson::SizeType i = 0; i < vb.Size(); ++i) {
+                if (m.value[i].IsNumber() && vb[i].IsNumber() && m.value[i] != vb[i]) {
+                    m.value[i].SetDouble(
+                        Lerp(t, m.value[i].GetDouble(), vb[i].GetDouble()));
+                }
+            }
+        }
+    }
+}
+
+void _RenderDescFromJSON::load_sequence()
+{
+    auto section = m_doc.FindMember("sequence");
+    if (section == m_doc.MemberEnd()) {
+        return;
+    }
+    auto itc = section->value.FindMember("cameras");
+    if (!m_camera || itc == section->value.MemberEnd() || !itc->value.IsArray()
+        || itc->value.Empty()) {
+        ERROR("\"sequence\" needs a \"camera\" and a list of \"cameras\"");
+        return;
+    }
+
+    /* The keyframes override the members of the camera */
+    auto base = m_doc.FindMember("camera");
+    std::vector<rapidjson::Document> keys(itc->value.Size());
+    for (rapidjson::SizeType i = 0; i < itc->value.Size(); ++i) {
+        rapidjson::Document &key = keys[i];
+        key.CopyFrom(base->value, key.GetAllocator());
+        if (!itc->value[i].IsObject()) {
+            WARNING("Camera %u of the sequence must be an object", i);
+            continue;
+        }
+        for (const auto &m : itc->value[i].GetObject()) {
+            auto it = key.FindMember(m.name);
+            if (it != key.MemberEnd()) {
+                it->value.CopyFrom(m.value, key.GetAllocator());
+            }
+            else {
+                key.AddMember(rapidjson::Value(m.name, key.GetAllocator()),
+                              rapidjson::Value(m.value, key.GetAllocator()),
+                              key.GetAllocator());
+            }
+        }
+    }
+
+    /* One frame per camera, unless more frames are spread between them */
+    size_t frames = keys.size();
+    auto itf = section->value.FindMember("frames");
+    if (itf != section->value.MemberEnd() && itf->value.IsUint()) {
+        frames = std::max<size_t>(itf->value.GetUint(), 1);
+    }
+    for (size_t f = 0; f < frames; ++f) {
+        double x = frames > 1 ? (double)f * (keys.size() - 1) / (frames - 1) : .0;
+        auto k = std::min((size_t)x, keys.size() - 1);
+
+        rapidjson::Document camera;
+        camera.CopyFrom(keys[k], camera.GetAllocator());
+        if (k + 1 < keys.size()) {
+            interpolate(camera, keys[k + 1], x - (double)k);
+        }
+        sptr<Camera> c = Camera::create(read_params(camera, m_dir));
+        if (!c) {
+            ERROR("Couldn't create the camera of frame %lu", f);
+            m_cameras.clear();
+            return;
+        }
+        m_cameras.push_back(c);
+    }
+}
+
 void _RenderDescFromJSON::load_options()
 {
     auto section = m_doc.FindMember("options");
@@ -453,40 +632,152 @@ void _RenderDescFromJSON::load_primitives()
 {
     auto section = m_doc.FindMember("primitives");
     if (section != m_doc.MemberEnd()) {
-        size_t ix = 0;
-        auto commons = Params::create(m_textures, m_materials, m_shapes);
+        auto commons = Params::create(m_textures, m_materials);
 
         for (const auto &v : section->value.GetArray()) {
-            if (v.IsObject()) {
-                auto p = Params::create(commons, read_params(v, m_dir));
-
-                if (auto prim = Primitive::create(p)) {
-                    if (auto agg = std::dynamic_pointer_cast<Aggregate>(prim)) {
-                        auto prims = agg->primitives();
-                        m_primitives.insert(std::end(m_primitives),
-                                            std::begin(prims),
-                                            std::end(prims));
-                        m_box = Union(m_box, agg->bounds());
-                    }
-                    else {
-                        m_primitives.emplace_back(prim);
-                        m_box = Union(m_box, prim->bounds());
-                    }
-                    continue;
-                }
-                WARNING("Couldn't create primitive at index %lu", ix);
+            auto job = std::make_shared<_LoadPrimitive>();
+            m_primitiveJobs.push_back(job);
+            if (!v.IsObject()) {
+                continue;
+            }
+            job->m_params = Params::create(commons, read_params(v, m_dir));
+
+            /* Waits only for its own shape */
+            auto it = m_shapeJobs.find(job->m_params->string("shape"));
+            if (it != m_shapeJobs.end()) {
+                job->m_event = it->second->m_event->notify(workq_get_queue(),
+                                                           LoadPrimitive,
+                                                           job,
+                                                           it->second);
             }
             else {
-                WARNING("Primitive at index %lu must be an object", ix);
+                job->m_event = workq_execute(workq_get_queue(), LoadPrimitive, job, {});
             }
-            ix++;
         }
     }
+}
+
+void _RenderDescFromJSON::wait_primitives()
+{
+    for (const auto &s : m_shapeJobs) {
+        s.second->m_event->wait();
+        WARNING_IF(!s.second->m_shape, "Couldn't create shape \"%s\"", s.first.c_str());
+        m_shapes.insert(std::make_pair(s.first, s.second->m_shape));
+    }
+    m_shapeJobs.clear();
+
+    for (size_t ix = 0; ix < m_primitiveJobs.size(); ++ix) {
+        const auto &job = m_primitiveJobs[ix];
+        if (!job->m_event) {
+            WARNING("Primitive at index %lu must be an object", ix);
+            continue;
+        }
+        job->m_event->wait();
+        if (auto agg = std::dynamic_pointer_cast<Aggregate>(job->m_primitive)) {
+            auto prims = agg->primitives();
+            m_primitives.insert(std::end(m_primitives),
+                                std::begin(prims),
+                                std::end(prims));
+            m_box = Union(m_box, agg->bounds());
+        }
+        else if (job->m_primitive) {
+            m_primitives.emplace_back(job->m_primitive);
+            m_box = Union(m_box, job->m_primitive->bounds());
+        }
+        else {
+            WARNING("Couldn't create primitive at index %lu", ix);
+        }
+    }
+    m_primitiveJobs.clear();
+
     if (m_primitives.empty()) {
         ERROR("Couldn't find a primitive");
     }
 }
 
+#pragma mark Edits
+
+bool _RenderDescFromJSON::parse(const std::string &json, rapidjson::Document &doc) const
+{
+    rapidjson::ParseResult ok = doc.Parse<rapidjson::kParseCommentsFlag>(json.c_str());
+    if (!ok) {
+        ERROR("JSON parse error: %s (%lu)", GetParseError_En(ok.Code()), ok.Offset());
+        return false;
+    }
+    return true;
+}
+
+bool _RenderDescFromJSON::setCamera(const std::string &json)
+{
+    rapidjson::Document doc;
+    if (!parse(json, doc)) {
+        return false;
+    }
+    if (!doc.IsObject()) {
+        ERROR("The camera must be an object");
+        return false;
+    }
+    sptr<Camera> camera = Camera::create(read_params(doc, m_dir));
+    if (!camera) {
+        ERROR("Couldn't create the camera");
+        return false;
+    }
+    m_camera = camera;
+    return true;
+}
+
+bool _RenderDescFromJSON::setMaterial(const std::string &json)
+{
+    rapidjson::Document doc;
+    if (!parse(json, doc)) {
+        return false;
+    }
+    auto itn = doc.IsObject() ? doc.FindMember("name") : doc.MemberEnd();
+    if (!doc.IsObject() || itn == doc.MemberEnd() || !itn->value.IsString()) {
+        ERROR("The material must be an object with a name");
+        return false;
+    }
+    std::string k = itn->value.GetString();
+    auto it = m_materials.find(k);
+    if (it == m_materials.end()) {
+        ERROR("Unknown material \"%s\"", k.c_str());
+        return false;
+    }
+    sptr<Material> mat = read_material(doc);
+    if (!mat) {
+        ERROR("Couldn't create material \"%s\"", k.c_str());
+        return false;
+    }
+
+    /* The primitives keep their place in the accelerators */
+    sptr<Material> previous = std::dynamic_pointer_cast<Material>(it->second);
+    for (const auto &prim : m_primitives) {
+        if (!std::dynamic_pointer_cast<Aggregate>(prim) && prim->material() == previous) {
+            prim->setMaterial(mat);
+        }
+    }
+    it->second = mat;
+    return true;
+}
+
+bool _RenderDescFromJSON::setLights(const std::string &json)
+{
+    rapidjson::Document doc;
+    if (!parse(json, doc)) {
+        return false;
+    }
+    std::vector<sptr<Light>> lights;
+    std::vector<sptr<Primitive>> primitives(m_primitives.begin(),
+                                            m_primitives.begin()
+                                                + (ptrdiff_t)m_shapePrimitives);
+    if (!read_lights(doc, lights, primitives)) {
+        return false;
+    }
+    m_lights = lights;
+    m_primitives = primitives;
+    return true;
+}
+
 #pragma mark Static constructors
 
 sptr<RenderDescription> RenderDescription::create(
@@ -510,45 +801,121 @@ sptr<RenderDescription> RenderDescription::load(const std::string &path)
     return nullptr;
 }
 
+#pragma mark - Batch
+
+/* Rays intersected by each job of a batch */
+constexpr size_t BatchGrain = 256;
+
+struct _IntersectBatch : Batch<Interaction>,
+                         std::enable_shared_from_this<_IntersectBatch> {
+    _IntersectBatch(const sptr<Primitive> &world,
+                    const std::vector<Ray> &rays,
+                    bool occlusion) :
+        m_world(world),
+        m_rays(rays),
+        m_isects(rays.size()),
+        m_occlusion(occlusion)
+    {}
+
+    sptr<Event> schedule() override;
+    const std::vector<Interaction> &content() override;
+
+    static void Intersect(const sptr<Object> &obj, const sptr<Object> &arg);
+
+    sptr<Primitive> m_world;
+    std::vector<Ray> m_rays;
+    std::vector<Interaction> m_isects;
+    bool m_occlusion;
+    std::once_flag m_scheduled;
+    sptr<Event> m_event;
+};
+
+sptr<Event> _IntersectBatch::schedule()
+{
+    std::call_once(m_scheduled, [this]() {
+        m_event = workq_execute_ranges(workq_get_queue(),
+                                       m_rays.size(),
+                                       BatchGrain,
+                                       Intersect,
+                                       shared_from_this());
+    });
+    return m_event;
+}
+
+const std::vector<Interaction> &_IntersectBatch::content()
+{
+    schedule()->wait();
+    return m_isects;
+}
+
+void _IntersectBatch::Intersect(const sptr<Object> &obj, const sptr<Object> &arg)
+{
+    auto batch = std::static_pointer_cast<_IntersectBatch>(obj);
+    auto range = std::static_pointer_cast<WorkRange>(arg);
+
+    for (size_t i = range->begin; i < range->end; ++i) {
+        if (batch->m_occlusion) {
+            if (batch->m_world->qIntersect(batch->m_rays[i])) {
+                batch->m_isects[i].t = .0f;
+            }
+        }
+        else {
+            Interaction isect;
+            if (batch->m_world->intersect(batch->m_rays[i], isect)) {
+                batch->m_isects[i] = std::move(isect);
+            }
+        }
+    }
+}
+
 #pragma mark - Scene
 
 struct _Scene : Scene {
     _Scene(const sptr<Primitive> &w, const std::vector<sptr<Light>> &l) :
         m_world(w),
-        m_lights(l)
+        m_lights(l),
+        m_materials(MaterialTable::create(w))
     {}
 
     bounds3f bounds() const override { return m_world->bounds(); }
     const std::vector<sptr<Light>> &lights() const override { return m_lights; }
 
+    const MaterialTable &materials() const override { return *m_materials; }
+    void updateMaterials() override { m_materials = MaterialTable::create(m_world); }
+
     bool intersect(const Ray &r, Interaction &isect) const override
     {
         return m_world->intersect(r, isect);
     }
     bool qIntersect(const Ray &r) const override { return m_world->qIntersect(r); }
 
-    sptr<Batch<Interaction>> intersect(const std::vector<Ray> &) const override
+    sptr<Batch<Interaction>> intersect(const std::vector<Ray> &rays) const override
     {
-        trap("Invalid Batch Intersect on non-Accelerator Primitive");
+        return std::make_shared<_IntersectBatch>(m_world, rays, false);
     }
-    sptr<Batch<Interaction>> qIntersect(const std::vector<Ray> &) const override
+    sptr<Batch<Interaction>> qIntersect(const std::vector<Ray> &rays) const override
     {
-        trap("Invalid Batch Intersect on non-Accelerator Primitive");
+        return std::make_shared<_IntersectBatch>(m_world, rays, true);
     }
 
     sptr<Primitive> m_world;
     std::vector<sptr<Light>> m_lights;
+    sptr<MaterialTable> m_materials;
 };
 
 struct _SceneAccel : Scene {
     _SceneAccel(const sptr<AcceleratorAsync> &w, const std::vector<sptr<Light>> &l) :
         m_world(w),
-        m_lights(l)
+        m_lights(l),
+        m_materials(MaterialTable::create(w))
     {}
 
     bounds3f bounds() const override { return m_world->bounds(); }
     const std::vector<sptr<Light>> &lights() const override { return m_lights; }
 
+    const MaterialTable &materials() const override { return *m_materials; }
+    void updateMaterials() override { m_materials = MaterialTable::create(m_world); }
+
     bool intersect(const Ray &r, Interaction &isect) const override
     {
         return m_world->intersect(r, isect);
@@ -566,6 +933,7 @@ struct _SceneAccel : Scene {
 
     sptr<AcceleratorAsync> m_world;
     std::vector<sptr<Light>> m_lights;
+    sptr<MaterialTable> m_materials;
 };
 
 #pragma mark Static Constructors
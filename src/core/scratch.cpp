@@ -0,0 +1,115 @@
+#include "rt1w/scratch.hpp"
+
+#include "rt1w/arena.hpp"
+#include "rt1w/sampler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/* Only written by the thread, read by stats() */
+struct _counters {
+    std::atomic<uint64_t> tiles{ 0 };
+    std::atomic<uint64_t> samples{ 0 };
+    std::atomic<uint64_t> samplers{ 0 };
+};
+
+static void Add(std::atomic<uint64_t> &counter, uint64_t n)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+}
+
+struct _Scratch;
+
+/* Scratches of the running threads, and the counters of the ones gone */
+struct _registry {
+    std::mutex lock;
+    std::vector<_Scratch *> scratches;
+    ScratchStats retired;
+};
+
+/* Never destroyed, the threads still running at exit unregister from it */
+static _registry &Registry()
+{
+    static auto *r = new _registry;
+    return *r;
+}
+
+struct _Scratch : Scratch {
+    _Scratch();
+    ~_Scratch() override;
+
+    const sptr<Sampler> &sampler(const sptr<const Sampler> &prototype,
+                                 uint64_t seed) override;
+    Arena &arena() override { return Arena::local(); }
+    void count(uint64_t tiles, uint64_t samples) override;
+
+    void addTo(ScratchStats &stats) const;
+
+    std::weak_ptr<const Sampler> m_prototype;
+    sptr<Sampler> m_sampler;
+    _counters m_counters;
+};
+
+_Scratch::_Scratch()
+{
+    _registry &r = Registry();
+    std::lock_guard<std::mutex> lock(r.lock);
+    r.scratches.push_back(this);
+}
+
+_Scratch::~_Scratch()
+{
+    _registry &r = Registry();
+    std::lock_guard<std::mutex> lock(r.lock);
+    addTo(r.retired);
+    r.scratches.erase(std::find(r.scratches.begin(), r.scratches.end(), this));
+}
+
+const sptr<Sampler> &_Scratch::sampler(const sptr<const Sampler> &prototype,
+                                       uint64_t seed)
+{
+    if (m_sampler && m_prototype.lock() == prototype) {
+        m_sampler->seed(seed);
+    }
+    else {
+        m_sampler = prototype->clone(seed);
+        m_prototype = prototype;
+        Add(m_counters.samplers, 1);
+    }
+    return m_sampler;
+}
+
+void _Scratch::count(uint64_t tiles, uint64_t samples)
+{
+    Add(m_counters.tiles, tiles);
+    Add(m_counters.samples, samples);
+}
+
+void _Scratch::addTo(ScratchStats &stats) const
+{
+    stats.tiles += m_counters.tiles.load(std::memory_order_relaxed);
+    stats.samples += m_counters.samples.load(std::memory_order_relaxed);
+    stats.samplers += m_counters.samplers.load(std::memory_order_relaxed);
+}
+
+#pragma mark - Static
+
+Scratch &Scratch::get()
+{
+    static thread_local _Scratch scratch;
+    return scratch;
+}
+
+ScratchStats Scratch::stats()
+{
+    _registry &r = Registry();
+    std::lock_guard<std::mutex> lock(r.lock);
+    ScratchStats stats = r.retired;
+    for (const _Scratch *s : r.scratches) {
+        s->addTo(stats);
+    }
+    return stats;
+}
@@ -0,0 +1,255 @@
+#include "rt1w/server.hpp"
+
+#include "rt1w/accelerator.hpp"
+#include "rt1w/context.hpp"
+#include "rt1w/error.h"
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+#include "rt1w/imageio.h"
+#include "rt1w/params.hpp"
+#include "rt1w/primitive.hpp"
+#include "rt1w/scene.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Passes rendered by a single command at most */
+constexpr uint32_t MaxPasses = 4096;
+
+struct _RenderServer : RenderServer {
+    _RenderServer(const sptr<RenderDescription> &desc,
+                  const std::function<sptr<Render>(const sptr<RenderDescription> &,
+                                                   const sptr<Scene> &)> &create) :
+        m_desc(desc),
+        m_create(create),
+        m_done(false)
+    {}
+
+    std::string execute(const std::string &command) override;
+    bool done() const override { return m_done; }
+
+    sptr<Scene> scene() const override { return m_scene; }
+    sptr<Render> render() override;
+
+    void build();
+
+    sptr<RenderDescription> m_desc;
+    std::function<sptr<Render>(const sptr<RenderDescription> &, const sptr<Scene> &)>
+        m_create;
+
+    /* Primitives the accelerator was built from */
+    std::vector<sptr<Primitive>> m_primitives;
+    sptr<Primitive> m_accel;
+    sptr<Scene> m_scene;
+
+    /* Created on demand after the edits */
+    sptr<Render> m_render;
+    bool m_done;
+};
+
+void _RenderServer::build()
+{
+    if (!m_accel || m_primitives != m_desc->primitives()) {
+        std::string name = Params::string(m_desc->options(), "accelerator", "bvh");
+        m_primitives = m_desc->primitives();
+        m_accel = Accelerator::create(name, m_primitives);
+    }
+    m_scene = Scene::create(m_accel, m_desc->lights());
+}
+
+sptr<Render> _RenderServer::render()
+{
+    if (!m_scene) {
+        build();
+    }
+    if (!m_render) {
+        m_render = m_create(m_desc, m_scene);
+    }
+    return m_render;
+}
+
+static bool WritePNG(const sptr<Image> &image, const std::string &path)
+{
+    auto img = Image::create(image, buffer_format_init(TYPE_UINT8, ORDER_RGB));
+    buffer_t buf = img->buffer();
+    return image_write_png(path.c_str(),
+                           buf.rect.size.x,
+                           buf.rect.size.y,
+                           buf.data,
+                           buf.bpr)
+           == 0;
+}
+
+std::string _RenderServer::execute(const std::string &command)
+{
+    size_t space = command.find(' ');
+    std::string name = command.substr(0, space);
+    std::string args = space == std::string::npos ? "" : command.substr(space + 1);
+
+    if (name == "camera" || name == "material") {
+        bool ok = name == "camera" ? m_desc->setCamera(args) : m_desc->setMaterial(args);
+        if (!ok) {
+            return "error invalid " + name;
+        }
+        if (name == "material" && m_scene) {
+            m_scene->updateMaterials();
+        }
+        m_render = nullptr;
+        return "ok";
+    }
+    if (name == "lights") {
+        if (!m_desc->setLights(args)) {
+            return "error invalid lights";
+        }
+        /* The accelerator is only rebuilt if area lights were changed */
+        if (m_scene) {
+            build();
+        }
+        m_render = nullptr;
+        return "ok";
+    }
+    if (name == "render") {
+        long passes = args.empty() ? 1 : strtol(args.c_str(), nullptr, 10);
+        if (passes <= 0 || passes > MaxPasses) {
+            return "error invalid passes";
+        }
+        sptr<Render> r = render();
+        if (!r) {
+            return "error couldn't create the render";
+        }
+        for (long i = 0; i < passes; ++i) {
+            r->schedulePass()->wait();
+        }
+        return "ok " + std::to_string(r->passes());
+    }
+    if (name == "write") {
+        sptr<Render> r = render();
+        if (args.empty() || !r) {
+            return "error nothing to write";
+        }
+        return WritePNG(r->image(), args) ? "ok" : "error couldn't write " + args;
+    }
+    if (name == "quit") {
+        m_done = true;
+        return "ok";
+    }
+    return "error unknown command " + name;
+}
+
+#pragma mark - Serve
+
+static bool WriteAll(int fd, const std::string &str)
+{
+    const char *p = str.data();
+    size_t size = str.size();
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) {
+            n = write(fd, p, size);
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/* Returns false at the end of the input */
+static bool ReadLine(int fd, std::string &buffer, std::string &line)
+{
+    size_t eol;
+    while ((eol = buffer.find('\n')) == std::string::npos) {
+        char data[4096];
+        ssize_t n = read(fd, data, sizeof(data));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            line = buffer;
+            buffer.clear();
+            return !line.empty();
+        }
+        buffer.append(data, (size_t)n);
+    }
+    line = buffer.substr(0, eol);
+    buffer.erase(0, eol + 1);
+    return true;
+}
+
+void Serve(const sptr<RenderServer> &server, int in, int out)
+{
+    std::string buffer;
+    std::string line;
+    while (!server->done() && ReadLine(in, buffer, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        std::string reply = server->execute(line);
+        if (!WriteAll(out, reply.append("\n"))) {
+            break;
+        }
+    }
+}
+
+bool Serve(const sptr<RenderServer> &server, const std::string &address)
+{
+    std::string path = address.compare(0, 5, "unix:") == 0 ? address.substr(5) : "";
+
+    sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(sun.sun_path)) {
+        ERROR("Invalid address \"%s\", expected unix:<path>", address.c_str());
+        return false;
+    }
+    memcpy(sun.sun_path, path.c_str(), path.size());
+    unlink(sun.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (sockaddr *)&sun, sizeof(sun)) != 0 || listen(fd, 4) != 0) {
+        ERROR("Couldn't listen on \"%s\": %s", address.c_str(), strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    bool ok = true;
+    while (!server->done()) {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERROR("Couldn't accept a client: %s", strerror(errno));
+            ok = false;
+            break;
+        }
+        Serve(server, client, client);
+        close(client);
+    }
+    close(fd);
+    unlink(sun.sun_path);
+    return ok;
+}
+
+#pragma mark - Static constructor
+
+sptr<RenderServer> RenderServer::create(
+    const sptr<RenderDescription> &desc,
+    const std::function<sptr<Render>(const sptr<RenderDescription> &,
+                                     const sptr<Scene> &)> &create)
+{
+    return std::make_shared<_RenderServer>(desc, create);
+}
@@ -20,6 +20,9 @@ sptr<Shape> Shape::create(const sptr<Params> &p)
     if (type == "mesh") {
         return Mesh::create(p);
     }
+    if (type == "binmesh") {
+        return Mesh::create_binary(p);
+    }
     ERROR("Unknown shape : \"%s\"", type.c_str());
 
     return nullptr;
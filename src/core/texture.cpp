@@ -1,17 +1,63 @@
 #include "rt1w/texture.hpp"
 
 #include "rt1w/error.h"
+#include "rt1w/event.hpp"
 #include "rt1w/image.hpp"
+#include "rt1w/material.hpp"
 #include "rt1w/params.hpp"
 #include "rt1w/spectrum.hpp"
 #include "rt1w/value.hpp"
 
 #include <cmath>
 
+static bool CheckerEven(float u, float v)
+{
+    float sines = sinf(10.0f * u) * sinf(10.0f * v);
+    return sines > 0.0f;
+}
+
+static Spectrum ImageValue(const buffer_t &buf, rect_t rect, float u, float v)
+{
+    u = fminf(1.0f, fmaxf(0.0f, u));
+    v = fminf(1.0f, fmaxf(0.0f, v));
+
+    /* Convert (u, v) to (x, y) in rect, the whole image if it has no size */
+    uint32_t w = rect.size.x ? rect.size.x : buf.rect.size.x;
+    uint32_t h = rect.size.x ? rect.size.y : buf.rect.size.y;
+    int64_t x = lrint((double)u * (double)(w - 1));
+    int64_t y = lrint(((double)v) * (double)(h - 1));
+
+    /* Convert coordinated from rect to buf.rect */
+    x += rect.org.x;
+    y += rect.org.y;
+
+    /* Convert from buf.rect to offset in buffer.data */
+    x += buf.rect.org.x;
+    y += buf.rect.org.y;
+
+    ASSERT(x >= 0 && y >= 0);
+
+    size_t pix_size = buf.format.size;
+    uint8_t *sp = (uint8_t *)buf.data + (size_t)y * buf.bpr + (size_t)x * pix_size;
+    v3f color = { (float)sp[0] / 255.0f, (float)sp[1] / 255.0f, (float)sp[2] / 255.0f };
+
+    return Spectrum::fromRGB(color);
+}
+
+#pragma mark - Textures
+
 struct _Texture_const : Texture {
     _Texture_const(const Spectrum &s) : m_color(s){};
 
+    sptr<Event> schedule() override { return Event::create(0); }
     Spectrum value(float, float, const v3f &) const override { return m_color; }
+    uint32_t flatten(MaterialTable &table) const override
+    {
+        TextureRecord r = {};
+        r.op = TEXTURE_CONSTANT;
+        r.color = m_color;
+        return table.add(r);
+    }
 
     Spectrum m_color;
 };
@@ -20,7 +66,12 @@ struct _Texture_checker : Texture {
     _Texture_checker(const sptr<Texture> &a, const sptr<Texture> &b) : m_odd(a), m_even(b)
     {}
 
+    sptr<Event> schedule() override
+    {
+        return Event::create({ m_odd->schedule(), m_even->schedule() });
+    }
     Spectrum value(float, float, const v3f &) const override;
+    uint32_t flatten(MaterialTable &table) const override;
 
     sptr<Texture> m_odd;
     sptr<Texture> m_even;
@@ -28,14 +79,24 @@ struct _Texture_checker : Texture {
 
 Spectrum _Texture_checker::value(float u, float v, const v3f &p) const
 {
-    float sines = sinf(10.0f * u) * sinf(10.0f * v);
-    return sines > 0.0f ? m_even->value(u, v, p) : m_odd->value(u, v, p);
+    return CheckerEven(u, v) ? m_even->value(u, v, p) : m_odd->value(u, v, p);
+}
+
+uint32_t _Texture_checker::flatten(MaterialTable &table) const
+{
+    TextureRecord r = {};
+    r.op = TEXTURE_CHECKER;
+    r.odd = table.add(m_odd);
+    r.even = table.add(m_even);
+    return table.add(r);
 }
 
 struct _Texture_img : Texture {
     _Texture_img(const sptr<Image> &img, rect_t r);
 
+    sptr<Event> schedule() override { return m_img->schedule(); }
     Spectrum value(float, float, const v3f &) const override;
+    uint32_t flatten(MaterialTable &table) const override;
 
     sptr<Image> m_img;
     rect_t m_rect;
@@ -50,30 +111,38 @@ _Texture_img::_Texture_img(const sptr<Image> &img, rect_t r)
 
 Spectrum _Texture_img::value(float u, float v, const v3f &) const
 {
-    buffer_t buf = m_img->buffer();
-
-    u = fminf(1.0f, fmaxf(0.0f, u));
-    v = fminf(1.0f, fmaxf(0.0f, v));
-
-    /* Convert (u, v) to (x, y) in m_rect */
-    int64_t x = lrint((double)u * (double)(m_rect.size.x - 1));
-    int64_t y = lrint(((double)v) * (double)(m_rect.size.y - 1));
-
-    /* Convert coordinated from m_rect to buf.rect */
-    x += m_rect.org.x;
-    y += m_rect.org.y;
-
-    /* Convert from buf.rect to offset in buffer.data */
-    x += buf.rect.org.x;
-    y += buf.rect.org.y;
+    return ImageValue(m_img->buffer(), m_rect, u, v);
+}
 
-    ASSERT(x >= 0 && y >= 0);
+uint32_t _Texture_img::flatten(MaterialTable &table) const
+{
+    TextureRecord r = {};
+    r.op = TEXTURE_IMAGE;
+    r.image = table.add(m_img);
+    r.rect = m_rect;
+    return table.add(r);
+}
 
-    size_t pix_size = buf.format.size;
-    uint8_t *sp = (uint8_t *)buf.data + (size_t)y * buf.bpr + (size_t)x * pix_size;
-    v3f color = { (float)sp[0] / 255.0f, (float)sp[1] / 255.0f, (float)sp[2] / 255.0f };
+#pragma mark - Flattened textures
 
-    return Spectrum::fromRGB(color);
+Spectrum EvaluateTexture(const std::vector<TextureRecord> &textures,
+                         const std::vector<sptr<Image>> &images,
+                         uint32_t index,
+                         float u,
+                         float v)
+{
+    for (;;) {
+        const TextureRecord &r = textures[index];
+        switch (r.op) {
+        case TEXTURE_CONSTANT:
+            return r.color;
+        case TEXTURE_CHECKER:
+            index = CheckerEven(u, v) ? r.even : r.odd;
+            break;
+        case TEXTURE_IMAGE:
+            return ImageValue(images[r.image]->buffer(), r.rect, u, v);
+        }
+    }
 }
 
 #pragma mark - Static constructors
@@ -115,7 +184,8 @@ sptr<Texture> Texture::create(const sptr<Params> &p)
     else if (type == "image") {
         if (sptr<Image> img = Image::create(p)) {
             v2i org = Params::vector2i(p, "origin", { 0, 0 });
-            v2u size = Params::vector2u(p, "size", img->size());
+            /* The size of the image is only known once it's decoded */
+            v2u size = Params::vector2u(p, "size", { 0, 0 });
             rect_t rect = { { org.x, org.y }, { size.x, size.y } };
             return Texture::create_image(img, rect);
         }
@@ -69,6 +69,7 @@ Interaction Transform::operator()(const Interaction &i) const
     ri.shading.dpdu = Mulv(*this, i.shading.dpdu);
     ri.shading.dpdv = Mulv(*this, i.shading.dpdv);
     ri.mat = i.mat;
+    ri.matIndex = i.matIndex;
     ri.prim = i.prim;
 
     return ri;
@@ -2,113 +2,620 @@
 
 #include "rt1w/error.h"
 #include "rt1w/event.hpp"
-#include "rt1w/sync.h"
+#include "rt1w/pool.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <mutex>
 #include <thread>
+#include <memory>
 #include <vector>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* CPUs a thread may run on, any if empty */
+typedef std::vector<uint32_t> cpuset;
+
+/* Bound of the CPU numbers of the lists, same as the kernel's default */
+constexpr unsigned long MaxCPUs = 8192;
+
+/* Recycled, as there are many small jobs */
 struct _job {
+    static void *operator new(size_t)
+    {
+        return BlockPool<sizeof(_job), alignof(_job)>::allocate();
+    }
+    static void operator delete(void *p)
+    {
+        BlockPool<sizeof(_job), alignof(_job)>::deallocate(p);
+    }
+
     sptr<Object> m_obj;
     sptr<Object> m_arg;
     workq_func m_func;
+    /* Null for the jobs of workq_execute_n() */
     sptr<Event> m_event;
-    _job *m_next;
+    workq_context m_context;
+};
+
+#pragma mark - Deque
+
+/* Chase-Lev deque of the jobs of a thread: the thread pushes and pops its jobs at
+ * the bottom, the other threads steal the oldest ones from the top. */
+struct _deque {
+    struct array {
+        explicit array(int64_t capacity) :
+            m_mask(capacity - 1),
+            m_slots(new std::atomic<_job *>[(size_t)capacity])
+        {}
+
+        int64_t capacity() const { return m_mask + 1; }
+        _job *get(int64_t i) const
+        {
+            return m_slots[(size_t)(i & m_mask)].load(std::memory_order_relaxed);
+        }
+        void put(int64_t i, _job *job)
+        {
+            m_slots[(size_t)(i & m_mask)].store(job, std::memory_order_relaxed);
+        }
+
+        int64_t m_mask;
+        uptr<std::atomic<_job *>[]> m_slots;
+    };
+
+    _deque() : m_array(new array(InitialCapacity)) { m_arrays.emplace_back(m_array); }
+
+    void push(_job *job);
+    _job *pop();
+    _job *steal();
+
+    static constexpr int64_t InitialCapacity = 256;
+
+    std::atomic<int64_t> m_top{ 0 };
+    std::atomic<int64_t> m_bottom{ 0 };
+    std::atomic<array *> m_array;
+
+    /* The arrays replaced when growing may still be read by a thief, they are kept
+     * until the queue goes away */
+    std::vector<uptr<array>> m_arrays;
+};
+
+void _deque::push(_job *job)
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    array *a = m_array.load(std::memory_order_relaxed);
+    if (b - t >= a->capacity()) {
+        auto grown = std::make_unique<array>(a->capacity() * 2);
+        for (int64_t i = t; i < b; ++i) {
+            grown->put(i, a->get(i));
+        }
+        a = grown.get();
+        m_arrays.push_back(std::move(grown));
+        m_array.store(a, std::memory_order_release);
+    }
+    a->put(b, job);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+_job *_deque::pop()
+{
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    array *a = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+
+    _job *job = nullptr;
+    if (t <= b) {
+        job = a->get(b);
+        if (t == b) {
+            /* Last job, race against the thieves */
+            if (!m_top.compare_exchange_strong(t,
+                                               t + 1,
+                                               std::memory_order_seq_cst,
+                                               std::memory_order_relaxed)) {
+                job = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+    }
+    else {
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+_job *_deque::steal()
+{
+    while (true) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        _job *job = m_array.load(std::memory_order_acquire)->get(t);
+        if (m_top.compare_exchange_strong(t,
+                                          t + 1,
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return job;
+        }
+    }
+}
+
+#pragma mark - Queue
+
+/* Rounds of looking for a job before a thread goes to sleep */
+constexpr uint32_t SpinRounds = 16;
+
+/* Jobs of each thread, by priority, on their own cache lines */
+struct alignas(64) _worker {
+    _deque m_jobs[WORKQ_PRIORITIES];
+
+    /* Nanoseconds spent executing jobs */
+    std::atomic<uint64_t> m_busy{ 0 };
 };
 
 struct workq {
-    workq(uint32_t concurrency) : m_concurrency(concurrency) {}
+    workq(uint32_t concurrency, const std::vector<cpuset> &affinity) :
+        m_concurrency(concurrency),
+        m_affinity(affinity),
+        m_workers(concurrency)
+    {}
 
     void init();
-    [[noreturn]] void work();
+    void stop();
+    void work(size_t index);
 
     void enqueue(_job *);
-    _job *dequeue();
+    void wake();
+    _job *find(size_t index);
+    _job *find(size_t index, int priority);
+    _job *next(size_t index);
 
     uint32_t m_concurrency;
-    void *volatile m_head = nullptr;
-    void *volatile m_queue = nullptr;
+
+    /* CPUs of each thread, in turn */
+    std::vector<cpuset> m_affinity;
+
+    std::vector<_worker> m_workers;
+    std::vector<std::thread> m_threads;
+
+    /* Jobs submitted from other threads, in order, by priority */
+    std::mutex m_lock;
+    std::deque<_job *> m_injected[WORKQ_PRIORITIES];
+    std::atomic<size_t> m_ninjected[WORKQ_PRIORITIES] = {};
+
+    /* Jobs queued above the batch priority, the threads only look for them when
+     * there are some */
+    std::atomic<size_t> m_urgent{ 0 };
+
+    /* Sleeping threads wait for the epoch to change, which it does each time a job
+     * is published, after it is */
     std::mutex m_mutex;
     std::condition_variable m_cv;
-    std::vector<std::thread> m_threads;
+    std::atomic<uint64_t> m_epoch{ 0 };
+    std::atomic<uint32_t> m_sleeping{ 0 };
+    bool m_stop = false;
 };
 
+/* Queue and index of the current thread, if it's one of the threads of a queue */
+static thread_local workq *t_queue = nullptr;
+static thread_local size_t t_index = 0;
+
+/* Context of the jobs submitted by the current thread */
+static thread_local workq_context t_context;
+
+#pragma mark - Affinity
+
+static bool SetAffinity(std::thread::native_handle_type thread, const cpuset &cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    return cpus.empty();
+#endif
+}
+
+/* CPUs the process may run on, or empty if unknown */
+static cpuset AllowedCPUs()
+{
+    cpuset cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+/* Parses a list of CPUs or nodes like "0-3,8", as found in sysfs */
+static bool ParseList(const char *list, cpuset *cpus)
+{
+    const char *s = list;
+    while (*s >= '0' && *s <= '9') {
+        char *end;
+        unsigned long first = strtoul(s, &end, 10);
+        unsigned long last = first;
+        if (*end == '-') {
+            s = end + 1;
+            if (*s < '0' || *s > '9') {
+                return false;
+            }
+            last = strtoul(s, &end, 10);
+        }
+        if (last < first || last >= MaxCPUs) {
+            return false;
+        }
+        for (unsigned long c = first; c <= last; ++c) {
+            cpus->push_back((uint32_t)c);
+        }
+
+        s = end;
+        if (*s != ',') {
+            break;
+        }
+        ++s;
+    }
+    return !cpus->empty() && (*s == '\0' || *s == '\n');
+}
+
+static bool ReadList(const char *path, cpuset *cpus)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), f) && ParseList(buf, cpus);
+    fclose(f);
+    return ok;
+}
+
 void workq::init()
 {
     for (size_t i = 0; i < m_concurrency; i++) {
-        m_threads.emplace_back(std::thread(&workq::work, this));
+        m_threads.emplace_back(std::thread(&workq::work, this, i));
+        if (!m_affinity.empty()) {
+            const cpuset &cpus = m_affinity[i % m_affinity.size()];
+            WARNING_IF(!SetAffinity(m_threads.back().native_handle(), cpus),
+                       "Couldn't pin thread %lu",
+                       i);
+        }
     }
 }
 
-void workq::work()
+void workq::stop()
 {
-    while (true) {
-        _job *job = dequeue();
-        if (job->m_func) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_epoch.fetch_add(1);
+    }
+    m_cv.notify_all();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+void workq::work(size_t index)
+{
+    using clock = std::chrono::steady_clock;
+
+    t_queue = this;
+    t_index = index;
+    while (_job *job = next(index)) {
+        if (job->m_context.priority > WORKQ_PRIORITY_BATCH) {
+            m_urgent.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /* The cancelled jobs are skipped, except for the ones of workq_execute_n()
+         * which must go through all their indices */
+        const sptr<CancelToken> &token = job->m_context.token;
+        bool skip = job->m_event && token && token->cancelled();
+        if (job->m_func && !skip) {
+            t_context = std::move(job->m_context);
+            clock::time_point start = clock::now();
             job->m_func(job->m_obj, job->m_arg);
+
+            auto elapsed = clock::now() - start;
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+            m_workers[index].m_busy.fetch_add((uint64_t)ns.count(),
+                                              std::memory_order_relaxed);
+            t_context = {};
+        }
+        if (job->m_event) {
+            job->m_event->signal();
         }
-        job->m_event->signal();
         delete job;
     }
 }
 
+/* The threads of the queue push their jobs to their own deque, the others append
+ * them to the injected ones */
 void workq::enqueue(_job *job)
 {
-    _job *q = (_job *)sync_lock_ptr(&m_queue);
-    job->m_next = q;
-    m_cv.notify_one();
-    sync_unlock_ptr(&m_queue, job);
+    job->m_context = t_context;
+    int p = job->m_context.priority;
+    if (p > WORKQ_PRIORITY_BATCH) {
+        m_urgent.fetch_add(1);
+    }
+    if (t_queue == this) {
+        m_workers[t_index].m_jobs[p].push(job);
+    }
+    else {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_injected[p].push_back(job);
+        m_ninjected[p].fetch_add(1);
+    }
+    wake();
 }
 
-_job *workq::dequeue()
+void workq::wake()
 {
-    _job *job = nullptr;
-    do {
-        _job *head = (_job *)sync_lock_ptr(&m_head);
-        if (head) {
-            job = head;
-            head = job->m_next;
-            sync_unlock_ptr(&m_head, head);
-            job->m_next = nullptr;
-        }
-        else {
-            job = (_job *)sync_lock_ptr(&m_queue);
-            if (job) {
-                sync_unlock_ptr(&m_queue, nullptr);
-                while (job->m_next) {
-                    _job *next = job->m_next;
-                    job->m_next = head;
-                    head = job;
-                    job = next;
-                }
-                sync_unlock_ptr(&m_head, head);
-            }
-            else {
-                sync_unlock_ptr(&m_queue, nullptr);
-                sync_unlock_ptr(&m_head, nullptr);
-                std::unique_lock<std::mutex> lk(m_mutex);
-                m_cv.wait(lk);
+    m_epoch.fetch_add(1);
+    if (m_sleeping.load() > 0) {
+        /* Wait for the sleeping thread to be waiting, then wake it up */
+        { std::lock_guard<std::mutex> lock(m_mutex); }
+        m_cv.notify_one();
+    }
+}
+
+/* The jobs of the highest priority queued anywhere first */
+_job *workq::find(size_t index)
+{
+    if (m_urgent.load() > 0) {
+        for (int p = WORKQ_PRIORITIES - 1; p > WORKQ_PRIORITY_BATCH; --p) {
+            if (_job *job = find(index, p)) {
+                return job;
             }
         }
-    } while (!job);
-    return job;
+    }
+    return find(index, WORKQ_PRIORITY_BATCH);
+}
+
+/* Own jobs first, the newest being the most likely to be in the cache, then the
+ * injected ones, then the oldest jobs of the other threads */
+_job *workq::find(size_t index, int p)
+{
+    if (_job *job = m_workers[index].m_jobs[p].pop()) {
+        return job;
+    }
+    if (m_ninjected[p].load() > 0) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_injected[p].empty()) {
+            _job *job = m_injected[p].front();
+            m_injected[p].pop_front();
+            m_ninjected[p].fetch_sub(1);
+            return job;
+        }
+    }
+    for (size_t i = 1; i < m_concurrency; ++i) {
+        if (_job *job = m_workers[(index + i) % m_concurrency].m_jobs[p].steal()) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+/* Returns the next job to execute, or nullptr once the queue is stopped and no job
+ * is left */
+_job *workq::next(size_t index)
+{
+    uint32_t round = 0;
+    while (true) {
+        /* Read before looking for a job, so that a job published after it was looked
+         * for changes it */
+        uint64_t epoch = m_epoch.load();
+        if (_job *job = find(index)) {
+            return job;
+        }
+        if (round++ < SpinRounds) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_stop) {
+            return nullptr;
+        }
+        m_sleeping.fetch_add(1);
+        m_cv.wait(lock, [&]() { return m_epoch.load() != epoch; });
+        m_sleeping.fetch_sub(1);
+        round = 0;
+    }
 }
 
 #pragma mark - Static
 
-static workq *global_workq = []() -> workq * {
-    auto *queue = new workq(std::thread::hardware_concurrency());
-    queue->init();
+/* Set up by workq_configure(), before the queue is created on first use */
+static uint32_t global_concurrency = 0;
+static std::vector<cpuset> global_affinity;
+
+static std::once_flag global_once;
+static std::atomic<bool> global_started(false);
+static workq *global_workq = nullptr;
 
+/* Number of threads and CPUs of each one, and all the CPUs they may run on */
+static bool Setup(const workq_config &config,
+                  uint32_t *concurrency,
+                  std::vector<cpuset> *affinity,
+                  cpuset *allowed)
+{
+    cpuset cpus;
+    if (!config.cpus.empty() && !ParseList(config.cpus.c_str(), &cpus)) {
+        ERROR("Invalid list of CPUs \"%s\"", config.cpus.c_str());
+        return false;
+    }
+    cpuset node;
+    if (config.node >= 0) {
+        char path[64];
+        snprintf(path,
+                 sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist",
+                 config.node);
+        if (!ReadList(path, &node)) {
+            ERROR("No NUMA node %d", config.node);
+            return false;
+        }
+    }
+
+    /* Each thread gets one of the CPUs requested, or any CPU of the node */
+    if (!cpus.empty() && !node.empty()) {
+        cpus.erase(std::remove_if(cpus.begin(),
+                                  cpus.end(),
+                                  [&](uint32_t c) {
+                                      return std::find(node.begin(), node.end(), c)
+                                             == node.end();
+                                  }),
+                   cpus.end());
+        if (cpus.empty()) {
+            ERROR("None of the CPUs %s is on NUMA node %d",
+                  config.cpus.c_str(),
+                  config.node);
+            return false;
+        }
+    }
+    affinity->clear();
+    for (uint32_t cpu : cpus) {
+        affinity->push_back({ cpu });
+    }
+    if (cpus.empty() && !node.empty()) {
+        affinity->push_back(node);
+    }
+    *allowed = cpus.empty() ? node : cpus;
+
+    *concurrency = config.threads ? config.threads : (uint32_t)allowed->size();
+    if (*concurrency == 0) {
+        *concurrency = (uint32_t)AllowedCPUs().size();
+    }
+    if (*concurrency == 0) {
+        *concurrency = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return true;
+}
+
+bool workq_configure(const workq_config &config)
+{
+    if (global_started) {
+        ERROR("The work queue is already running");
+        return false;
+    }
+
+    cpuset allowed;
+    if (!Setup(config, &global_concurrency, &global_affinity, &allowed)) {
+        return false;
+    }
+    if (!allowed.empty() && !SetAffinity(pthread_self(), allowed)) {
+        WARNING("Threads can't be pinned to CPUs");
+        global_affinity.clear();
+    }
+    return true;
+}
+
+workq *workq_create(const workq_config &config)
+{
+    uint32_t concurrency;
+    std::vector<cpuset> affinity;
+    cpuset allowed;
+    if (!Setup(config, &concurrency, &affinity, &allowed)) {
+        return nullptr;
+    }
+    auto *queue = new workq(concurrency, affinity);
+    queue->init();
     return queue;
-}();
+}
+
+void workq_destroy(workq *workq)
+{
+    if (workq) {
+        workq->stop();
+        delete workq;
+    }
+}
+
+uint32_t workq_numa_nodes()
+{
+    cpuset nodes;
+    if (!ReadList("/sys/devices/system/node/online", &nodes)) {
+        return 1;
+    }
+    return (uint32_t)nodes.size();
+}
 
 workq *workq_get_queue()
 {
+    std::call_once(global_once, []() {
+        global_started = true;
+
+        /* Not configured, one thread per CPU allowed */
+        if (global_concurrency == 0) {
+            cpuset allowed;
+            Setup({}, &global_concurrency, &global_affinity, &allowed);
+        }
+        global_workq = new workq(global_concurrency, global_affinity);
+        global_workq->init();
+    });
     return global_workq;
 }
 
+uint32_t workq_concurrency(workq *workq)
+{
+    return workq ? workq->m_concurrency : 1;
+}
+
+std::vector<double> workq_busy_times(workq *workq)
+{
+    std::vector<double> times;
+    if (workq) {
+        for (const _worker &w : workq->m_workers) {
+            times.push_back(w.m_busy.load(std::memory_order_relaxed) * 1e-9);
+        }
+    }
+    return times;
+}
+
+workq_context workq_set_context(const workq_context &context)
+{
+    workq_context previous = std::move(t_context);
+    t_context = context;
+    return previous;
+}
+
+workq_context workq_get_context()
+{
+    return t_context;
+}
+
+bool workq_cancelled()
+{
+    return t_context.token && t_context.token->cancelled();
+}
+
 sptr<Event> workq_execute(workq *workq,
                           workq_func func,
                           const sptr<Object> &obj,
@@ -150,3 +657,74 @@ void workq_execute(workq *workq,
         event->signal();
     }
 }
+
+sptr<Event> workq_execute_ranges(workq *workq,
+                                 size_t count,
+                                 size_t grain,
+                                 workq_func func,
+                                 const sptr<Object> &obj)
+{
+    ASSERT(grain > 0);
+
+    size_t n = (count + grain - 1) / grain;
+    sptr<Event> event = Event::create((int32_t)n);
+    for (size_t begin = 0; begin < count; begin += grain) {
+        auto range = std::make_shared<WorkRange>(begin, std::min(begin + grain, count));
+        workq_execute(workq, event, func, obj, range);
+    }
+    return event;
+}
+
+/* The indices of workq_execute_n(), claimed in order by one job per thread */
+struct _batch : Object {
+    _batch(size_t n, workq_func_n func, const sptr<Object> &obj) :
+        m_count(n),
+        m_func(func),
+        m_obj(obj),
+        m_event(Event::create(1))
+    {}
+
+    size_t m_count;
+    workq_func_n m_func;
+    sptr<Object> m_obj;
+    sptr<Event> m_event;
+    std::atomic<size_t> m_next{ 0 };
+    std::atomic<size_t> m_done{ 0 };
+};
+
+static void RunBatch(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto batch = std::static_pointer_cast<_batch>(obj);
+    size_t done = 0;
+    for (size_t i; (i = batch->m_next.fetch_add(1)) < batch->m_count;) {
+        batch->m_func(batch->m_obj, i);
+        done++;
+    }
+    if (done && batch->m_done.fetch_add(done) + done == batch->m_count) {
+        batch->m_event->signal();
+    }
+}
+
+sptr<Event> workq_execute_n(workq *workq,
+                            size_t count,
+                            workq_func_n func,
+                            const sptr<Object> &obj)
+{
+    if (count == 0) {
+        return Event::create(0);
+    }
+    auto batch = make_pooled<_batch>(count, func, obj);
+    size_t n = std::min(count, (size_t)workq_concurrency(workq));
+    for (size_t i = 0; i < n; ++i) {
+        if (workq) {
+            auto *job = new _job;
+            job->m_obj = batch;
+            job->m_func = RunBatch;
+            workq->enqueue(job);
+        }
+        else {
+            RunBatch(batch, nullptr);
+        }
+    }
+    return batch->m_event;
+}
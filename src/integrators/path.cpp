@@ -1,5 +1,7 @@
 #include "integrators/path.hpp"
 
+#include "rt1w/aov.hpp"
+#include "rt1w/arena.hpp"
 #include "rt1w/bxdf.hpp"
 #include "rt1w/interaction.hpp"
 #include "rt1w/light.hpp"
@@ -16,8 +18,7 @@ struct _PathIntegrator : PathIntegrator {
                 const sptr<Scene> &scene,
                 const sptr<Sampler> &sampler,
                 size_t depth,
-                v3f *N,
-                Spectrum *A) const override;
+                AOVSample *aov) const override;
 
     sptr<Sampler> m_sampler;
     size_t m_maxDepth;
@@ -27,9 +28,9 @@ Spectrum _PathIntegrator::Li(const Ray &r,
                              const sptr<Scene> &scene,
                              const sptr<Sampler> &sampler,
                              size_t,
-                             v3f *N,
-                             Spectrum *A) const
+                             AOVSample *aov) const
 {
+    Arena &arena = Arena::local();
     Ray ray = r;
     Spectrum L;
     Spectrum beta = { 1.f };
@@ -40,8 +41,8 @@ Spectrum _PathIntegrator::Li(const Ray &r,
         bool intersect = scene->intersect(ray, isect);
         if (bounces == 0) {
             if (intersect) {
-                if (N) {
-                    *N = isect.n;
+                if (aov) {
+                    aov->record(isect);
                 }
                 L = LightEmitted(isect, -ray.dir());
             }
@@ -64,14 +65,13 @@ Spectrum _PathIntegrator::Li(const Ray &r,
         if (!intersect || bounces > m_maxDepth) {
             break;
         }
-        L += beta * UniformSampleOneLight(isect, scene, sampler);
-
-        v3f wi;
-
-        sptr<BSDF> bsdf = ComputeBSDF(isect);
+        BSDF *bsdf = scene->materials().computeBsdf(isect, arena);
         if (!bsdf) {
             break;
         }
+        L += beta * UniformSampleOneLight(isect, *bsdf, scene, sampler);
+
+        v3f wi;
         BxDFType sampled;
         float pdf;
         Spectrum f =
@@ -79,8 +79,8 @@ Spectrum _PathIntegrator::Li(const Ray &r,
         if (f.isBlack() || FloatEqual(pdf, .0f)) {
             break;
         }
-        if (A && bounces == 0) {
-            *A = f;
+        if (aov && (aov->requested & AOV_ALBEDO) && bounces == 0) {
+            aov->A = f;
         }
         beta *= f * AbsDot(wi, isect.shading.n) / pdf;
         specular = sampled & BSDF_SPECULAR;
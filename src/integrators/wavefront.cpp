@@ -0,0 +1,369 @@
+#include "integrators/wavefront.hpp"
+
+#include "integrators/path.hpp"
+#include "rt1w/aov.hpp"
+#include "rt1w/arena.hpp"
+#include "rt1w/bxdf.hpp"
+#include "rt1w/error.h"
+#include "rt1w/event.hpp"
+#include "rt1w/interaction.hpp"
+#include "rt1w/light.hpp"
+#include "rt1w/material.hpp"
+#include "rt1w/ray.hpp"
+#include "rt1w/rng.hpp"
+#include "rt1w/sampler.hpp"
+#include "rt1w/scene.hpp"
+#include "rt1w/workq.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+/* Paths shaded by each job of the shading stage */
+constexpr size_t ShadingGrain = 64;
+
+/* The state of the paths is kept in separate arrays, indexed by path. Each bounce
+ * of the paths still active goes through the stages:
+ *  - extension, the next rays are intersected in a batch
+ *  - emission, the misses and the lights hit are accounted for
+ *  - shading, grouped by material, builds the BSDFs of each material in a batch,
+ *    then samples a light and the next direction
+ *  - shadow, the shadow rays are tested in a batch and the unoccluded direct
+ *    lighting is accumulated
+ * The stages are chained with the events of the batches, nothing ever waits. */
+struct _WavefrontBatch : Batch<Spectrum>, std::enable_shared_from_this<_WavefrontBatch> {
+    _WavefrontBatch(const std::vector<Ray> &rays,
+                    const std::vector<uint64_t> &seeds,
+                    const sptr<Scene> &scene,
+                    size_t maxDepth,
+                    std::vector<AOVSample> *aovs);
+
+    sptr<Event> schedule() override;
+    const std::vector<Spectrum> &content() override;
+
+    void extend();
+    void emit();
+    void shade(size_t begin, size_t end);
+    void shadow();
+    void accumulate();
+
+    sptr<Scene> m_scene;
+    size_t m_maxDepth;
+    size_t m_bounce;
+    std::vector<AOVSample> *m_aovs;
+
+    /* Per path */
+    std::vector<Ray> m_rays;
+    std::vector<Spectrum> m_beta;
+    std::vector<Spectrum> m_L;
+    std::vector<uint8_t> m_specular;
+    std::vector<RNGState> m_rng;
+
+    /* Paths intersected by the extension rays, then the ones to shade, sorted by
+     * material, and whether they go on after the bounce */
+    std::vector<uint32_t> m_active;
+    sptr<Batch<Interaction>> m_hits;
+    std::vector<uint32_t> m_shading;
+    std::vector<uint8_t> m_continue;
+
+    /* Direct lighting of the shaded paths, if their shadow ray isn't occluded */
+    std::vector<Spectrum> m_Ld;
+    std::vector<uint8_t> m_lit;
+    std::vector<Ray> m_shadowRays;
+    sptr<Batch<Interaction>> m_occluded;
+
+    std::once_flag m_scheduled;
+    sptr<Event> m_event;
+};
+
+static void Intersected(const sptr<Object> &obj, const sptr<Object> &)
+{
+    std::static_pointer_cast<_WavefrontBatch>(obj)->emit();
+}
+
+static void Shade(const sptr<Object> &obj, const sptr<Object> &arg)
+{
+    auto range = std::static_pointer_cast<WorkRange>(arg);
+    std::static_pointer_cast<_WavefrontBatch>(obj)->shade(range->begin, range->end);
+}
+
+static void Shaded(const sptr<Object> &obj, const sptr<Object> &)
+{
+    std::static_pointer_cast<_WavefrontBatch>(obj)->shadow();
+}
+
+static void Occluded(const sptr<Object> &obj, const sptr<Object> &)
+{
+    std::static_pointer_cast<_WavefrontBatch>(obj)->accumulate();
+}
+
+_WavefrontBatch::_WavefrontBatch(const std::vector<Ray> &rays,
+                                 const std::vector<uint64_t> &seeds,
+                                 const sptr<Scene> &scene,
+                                 size_t maxDepth,
+                                 std::vector<AOVSample> *aovs) :
+    m_scene(scene),
+    m_maxDepth(maxDepth),
+    m_bounce(0),
+    m_aovs(aovs),
+    m_rays(rays),
+    m_beta(rays.size(), Spectrum(1.f)),
+    m_L(rays.size()),
+    m_specular(rays.size(), 0),
+    m_active(rays.size())
+{
+    ASSERT(seeds.size() == rays.size());
+    ASSERT(!aovs || aovs->size() == rays.size());
+
+    m_rng.reserve(seeds.size());
+    for (uint64_t seed : seeds) {
+        m_rng.emplace_back(seed);
+    }
+    for (size_t i = 0; i < m_active.size(); ++i) {
+        m_active[i] = (uint32_t)i;
+    }
+}
+
+sptr<Event> _WavefrontBatch::schedule()
+{
+    std::call_once(m_scheduled, [this]() {
+        m_event = Event::create(1);
+        extend();
+    });
+    return m_event;
+}
+
+const std::vector<Spectrum> &_WavefrontBatch::content()
+{
+    schedule()->wait();
+    return m_L;
+}
+
+void _WavefrontBatch::extend()
+{
+    if (m_active.empty()) {
+        m_event->signal();
+        return;
+    }
+    std::vector<Ray> rays;
+    rays.reserve(m_active.size());
+    for (uint32_t p : m_active) {
+        rays.push_back(m_rays[p]);
+    }
+    m_hits = m_scene->intersect(rays);
+    m_hits->schedule()->notify(nullptr, Intersected, shared_from_this(), nullptr);
+}
+
+void _WavefrontBatch::emit()
+{
+    const std::vector<Interaction> &hits = m_hits->content();
+    const std::vector<sptr<Light>> &lights = m_scene->lights();
+
+    m_shading.clear();
+    for (size_t k = 0; k < m_active.size(); ++k) {
+        uint32_t p = m_active[k];
+        const Interaction &isect = hits[k];
+        bool intersect = isect.t > -Infinity;
+
+        if (m_bounce == 0 && intersect && m_aovs) {
+            (*m_aovs)[p].record(isect);
+        }
+        if (m_bounce == 0 || m_specular[p]) {
+            if (intersect) {
+                m_L[p] += m_beta[p] * LightEmitted(isect, -m_rays[p].dir());
+            }
+            else {
+                for (const auto &light : lights) {
+                    m_L[p] += m_beta[p] * light->Le(m_rays[p]);
+                }
+            }
+        }
+        if (intersect && m_bounce <= m_maxDepth) {
+            m_shading.push_back((uint32_t)k);
+        }
+    }
+
+    /* Hits on the same material are shaded together */
+    std::sort(m_shading.begin(), m_shading.end(), [&](uint32_t a, uint32_t b) {
+        return hits[a].matIndex < hits[b].matIndex;
+    });
+
+    size_t n = m_shading.size();
+    m_continue.assign(n, 0);
+    m_lit.assign(n, 0);
+    m_Ld.assign(n, {});
+    m_shadowRays.clear();
+    m_shadowRays.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        m_shadowRays.push_back(m_rays[m_active[m_shading[i]]]);
+    }
+
+    sptr<Event> event = workq_execute_ranges(workq_get_queue(),
+                                             n,
+                                             ShadingGrain,
+                                             Shade,
+                                             shared_from_this());
+    event->notify(nullptr, Shaded, shared_from_this(), nullptr);
+}
+
+void _WavefrontBatch::shade(size_t begin, size_t end)
+{
+    const std::vector<Interaction> &hits = m_hits->content();
+    const std::vector<sptr<Light>> &lights = m_scene->lights();
+    const MaterialTable &materials = m_scene->materials();
+
+    /* The BSDFs of the range are built by runs of the same material, and only live
+     * for the job */
+    Arena &arena = Arena::local();
+    Arena::Mark mark = arena.mark();
+    size_t count = end - begin;
+    const Interaction **isects = arena.array<const Interaction *>(count);
+    BSDF **bsdfs = arena.array<BSDF *>(count);
+    for (size_t i = 0; i < count; ++i) {
+        isects[i] = &hits[m_shading[begin + i]];
+    }
+    for (size_t i = 0; i < count;) {
+        uint32_t material = isects[i]->matIndex;
+        size_t j = i + 1;
+        while (j < count && isects[j]->matIndex == material) {
+            ++j;
+        }
+        materials.computeBsdfs(material, isects + i, j - i, arena, bsdfs + i);
+        i = j;
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+        uint32_t k = m_shading[i];
+        uint32_t p = m_active[k];
+        const Interaction &isect = hits[k];
+        RNGState &rng = m_rng[p];
+
+        BSDF *bsdf = bsdfs[i - begin];
+        if (!bsdf) {
+            continue;
+        }
+
+        /* Direct lighting from one of the lights, tested later */
+        if (!lights.empty()) {
+            auto n = (uint32_t)lights.size();
+            const sptr<Light> &light = lights[rng.u32(n)];
+
+            v3f wi;
+            float pdf;
+            VisibilityTester vis;
+            v2f u = { rng.f32(), rng.f32() };
+            Spectrum Li = light->sample_Li(isect, u, wi, pdf, vis);
+            if (!Li.isBlack() && pdf > .0f) {
+                Spectrum f =
+                    bsdf->f(isect.wo, wi, BSDF_ALL) * AbsDot(wi, isect.shading.n);
+                if (!f.isBlack()) {
+                    m_Ld[i] = m_beta[p] * f * Li * (float)n / pdf;
+                    m_shadowRays[i] = vis.ray();
+                    m_lit[i] = 1;
+                }
+            }
+        }
+
+        /* Next direction */
+        v3f wi;
+        float pdf;
+        BxDFType sampled;
+        v2f u = { rng.f32(), rng.f32() };
+        Spectrum f = bsdf->sample_f(isect.wo, u, wi, pdf, BSDF_ALL, &sampled);
+        if (f.isBlack() || FloatEqual(pdf, .0f)) {
+            continue;
+        }
+        if (m_aovs && ((*m_aovs)[p].requested & AOV_ALBEDO) && m_bounce == 0) {
+            (*m_aovs)[p].A = f;
+        }
+        m_beta[p] *= f * AbsDot(wi, isect.shading.n) / pdf;
+        m_specular[p] = (sampled & BSDF_SPECULAR) ? 1 : 0;
+        m_rays[p] = SpawnRay(isect, wi);
+
+        if (m_bounce > 3) {
+            float q = std::max(.5f, 1.f - MaxComponent(m_beta[p]));
+            if (rng.f32() < q) {
+                continue;
+            }
+            m_beta[p] /= 1 - q;
+        }
+        m_continue[i] = 1;
+    }
+    arena.rewind(mark);
+}
+
+void _WavefrontBatch::shadow()
+{
+    /* The hits aren't needed past the shading */
+    m_hits.reset();
+
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < m_shading.size(); ++i) {
+        if (m_lit[i]) {
+            rays.push_back(m_shadowRays[i]);
+        }
+    }
+    m_occluded = m_scene->qIntersect(rays);
+    m_occluded->schedule()->notify(nullptr, Occluded, shared_from_this(), nullptr);
+}
+
+void _WavefrontBatch::accumulate()
+{
+    const std::vector<Interaction> &occluded = m_occluded->content();
+
+    std::vector<uint32_t> active;
+    for (size_t i = 0, j = 0; i < m_shading.size(); ++i) {
+        uint32_t p = m_active[m_shading[i]];
+        if (m_lit[i] && occluded[j++].t == -Infinity) {
+            m_L[p] += m_Ld[i];
+        }
+        if (m_continue[i]) {
+            active.push_back(p);
+        }
+    }
+    m_occluded.reset();
+
+    /* Keep the paths in order for the coherence of the next rays */
+    std::sort(active.begin(), active.end());
+    m_active = std::move(active);
+    m_bounce++;
+    extend();
+}
+
+#pragma mark - Integrator
+
+struct _WavefrontIntegrator : WavefrontIntegrator {
+    _WavefrontIntegrator(const sptr<Sampler> &s, size_t m) :
+        m_sampler(s),
+        m_maxDepth(m),
+        m_path(PathIntegrator::create(s, m))
+    {}
+
+    sptr<const Sampler> sampler() const override { return m_sampler; }
+    Spectrum Li(const Ray &ray,
+                const sptr<Scene> &scene,
+                const sptr<Sampler> &sampler,
+                size_t depth,
+                AOVSample *aov) const override
+    {
+        return m_path->Li(ray, scene, sampler, depth, aov);
+    }
+    sptr<Batch<Spectrum>> Li(const std::vector<Ray> &rays,
+                             const std::vector<uint64_t> &seeds,
+                             const sptr<Scene> &scene,
+                             std::vector<AOVSample> *aovs) const override
+    {
+        return std::make_shared<_WavefrontBatch>(rays, seeds, scene, m_maxDepth, aovs);
+    }
+
+    sptr<Sampler> m_sampler;
+    size_t m_maxDepth;
+    /* Traces the single rays */
+    sptr<PathIntegrator> m_path;
+};
+
+sptr<WavefrontIntegrator> WavefrontIntegrator::create(const sptr<Sampler> &sampler,
+                                                      size_t maxDepth)
+{
+    return std::make_shared<_WavefrontIntegrator>(sampler, maxDepth);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "rt1w/integrator.hpp"
+#include "rt1w/sptr.hpp"
+
+struct Sampler;
+
+struct WavefrontIntegrator : IntegratorAsync {
+    static sptr<WavefrontIntegrator> create(const sptr<Sampler> &sampler,
+                                            size_t maxDepth);
+};
@@ -1,5 +1,7 @@
 #include "integrators/whitted.hpp"
 
+#include "rt1w/aov.hpp"
+#include "rt1w/arena.hpp"
 #include "rt1w/bxdf.hpp"
 #include "rt1w/interaction.hpp"
 #include "rt1w/light.hpp"
@@ -16,8 +18,7 @@ struct _WhittedIntegrator : WhittedIntegrator {
                 const sptr<Scene> &scene,
                 const sptr<Sampler> &sampler,
                 size_t depth,
-                v3f *N = nullptr,
-                Spectrum *A = nullptr) const override;
+                AOVSample *aov = nullptr) const override;
 
     sptr<Sampler> m_sampler;
     size_t m_maxDepth;
@@ -27,8 +28,7 @@ Spectrum _WhittedIntegrator::Li(const Ray &ray,
                                 const sptr<Scene> &scene,
                                 const sptr<Sampler> &sampler,
                                 size_t depth,
-                                v3f *N,
-                                Spectrum *A) const
+                                AOVSample *aov) const
 {
     ASSERT(scene);
     ASSERT(sampler);
@@ -41,7 +41,7 @@ Spectrum _WhittedIntegrator::Li(const Ray &ray,
         }
         return L;
     }
-    sptr<BSDF> bsdf = ComputeBSDF(isect);
+    BSDF *bsdf = scene->materials().computeBsdf(isect, Arena::local());
     Spectrum L = LightEmitted(isect, isect.wo);
 
     for (const auto &light : scene->lights()) {
@@ -67,11 +67,11 @@ Spectrum _WhittedIntegrator::Li(const Ray &ray,
              * AbsDot(wi, isect.shading.n) / pdf;
     }
 
-    if (N) {
-        *N = isect.n;
-    }
-    if (A) {
-        *A = f;
+    if (aov) {
+        aov->record(isect);
+        if (aov->requested & AOV_ALBEDO) {
+            aov->A = f;
+        }
     }
     return L;
 }
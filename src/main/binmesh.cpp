@@ -0,0 +1,62 @@
+#include "shapes/binmesh.hpp"
+#include "tools/loader_obj.hpp"
+
+#include "rt1w/error.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+[[noreturn]] static void usage(const char *msg = nullptr)
+{
+    if (msg) {
+        fprintf(stderr, "binmesh: %s\n\n", msg);
+    }
+    fprintf(stderr, R"(usage: binmesh <input.obj> <output.binmesh>
+Converts all the shapes of an OBJ file into a single binary mesh, that can be
+loaded in a scene using a shape of type "binmesh".
+
+)");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3 || !strcmp(argv[1], "--help") || !strcmp(argv[1], "-h")) {
+        usage();
+    }
+
+    std::vector<v3f> vertices;
+    std::vector<v3f> normals;
+    std::vector<v2f> texcoords;
+    std::vector<std::vector<uint32_t>> shapes;
+
+    DIE_IF(!LoadObj(argv[1], vertices, normals, texcoords, shapes),
+           "Couldn't load %s",
+           argv[1]);
+
+    std::vector<uint32_t> indices;
+    for (const auto &s : shapes) {
+        indices.insert(std::end(indices), std::begin(s), std::end(s));
+    }
+
+    bool ok = WriteBinMesh(argv[2],
+                           vertices.size(),
+                           vertices.data(),
+                           normals.empty() ? nullptr : normals.data(),
+                           texcoords.empty() ? nullptr : texcoords.data(),
+                           indices.size() / 3,
+                           indices.data());
+    if (!ok) {
+        return 1;
+    }
+    LOG("Wrote %s, %lu vertices, %lu triangles",
+        argv[2],
+        vertices.size(),
+        indices.size() / 3);
+
+    return 0;
+}
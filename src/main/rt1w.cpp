@@ -1,7 +1,9 @@
 #include "rt1w/accelerator.hpp"
+#include "rt1w/aov.hpp"
 #include "rt1w/camera.hpp"
 #include "rt1w/context.hpp"
 #include "rt1w/denoise.hpp"
+#include "rt1w/distributed.hpp"
 #include "rt1w/error.h"
 #include "rt1w/event.hpp"
 #include "rt1w/image.hpp"
@@ -10,13 +12,26 @@
 #include "rt1w/params.hpp"
 #include "rt1w/sampler.hpp"
 #include "rt1w/scene.hpp"
+#include "rt1w/scratch.hpp"
+#include "rt1w/server.hpp"
+#include "rt1w/workq.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <climits>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <deque>
 #include <string>
+#include <thread>
+#include <vector>
 
 [[noreturn]] static void usage(const char *msg = nullptr)
 {
@@ -27,9 +42,57 @@
 --help               Print this help text.
 --quality=<num>      Size of the grid in which pixel are subdivided.
                      Set to zero by default, so only one ray per pixel.
+--passes=<num>       Number of passes to render, each one adds quality^2 samples
+                     per pixel to the previous ones. One pass by default, or
+                     as many as fit in the time budget when one is given.
+--time-budget=<sec>  Stop starting new passes once the next one would end
+                     past this many seconds of rendering.
+--write-interval=<sec>
+                     Write the image out between passes, at most once every
+                     this many seconds, so long renders can be inspected.
+--checkpoint-interval=<sec>
+                     Save the state of the render to <output>.ckpt at most
+                     once every this many seconds, even during a pass.
+--resume             Continue the render from <output>.ckpt, with the same
+                     options, as if it had never stopped.
+--adaptive=<num>     Stop sampling the pixels whose relative error is below
+                     this threshold, e.g. 0.05. The samples of the passes are
+                     then spent on the noisy pixels, up to four times the
+                     passes requested.
+--tile-size=<num>    Size in pixels of the tiles rendered by each thread, 32 by
+                     default.
+--tile-order=<order> Order of the tiles of the first pass: "center" (default)
+                     renders from the center of the image outwards, "hilbert"
+                     follows a Hilbert curve, "columns" goes column by column.
+--threads=<num>      Number of rendering threads, one per CPU by default.
+--cpus=<list>        Pin the threads to these CPUs, one each in turn, e.g.
+                     "0-7,16-23".
+--numa-node=<num>    Only run on the CPUs of this NUMA node, so the scene is
+                     loaded in its local memory.
+--listen=<address>   Hand out the tiles to worker processes connecting to the
+                     address, either unix:<path> or <host>:<port>.
+--spawn-workers=<num>
+                     Start this many local workers for --listen. On machines
+                     with several NUMA nodes, the workers are spread over the
+                     nodes, each one with its own copy of the scene.
+--connect=<address>  Render the tiles handed out by the coordinator at the
+                     address. The scene file is the coordinator's one.
+--serve[=<address>]  Keep the scene loaded and run the commands read from stdin,
+                     or from the clients of the unix:<path> address, one per
+                     line: "camera <json>", "material <json>", "lights <json>",
+                     "render [<passes>]", "write <path>" and "quit". Only the
+                     edits of lights with a shape rebuild the BVH.
 --denoise            Apply a denoising step at the end of the rendering.
+                     Scenes with a camera "sequence" render each of its frames
+                     with these options, written to <output>-0001.png, ...
 --albedo             Outputs the color on the first ray-shape hit.
 --normals            Outputs the normals, remapped to [0, 1].
+--depth              Outputs the distance to the nearest hit of each pixel, as
+                     a float map.
+--primitive-id       Outputs the number of the nearest primitive of each pixel,
+                     in the order of the scene file, as a float map.
+--material-id        Outputs the number of the material of the nearest primitive
+                     of each pixel, as a float map.
 --quiet              Only prints error messages.
 --verbose            Print more stuff.
 
@@ -37,17 +100,42 @@
     exit(1);
 }
 
+/* Adaptive rendering caps the passes to this multiple of the requested ones */
+constexpr uint32_t MaxAdaptivePassRatio = 4;
+
+/* Frames of a sequence rendered but not written yet */
+constexpr size_t MaxPendingFrames = 2;
+
 enum {
     OPTION_QUIET = 1,
     OPTION_VERBOSE = 1 << 1,
     OPTION_DENOISE = 1 << 2,
     OPTION_NORMALS = 1 << 3,
-    OPTION_ALBEDO = 1 << 4
+    OPTION_ALBEDO = 1 << 4,
+    OPTION_RESUME = 1 << 5,
+    OPTION_DEPTH = 1 << 6,
+    OPTION_PRIMITIVE_ID = 1 << 7,
+    OPTION_MATERIAL_ID = 1 << 8,
+    OPTION_SERVE = 1 << 9
 };
 
 struct options {
     char file[256];
     uint32_t quality;
+    uint32_t passes;
+    double budget;
+    double interval;
+    double checkpoint;
+    float threshold;
+    uint32_t tileSize;
+    TileOrder tileOrder;
+    char listen[256];
+    char connect[256];
+    uint32_t workers;
+    char serve[256];
+    uint32_t threads;
+    char cpus[256];
+    int32_t node;
     uint32_t flags;
 };
 
@@ -56,10 +144,214 @@ static inline std::string RemoveExtensionJSON(const std::string &s)
     return s.substr(0, s.rfind(".json"));
 }
 
+/* Passes other than the image needed by the options */
+static uint32_t AOVsFromFlags(uint32_t flags)
+{
+    uint32_t aovs = 0;
+    if (flags & (OPTION_NORMALS | OPTION_DENOISE)) {
+        aovs |= AOV_NORMALS;
+    }
+    if (flags & (OPTION_ALBEDO | OPTION_DENOISE)) {
+        aovs |= AOV_ALBEDO;
+    }
+    if (flags & OPTION_DEPTH) {
+        aovs |= AOV_DEPTH;
+    }
+    if (flags & OPTION_PRIMITIVE_ID) {
+        aovs |= AOV_PRIMITIVE_ID;
+    }
+    if (flags & OPTION_MATERIAL_ID) {
+        aovs |= AOV_MATERIAL_ID;
+    }
+    return aovs;
+}
+
+static sptr<Scene> CreateScene(const sptr<RenderDescription> &render)
+{
+    /* Create BVH */
+    std::string accelerator = Params::string(render->options(), "accelerator", "bvh");
+    sptr<Primitive> accel = Accelerator::create(accelerator, render->primitives());
+
+    return Scene::create(accel, render->lights());
+}
+
+/* Creates the Render for the scene. The coordinator doesn't trace any ray, so it
+ * doesn't need the scene itself. */
+static sptr<Render> CreateRender(const sptr<RenderDescription> &render,
+                                 const sptr<Scene> &scene,
+                                 const sptr<Camera> &camera,
+                                 uint32_t quality,
+                                 uint32_t aovs)
+{
+    /* The images of the textures were decoded while the accelerator was built */
+    render->schedule()->wait();
+
+    /* Create integrator */
+    sptr<Sampler> sampler = Sampler::create(quality, quality, 4, true);
+
+    std::string str = render->options()->string("integrator");
+    sptr<Integrator> integrator = Integrator::create(str, sampler, 4);
+
+    sptr<Render> rdr = Render::create(scene, camera, integrator);
+    rdr->setAOVs(aovs, render->primitives());
+    return rdr;
+}
+
+/* With several NUMA nodes, the workers are spread over the nodes so that each one
+ * renders from a copy of the scene in its local memory */
+static std::vector<pid_t> SpawnWorkers(const char *program,
+                                       uint32_t count,
+                                       const char *address)
+{
+    std::string connect = std::string("--connect=").append(address);
+    std::string node;
+    char *argv[] = { (char *)program, (char *)connect.c_str(), nullptr, nullptr };
+
+    uint32_t nodes = workq_numa_nodes();
+    std::vector<pid_t> pids;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (nodes > 1) {
+            node = "--numa-node=" + std::to_string(i % nodes);
+            argv[2] = (char *)node.c_str();
+        }
+        pid_t pid;
+        if (posix_spawnp(&pid, program, nullptr, nullptr, argv, environ) == 0) {
+            pids.push_back(pid);
+        }
+        else {
+            ERROR("Couldn't start worker: %s", strerror(errno));
+        }
+    }
+    return pids;
+}
+
+static void WritePNG(const sptr<Image> &image, const std::string &path)
+{
+    auto img = Image::create(image, buffer_format_init(TYPE_UINT8, ORDER_RGB));
+    buffer_t buf = img->buffer();
+    image_write_png(path.c_str(), buf.rect.size.x, buf.rect.size.y, buf.data, buf.bpr);
+}
+
+static void WritePFM(const sptr<Image> &image, const std::string &path)
+{
+    buffer_t buf = image->buffer();
+    auto channels = (uint32_t)buffer_order_sizeof(buf.format.order);
+    int32_t err = image_write_pfm(path.c_str(),
+                                  buf.rect.size.x,
+                                  buf.rect.size.y,
+                                  channels,
+                                  buf.data,
+                                  buf.bpr);
+    ERROR_IF(err, "Couldn't write \"%s\"", path.c_str());
+}
+
+/* The image, denoised if requested */
+static sptr<Image> FinalImage(const sptr<Render> &rdr, uint32_t flags)
+{
+    sptr<Image> img = rdr->image();
+    if (flags & OPTION_DENOISE) {
+        img = Denoise(img, rdr->normals(), rdr->albedo());
+    }
+    return img;
+}
+
+static void WriteOutputs(const sptr<Image> &img,
+                         const sptr<Render> &rdr,
+                         const std::string &output,
+                         uint32_t flags)
+{
+    WritePNG(img, std::string(output).append(".png"));
+
+    if (flags & OPTION_ALBEDO) {
+        WritePNG(rdr->albedo(), std::string(output).append("-albedo.png"));
+    }
+    if (flags & OPTION_NORMALS) {
+        WritePNG(rdr->normals(), std::string(output).append("-normals.png"));
+    }
+    if (flags & OPTION_DEPTH) {
+        WritePFM(rdr->depth(), std::string(output).append("-depth.pfm"));
+    }
+    if (flags & OPTION_PRIMITIVE_ID) {
+        WritePFM(rdr->primitiveIDs(), std::string(output).append("-primitive-id.pfm"));
+    }
+    if (flags & OPTION_MATERIAL_ID) {
+        WritePFM(rdr->materialIDs(), std::string(output).append("-material-id.pfm"));
+    }
+}
+
+/* A rendered frame of a sequence, written out by a worker */
+struct FrameOutput : Object {
+    sptr<Image> image;
+    sptr<Render> render;
+    std::string output;
+    uint32_t flags;
+};
+
+static void WriteFrame(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto frame = std::static_pointer_cast<FrameOutput>(obj);
+    WriteOutputs(frame->image, frame->render, frame->output, frame->flags);
+}
+
+static void RenderSequence(const sptr<RenderDescription> &render,
+                           const struct options &options,
+                           uint32_t aovs,
+                           const std::string &output)
+{
+    sptr<Scene> scene = CreateScene(render);
+    const std::vector<sptr<Camera>> &cameras = render->cameras();
+
+    std::deque<sptr<Event>> written;
+    for (size_t f = 0; f < cameras.size(); ++f) {
+        sptr<Render> rdr =
+            CreateRender(render, scene, cameras[f], options.quality, aovs);
+        rdr->setTiles(options.tileSize, options.tileOrder);
+
+        uint32_t passes = std::max(options.passes, 1u);
+        uint64_t budget = UINT64_MAX;
+        if (options.threshold > .0f) {
+            rdr->setAdaptiveThreshold(options.threshold);
+            v2u res = cameras[f]->resolution();
+            budget = (uint64_t)passes * options.quality * options.quality * res.x * res.y;
+            passes *= MaxAdaptivePassRatio;
+        }
+        for (uint32_t i = 0; i < passes; ++i) {
+            rdr->schedulePass()->wait();
+            if (rdr->samples() >= budget || rdr->activePixels() == 0) {
+                break;
+            }
+        }
+
+        /* Converted, denoised and encoded by a worker while the tiles of the next
+         * frame render on the others */
+        auto frame = std::make_shared<FrameOutput>();
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "-%04lu", f + 1);
+        frame->image = FinalImage(rdr, options.flags);
+        frame->render = rdr;
+        frame->output = std::string(output).append(suffix);
+        frame->flags = options.flags;
+        written.push_back(
+            frame->image->schedule()->notify(workq_get_queue(), WriteFrame, frame, {}));
+
+        /* Only keep a few frames in memory */
+        while (written.size() > MaxPendingFrames) {
+            written.front()->wait();
+            written.pop_front();
+        }
+    }
+    for (const auto &e : written) {
+        e->wait();
+    }
+}
+
 int main(int argc, char *argv[])
 {
     /* Process arguments */
-    struct options options = { "\0", 1, 0 };
+    struct options options = {
+        "\0", 1, 0, .0, .0, .0, .0f, 32, TileOrder::Center, "\0", "\0", 0, "\0",
+        0,    "\0", -1, 0
+    };
 
     if (argc == 1) {
         usage();
@@ -71,6 +363,66 @@ int main(int argc, char *argv[])
         else if (char *cc = strstr(argv[i], "-quality=")) {
             options.quality = (uint32_t)atoi(cc + 9);
         }
+        else if (char *p = strstr(argv[i], "-passes=")) {
+            options.passes = (uint32_t)atoi(p + 8);
+        }
+        else if (char *b = strstr(argv[i], "-time-budget=")) {
+            options.budget = atof(b + 13);
+        }
+        else if (char *w = strstr(argv[i], "-write-interval=")) {
+            options.interval = atof(w + 16);
+        }
+        else if (char *ck = strstr(argv[i], "-checkpoint-interval=")) {
+            options.checkpoint = atof(ck + 21);
+        }
+        else if (char *a = strstr(argv[i], "-adaptive=")) {
+            options.threshold = (float)atof(a + 10);
+        }
+        else if (char *t = strstr(argv[i], "-tile-size=")) {
+            options.tileSize = (uint32_t)atoi(t + 11);
+            if (options.tileSize == 0) {
+                usage("Invalid tile size");
+            }
+        }
+        else if (char *o = strstr(argv[i], "-tile-order=")) {
+            if (!strcmp(o + 12, "center")) {
+                options.tileOrder = TileOrder::Center;
+            }
+            else if (!strcmp(o + 12, "hilbert")) {
+                options.tileOrder = TileOrder::Hilbert;
+            }
+            else if (!strcmp(o + 12, "columns")) {
+                options.tileOrder = TileOrder::Columns;
+            }
+            else {
+                usage("Invalid tile order");
+            }
+        }
+        else if (char *th = strstr(argv[i], "-threads=")) {
+            options.threads = (uint32_t)atoi(th + 9);
+        }
+        else if (char *cpu = strstr(argv[i], "-cpus=")) {
+            strncpy(options.cpus, cpu + 6, 255);
+        }
+        else if (char *nn = strstr(argv[i], "-numa-node=")) {
+            options.node = atoi(nn + 11);
+        }
+        else if (char *l = strstr(argv[i], "-listen=")) {
+            strncpy(options.listen, l + 8, 255);
+        }
+        else if (char *sw = strstr(argv[i], "-spawn-workers=")) {
+            options.workers = (uint32_t)atoi(sw + 15);
+        }
+        else if (char *cn = strstr(argv[i], "-connect=")) {
+            strncpy(options.connect, cn + 9, 255);
+        }
+        else if (char *sv = strstr(argv[i], "-serve=")) {
+            strncpy(options.serve, sv + 7, 255);
+            options.flags |= OPTION_SERVE;
+        }
+        else if (!strcmp(argv[i], "--serve") || !strcmp(argv[i], "-serve")) {
+            options.flags |= OPTION_SERVE;
+        }
         else if (!strcmp(argv[i], "--denoise") || !strcmp(argv[i], "-denoise")) {
             options.flags |= OPTION_DENOISE;
         }
@@ -80,6 +432,19 @@ int main(int argc, char *argv[])
         else if (!strcmp(argv[i], "--normals") || !strcmp(argv[i], "-normals")) {
             options.flags |= OPTION_NORMALS;
         }
+        else if (!strcmp(argv[i], "--depth") || !strcmp(argv[i], "-depth")) {
+            options.flags |= OPTION_DEPTH;
+        }
+        else if (!strcmp(argv[i], "--primitive-id")
+                 || !strcmp(argv[i], "-primitive-id")) {
+            options.flags |= OPTION_PRIMITIVE_ID;
+        }
+        else if (!strcmp(argv[i], "--material-id") || !strcmp(argv[i], "-material-id")) {
+            options.flags |= OPTION_MATERIAL_ID;
+        }
+        else if (!strcmp(argv[i], "--resume") || !strcmp(argv[i], "-resume")) {
+            options.flags |= OPTION_RESUME;
+        }
         else if (!strcmp(argv[i], "--verbose") || !strcmp(argv[i], "-verbose")) {
             options.flags |= OPTION_VERBOSE;
         }
@@ -91,6 +456,28 @@ int main(int argc, char *argv[])
             strncpy(options.file, argv[i], 255);
         }
     }
+
+    /* Before anything runs on the threads */
+    workq_config config;
+    config.threads = options.threads;
+    config.cpus = options.cpus;
+    config.node = options.node;
+    DIE_IF(!workq_configure(config), "Invalid thread setup");
+
+    /* Worker, the coordinator sends the scene to render */
+    if (options.connect[0]) {
+        bool ok = RenderWorker(options.connect, [](const RenderSetup &setup) {
+            sptr<RenderDescription> render = RenderDescription::load(setup.file);
+            return render ? CreateRender(render,
+                                         CreateScene(render),
+                                         render->camera(),
+                                         setup.quality,
+                                         setup.aovs)
+                          : nullptr;
+        });
+        return ok ? 0 : 1;
+    }
+
     sptr<RenderDescription> render = RenderDescription::load(options.file);
 
     DIE_IF(!render, "Nothing to render");
@@ -98,64 +485,165 @@ int main(int argc, char *argv[])
     WARNING_IF(render->primitives().empty(), "Scene has no primitive");
     WARNING_IF(render->lights().empty(), "Scene has no light");
 
-    /* Create BVH */
-    std::string accelerator = Params::string(render->options(), "accelerator", "bvh");
-    sptr<Primitive> accel = Accelerator::create(accelerator, render->primitives());
-
-    /* Create Scene */
-    sptr<Scene> scene = Scene::create(accel, render->lights());
-
-    /* Get camera */
-    sptr<Camera> camera = render->camera();
-
-    /* Create integrator */
-    uint32_t ns = options.quality;
-    sptr<Sampler> sampler = Sampler::create(ns, ns, 4, true);
-
-    std::string str = render->options()->string("integrator");
-    sptr<Integrator> integrator = Integrator::create(str, sampler, 4);
-
     /* Get output filename */
     std::string output = Params::string(render->options(),
                                         "output",
                                         RemoveExtensionJSON(options.file));
 
     /* Create rendering context */
-    sptr<Render> rdr = Render::create(scene, camera, integrator);
+    bool distributed = options.listen[0] != '\0';
+    uint32_t aovs = AOVsFromFlags(options.flags);
 
-    /* Render and write out */
-    sptr<Image> img = rdr->image();
-    if (options.flags & OPTION_DENOISE) {
-        img = Denoise(img, rdr->normals(), rdr->albedo());
+    /* Keep the scene loaded and render on request */
+    if (options.flags & OPTION_SERVE) {
+        auto create = [&](const sptr<RenderDescription> &desc, const sptr<Scene> &scene) {
+            sptr<Render> r =
+                CreateRender(desc, scene, desc->camera(), options.quality, aovs);
+            r->setTiles(options.tileSize, options.tileOrder);
+            r->setAdaptiveThreshold(options.threshold);
+            return r;
+        };
+        sptr<RenderServer> server = RenderServer::create(render, create);
+        if (options.serve[0]) {
+            return Serve(server, options.serve) ? 0 : 1;
+        }
+        Serve(server, STDIN_FILENO, STDOUT_FILENO);
+        return 0;
     }
-    img = Image::create(img, buffer_format_init(TYPE_UINT8, ORDER_RGB));
 
-    buffer_t buf = img->buffer();
-    image_write_png(std::string(output).append(".png").c_str(),
-                    buf.rect.size.x,
-                    buf.rect.size.y,
-                    buf.data,
-                    buf.bpr);
-
-    if (options.flags & OPTION_ALBEDO) {
-        auto albedo = Image::create(rdr->albedo(),
-                                    buffer_format_init(TYPE_UINT8, ORDER_RGB));
-        auto abuf = albedo->buffer();
-        image_write_png(std::string(output).append("-albedo.png").c_str(),
-                        abuf.rect.size.x,
-                        abuf.rect.size.y,
-                        abuf.data,
-                        abuf.bpr);
-    }
-    if (options.flags & OPTION_NORMALS) {
-        auto normals = Image::create(rdr->normals(),
-                                     buffer_format_init(TYPE_UINT8, ORDER_RGB));
-        auto nbuf = normals->buffer();
-        image_write_png(std::string(output).append("-normals.png").c_str(),
-                        nbuf.rect.size.x,
-                        nbuf.rect.size.y,
-                        nbuf.data,
-                        nbuf.bpr);
+    /* Render the frames of the sequence with the same scene */
+    if (!render->cameras().empty() && !distributed) {
+        WARNING_IF(options.budget > .0 || options.checkpoint > .0
+                       || (options.flags & OPTION_RESUME),
+                   "Sequences ignore time budgets and checkpoints");
+        RenderSequence(render, options, aovs, output);
+        return 0;
+    }
+
+    sptr<Render> rdr = CreateRender(render,
+                                    distributed ? nullptr : CreateScene(render),
+                                    render->camera(),
+                                    options.quality,
+                                    aovs);
+    rdr->setTiles(options.tileSize, options.tileOrder);
+
+    /* Render passes until the requested count or the time budget is reached */
+    using clock = std::chrono::steady_clock;
+    auto seconds = [](clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    };
+
+    uint32_t passes = options.passes;
+    if (passes == 0) {
+        passes = options.budget > .0 ? UINT32_MAX : 1;
+    }
+
+    /* Adaptive rendering spends the samples of the requested passes, and
+     * converged pixels don't cost any, so it runs more passes */
+    uint64_t budget = UINT64_MAX;
+    if (options.threshold > .0f) {
+        rdr->setAdaptiveThreshold(options.threshold);
+        if (passes != UINT32_MAX) {
+            v2u res = rdr->image()->size();
+            budget = (uint64_t)passes * options.quality * options.quality * res.x * res.y;
+            passes *= MaxAdaptivePassRatio;
+        }
+    }
+    std::string png = std::string(output).append(".png");
+    std::string ckpt = std::string(output).append(".ckpt");
+
+    if (distributed) {
+        WARNING_IF(options.threshold > .0f || options.budget > .0,
+                   "Distributed renders ignore adaptive sampling and time budgets");
+        WARNING_IF(options.checkpoint > .0 || (options.flags & OPTION_RESUME),
+                   "Distributed renders can't be checkpointed");
+
+        sptr<Coordinator> coordinator = Coordinator::create(options.listen);
+        DIE_IF(!coordinator, "Couldn't start the coordinator");
+
+        /* Workers may not share the working directory */
+        char path[PATH_MAX];
+        DIE_IF(!realpath(options.file, path), "Couldn't resolve %s", options.file);
+
+        std::vector<pid_t> workers = SpawnWorkers(argv[0],
+                                                  options.workers,
+                                                  options.listen);
+        RenderSetup setup = { path, options.quality, aovs };
+        bool ok = coordinator->render(rdr, setup, std::max(options.passes, 1u));
+        for (pid_t pid : workers) {
+            if (!ok) {
+                kill(pid, SIGTERM);
+            }
+            waitpid(pid, nullptr, 0);
+        }
+        DIE_IF(!ok, "Distributed render failed");
+    }
+    else {
+        /* Without a checkpoint yet, the render starts from scratch */
+        if ((options.flags & OPTION_RESUME) && access(ckpt.c_str(), F_OK) == 0) {
+            DIE_IF(!rdr->resume(ckpt), "Couldn't resume the render");
+            LOG("Resuming after %u passes", rdr->passes());
+        }
+        uint32_t first = rdr->passes();
+
+        std::vector<double> busy = workq_busy_times(workq_get_queue());
+        clock::time_point start = clock::now();
+        clock::time_point written = start;
+        clock::time_point saved = start;
+        auto save = [&](clock::time_point now) {
+            if (options.checkpoint > .0 && seconds(now - saved) >= options.checkpoint) {
+                rdr->checkpoint(ckpt);
+                saved = now;
+            }
+        };
+
+        for (uint32_t i = first; i < passes; ++i) {
+            sptr<Event> pass = rdr->schedulePass();
+            while (options.checkpoint > .0 && !pass->test()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                save(clock::now());
+            }
+            pass->wait();
+            if (rdr->samples() >= budget || rdr->activePixels() == 0) {
+                break;
+            }
+
+            clock::time_point now = clock::now();
+            double elapsed = seconds(now - start);
+            double last = elapsed / (i + 1 - first);
+            if (options.budget > .0 && elapsed + last > options.budget) {
+                break;
+            }
+            save(now);
+            if (i + 1 < passes && options.interval > .0
+                && seconds(now - written) >= options.interval) {
+                WritePNG(rdr->image(), png);
+                written = now;
+            }
+        }
+
+        /* Time the threads spent waiting for tiles to render */
+        if (options.flags & OPTION_VERBOSE) {
+            double wall = seconds(clock::now() - start);
+            std::vector<double> done = workq_busy_times(workq_get_queue());
+            for (size_t i = 0; i < done.size(); ++i) {
+                double idle = wall - (done[i] - busy[i]);
+                LOG("Thread %lu idle for %.2fs (%.1f%%)", i, idle, idle / wall * 100.);
+            }
+            ScratchStats stats = Scratch::stats();
+            LOG("%llu tiles, %llu samples, %llu samplers allocated",
+                (unsigned long long)stats.tiles,
+                (unsigned long long)stats.samples,
+                (unsigned long long)stats.samplers);
+        }
+    }
+
+    /* Write out */
+    WriteOutputs(FinalImage(rdr, options.flags), rdr, output, options.flags);
+
+    /* The render is complete */
+    if (options.checkpoint > .0) {
+        unlink(ckpt.c_str());
     }
 
     return 0;
@@ -0,0 +1,205 @@
+#include "shapes/binmesh.hpp"
+
+#include "shapes/mesh-priv.hpp"
+
+#include "rt1w/error.h"
+#include "rt1w/params.hpp"
+#include "rt1w/transform.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#pragma mark - Mapped File
+
+struct MappedFile : Object {
+    static sptr<MappedFile> create(const std::string &path);
+
+    MappedFile(void *addr, size_t size) : m_addr(addr), m_size(size) {}
+    ~MappedFile() override { munmap(m_addr, m_size); }
+
+    const BinMeshHeader &header() const { return *(const BinMeshHeader *)m_addr; }
+
+    /* Array at offset, nullptr for absent arrays */
+    template <typename T>
+    const T *data(uint64_t offset) const
+    {
+        return offset ? (const T *)((const char *)m_addr + offset) : nullptr;
+    }
+
+    void *m_addr;
+    size_t m_size;
+};
+
+sptr<MappedFile> MappedFile::create(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ERROR("Couldn't open \"%s\"", path.c_str());
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ERROR("Couldn't stat \"%s\"", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    /* The mapping stays valid once the file descriptor is closed */
+    auto size = (size_t)st.st_size;
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        ERROR("Couldn't map \"%s\"", path.c_str());
+        return nullptr;
+    }
+    return std::make_shared<MappedFile>(addr, size);
+}
+
+#pragma mark - Validation
+
+static bool ValidArray(size_t size, uint64_t offset, uint64_t count, size_t stride)
+{
+    return offset % BinMeshAlignment == 0 && offset >= sizeof(BinMeshHeader)
+           && offset <= size && count <= (size - offset) / stride;
+}
+
+static bool ValidHeader(const BinMeshHeader &h, size_t size)
+{
+    if (memcmp(h.magic, BinMeshMagic, sizeof(BinMeshMagic)) != 0) {
+        ERROR("binmesh: invalid magic");
+        return false;
+    }
+    if (h.version != BinMeshVersion) {
+        ERROR("binmesh: unsupported version %u", h.version);
+        return false;
+    }
+    if (h.nv > UINT32_MAX || h.nt > UINT32_MAX) {
+        ERROR("binmesh: too many vertices or triangles");
+        return false;
+    }
+    if (!ValidArray(size, h.v, h.nv, sizeof(v3f))
+        || (h.n && !ValidArray(size, h.n, h.nv, sizeof(v3f)))
+        || (h.uv && !ValidArray(size, h.uv, h.nv, sizeof(v2f)))
+        || !ValidArray(size, h.i, 3 * h.nt, sizeof(uint32_t))) {
+        ERROR("binmesh: arrays out of the file's bounds");
+        return false;
+    }
+    return true;
+}
+
+#pragma mark - Static Constructors
+
+sptr<Mesh> Mesh::create_binary(const sptr<Params> &p)
+{
+    std::string file = Params::string(p, "file");
+    if (file.empty()) {
+        ERROR("Binary mesh parameter \"file\" not specified");
+        return nullptr;
+    }
+
+    sptr<MappedFile> mf = MappedFile::create(file);
+    if (!mf) {
+        return nullptr;
+    }
+    if (mf->m_size < sizeof(BinMeshHeader)) {
+        ERROR("binmesh: \"%s\" is too small", file.c_str());
+        return nullptr;
+    }
+
+    const BinMeshHeader &h = mf->header();
+    if (!ValidHeader(h, mf->m_size)) {
+        return nullptr;
+    }
+
+    /* Make sure that the indices can't read past the vertex arrays */
+    const auto *i = mf->data<uint32_t>(h.i);
+    for (size_t j = 0; j < 3 * h.nt; ++j) {
+        if (i[j] >= h.nv) {
+            ERROR("binmesh: index %u out of range", i[j]);
+            return nullptr;
+        }
+    }
+
+    /* Vertex & Mesh data point directly into the mapped file */
+    sptr<VertexData> vd = VertexData::create(h.nv,
+                                             mf->data<v3f>(h.v),
+                                             mf->data<v3f>(h.n),
+                                             mf->data<v2f>(h.uv),
+                                             mf);
+
+    Transform t = Transform(Params::matrix44f(p, "transform", m44f_identity()));
+    sptr<MeshData> md = MeshData::create(h.nt, vd, i, mf, t);
+
+    return Mesh::create(md);
+}
+
+#pragma mark - Writer
+
+static bool WriteArray(FILE *fp, const void *data, size_t size, uint64_t offset)
+{
+    static const char zeros[BinMeshAlignment] = {};
+
+    /* Pad up to the array's offset */
+    auto pos = (uint64_t)ftell(fp);
+    if (fwrite(zeros, 1, offset - pos, fp) != offset - pos) {
+        return false;
+    }
+    return fwrite(data, 1, size, fp) == size;
+}
+
+static uint64_t Align(uint64_t offset)
+{
+    return (offset + BinMeshAlignment - 1) & ~(BinMeshAlignment - 1);
+}
+
+bool WriteBinMesh(const std::string &path,
+                  size_t nv,
+                  const v3f *v,
+                  const v3f *n,
+                  const v2f *uv,
+                  size_t nt,
+                  const uint32_t *i)
+{
+    BinMeshHeader h = {};
+    memcpy(h.magic, BinMeshMagic, sizeof(BinMeshMagic));
+    h.version = BinMeshVersion;
+    h.nv = nv;
+    h.nt = nt;
+
+    uint64_t offset = Align(sizeof(BinMeshHeader));
+    h.v = offset;
+    offset = Align(offset + nv * sizeof(v3f));
+    if (n) {
+        h.n = offset;
+        offset = Align(offset + nv * sizeof(v3f));
+    }
+    if (uv) {
+        h.uv = offset;
+        offset = Align(offset + nv * sizeof(v2f));
+    }
+    h.i = offset;
+
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        ERROR("Couldn't open \"%s\" for writing", path.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1
+              && WriteArray(fp, v, nv * sizeof(v3f), h.v)
+              && (!n || WriteArray(fp, n, nv * sizeof(v3f), h.n))
+              && (!uv || WriteArray(fp, uv, nv * sizeof(v2f), h.uv))
+              && WriteArray(fp, i, 3 * nt * sizeof(uint32_t), h.i);
+
+    ok = fclose(fp) == 0 && ok;
+    ERROR_IF(!ok, "Couldn't write \"%s\"", path.c_str());
+
+    return ok;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "rt1w/geometry.hpp"
+
+#include <string>
+
+/* Binary mesh file layout, all values in host byte order:
+ *
+ *   BinMeshHeader
+ *   positions  nv x v3f
+ *   normals    nv x v3f (optional)
+ *   uvs        nv x v2f (optional)
+ *   indices    3 * nt x uint32_t
+ *
+ * Each array starts at the offset stored in the header, aligned on BinMeshAlignment
+ * bytes so that it can be used in place once the file is mapped in memory. The offset
+ * of an optional array that is not present is 0.
+ */
+constexpr char BinMeshMagic[8] = { 'R', 'T', '1', 'W', 'M', 'S', 'H', '\0' };
+constexpr uint32_t BinMeshVersion = 1;
+constexpr uint64_t BinMeshAlignment = 64;
+
+struct BinMeshHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t nv; /* Vertex count */
+    uint64_t nt; /* Triangle count */
+    uint64_t v;  /* Offset of the positions */
+    uint64_t n;  /* Offset of the normals */
+    uint64_t uv; /* Offset of the texture coordinates */
+    uint64_t i;  /* Offset of the indices */
+};
+
+bool WriteBinMesh(const std::string &path,
+                  size_t nv,
+                  const v3f *v,
+                  const v3f *n,
+                  const v2f *uv,
+                  size_t nt,
+                  const uint32_t *i);
@@ -4,6 +4,9 @@
 
 #include "rt1w/transform.hpp"
 
+#include <mutex>
+#include <vector>
+
 #pragma mark - Vertex Data
 
 struct VertexData : Object {
@@ -14,6 +17,14 @@ struct VertexData : Object {
     {
         return std::make_shared<VertexData>(nv, v, n, uv);
     }
+    static sptr<VertexData> create(size_t nv,
+                                   const v3f *v,
+                                   const v3f *n,
+                                   const v2f *uv,
+                                   const sptr<const Object> &storage)
+    {
+        return std::make_shared<VertexData>(nv, v, n, uv, storage);
+    }
 
     VertexData(size_t nv,
                uptr<std::vector<v3f>> &v,
@@ -23,7 +34,20 @@ struct VertexData : Object {
         m_v(v ? v->data() : nullptr),
         m_n(n ? n->data() : nullptr),
         m_uv(uv ? uv->data() : nullptr),
-        m_data({ std::move(v), std::move(n), std::move(uv) })
+        m_data({ std::move(v), std::move(n), std::move(uv), nullptr })
+    {}
+
+    /* Points at arrays owned by storage (e.g. a mapped file), nothing is copied */
+    VertexData(size_t nv,
+               const v3f *v,
+               const v3f *n,
+               const v2f *uv,
+               const sptr<const Object> &storage) :
+        m_nv(nv),
+        m_v(v),
+        m_n(n),
+        m_uv(uv),
+        m_data({ nullptr, nullptr, nullptr, storage })
     {}
 
     const size_t m_nv;
@@ -35,6 +59,7 @@ struct VertexData : Object {
         uptr<const std::vector<v3f>> v;
         uptr<const std::vector<v3f>> n;
         uptr<const std::vector<v2f>> uv;
+        sptr<const Object> storage;
     } m_data;
 };
 
@@ -48,6 +73,14 @@ struct MeshData : Object {
     {
         return std::make_shared<MeshData>(np, vd, i, worldToObj);
     }
+    static sptr<MeshData> create(size_t np,
+                                 const sptr<VertexData> &vd,
+                                 const uint32_t *i,
+                                 const sptr<const Object> &storage,
+                                 const Transform &worldToObj)
+    {
+        return std::make_shared<MeshData>(np, vd, i, storage, worldToObj);
+    }
 
     MeshData(size_t np,
              const sptr<VertexData> &vd,
@@ -59,9 +92,37 @@ struct MeshData : Object {
         m_vd(vd),
         m_worldToObj(worldToObj),
         m_objToWorld(Inverse(worldToObj)),
-        m_data({ std::move(i) })
+        m_data({ std::move(i), nullptr })
     {}
 
+    /* Points at indices owned by storage (e.g. a mapped file), nothing is copied */
+    MeshData(size_t np,
+             const sptr<VertexData> &vd,
+             const uint32_t *i,
+             const sptr<const Object> &storage,
+             const Transform &worldToObj) :
+        m_np(np),
+        m_ni(3 * np),
+        m_i(i),
+        m_vd(vd),
+        m_worldToObj(worldToObj),
+        m_objToWorld(Inverse(worldToObj)),
+        m_data({ nullptr, storage })
+    {}
+
+    /* The vertices in world space, only computed the first time the triangles are
+     * sampled by solid angle, i.e. for the emitters */
+    const v3f *worldVertices() const
+    {
+        std::call_once(m_world.once, [this]() {
+            m_world.v.resize(m_vd->m_nv);
+            for (size_t i = 0; i < m_vd->m_nv; ++i) {
+                m_world.v[i] = Mulp(m_objToWorld, m_vd->m_v[i]);
+            }
+        });
+        return m_world.v.data();
+    }
+
     const size_t m_np;
     const size_t m_ni;
     const uint32_t *m_i;
@@ -70,5 +131,10 @@ struct MeshData : Object {
     const Transform m_objToWorld;
     struct {
         uptr<std::vector<uint32_t>> i;
+        sptr<const Object> storage;
     } m_data;
+    mutable struct {
+        std::once_flag once;
+        std::vector<v3f> v;
+    } m_world;
 };
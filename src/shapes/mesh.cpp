@@ -2,6 +2,7 @@
 
 #include "rt1w/error.h"
 #include "rt1w/interaction.hpp"
+#include "rt1w/parallel.hpp"
 #include "rt1w/params.hpp"
 #include "rt1w/primitive.hpp"
 #include "rt1w/ray.hpp"
@@ -14,7 +15,7 @@
 #pragma mark - Triangle
 
 struct Triangle : Shape {
-    Triangle(const sptr<MeshData> &md, size_t ix) : m_md(md), m_v(&(md->m_i[3 * ix])) {}
+    Triangle(const sptr<MeshData> &md, size_t ix);
 
     bool intersect(const Ray &r, Interaction &isect) const override;
     bool qIntersect(const Ray &r) const override;
@@ -28,11 +29,33 @@ struct Triangle : Shape {
 
     Interaction sample(const Interaction &ref, const v2f &u) const override;
     float pdf(const Interaction &ref, const v3f &wi) const override;
+    float pdf(const Interaction &ref, const Interaction &isect) const override;
+
+    Interaction interaction(const v3f &b) const;
+    void worldVertices(v3f v[3]) const;
 
     sptr<const MeshData> m_md;
     const uint32_t *const m_v;
+    float m_area; /* World space area */
 };
 
+/* Solid angle bounds outside of which triangles are area sampled: the spherical
+ * sampling is numerically unstable for tiny triangles, and noisier than area sampling
+ * for triangles covering almost the whole hemisphere. */
+static constexpr float MinSphericalSampleArea = 3e-4f;
+static constexpr float MaxSphericalSampleArea = 6.22f;
+
+Triangle::Triangle(const sptr<MeshData> &md, size_t ix) :
+    m_md(md),
+    m_v(&(md->m_i[3 * ix]))
+{
+    const v3f p0 = Mulp(m_md->m_objToWorld, m_md->m_vd->m_v[m_v[0]]);
+    const v3f p1 = Mulp(m_md->m_objToWorld, m_md->m_vd->m_v[m_v[1]]);
+    const v3f p2 = Mulp(m_md->m_objToWorld, m_md->m_vd->m_v[m_v[2]]);
+
+    m_area = .5f * Cross(p1 - p0, p2 - p0).length();
+}
+
 static size_t MaxDimension(const v3f &v)
 {
     return v.x > v.y ? (v.x > v.z ? 0 : 2) : (v.y > v.z ? 1 : 2);
@@ -282,11 +305,7 @@ bool Triangle::qIntersect(const Ray &ray) const
 
 float Triangle::area() const
 {
-    const v3f p0 = Mulp(m_md->m_objToWorld, m_md->m_vd->m_v[m_v[0]]);
-    const v3f p1 = Mulp(m_md->m_objToWorld, m_md->m_vd->m_v[m_v[1]]);
-    const v3f p2 = Mulp(m_md->m_objToWorld, m_md->m_vd->m_v[m_v[2]]);
-
-    return .5f * Cross(p1 - p0, p2 - p0).length();
+    return m_area;
 }
 
 bounds3f Triangle::bounds() const
@@ -300,7 +319,7 @@ bounds3f Triangle::bounds() const
     return m_md->m_objToWorld(Union(bounds3f(p0, p1), p2));
 }
 
-Interaction Triangle::sample(const v2f &u) const
+Interaction Triangle::interaction(const v3f &b) const
 {
     sptr<VertexData> vd = m_md->m_vd;
 
@@ -308,13 +327,12 @@ Interaction Triangle::sample(const v2f &u) const
     v3f p1 = vd->m_v[m_v[1]];
     v3f p2 = vd->m_v[m_v[2]];
 
-    v2f b = UniformSampleTriangle(u);
     Interaction it;
-    it.p = b.x * p0 + b.y * p1 + (1.0f - b.x - b.y) * p2;
+    it.p = b.x * p0 + b.y * p1 + b.z * p2;
 
     if (vd->m_n) {
         it.n = Normalize(b.x * vd->m_n[m_v[0]] + b.y * vd->m_n[m_v[1]]
-                         + (1.0f - b.x - b.y) * vd->m_n[m_v[2]]);
+                         + b.z * vd->m_n[m_v[2]]);
     }
     else {
         it.n = Normalize(Cross(p1 - p0, p2 - p0));
@@ -325,9 +343,44 @@ Interaction Triangle::sample(const v2f &u) const
     return it;
 }
 
-Interaction Triangle::sample(const Interaction &, const v2f &u) const
+void Triangle::worldVertices(v3f v[3]) const
+{
+    const v3f *wv = m_md->worldVertices();
+    for (size_t i = 0; i < 3; ++i) {
+        v[i] = wv[m_v[i]];
+    }
+}
+
+static float SolidAngle(const v3f v[3], const v3f &p)
+{
+    return SphericalTriangleArea(Normalize(v[0] - p),
+                                 Normalize(v[1] - p),
+                                 Normalize(v[2] - p));
+}
+
+Interaction Triangle::sample(const v2f &u) const
+{
+    v2f b = UniformSampleTriangle(u);
+    return interaction({ b.x, b.y, 1.0f - b.x - b.y });
+}
+
+Interaction Triangle::sample(const Interaction &ref, const v2f &u) const
 {
-    return sample(u);
+    v3f v[3];
+    worldVertices(v);
+    float sa = SolidAngle(v, ref.p);
+    if (sa < MinSphericalSampleArea || sa > MaxSphericalSampleArea) {
+        return sample(u);
+    }
+
+    /* Barycentrics are invariant under the affine objToWorld transform */
+    float pdf;
+    v3f b = SampleSphericalTriangle(v, ref.p, u, pdf);
+    if (!(pdf > .0f)) {
+        /* Degenerate as seen from ref, pdf() makes the same test */
+        return sample(u);
+    }
+    return interaction(b);
 }
 
 float Triangle::pdf(const Interaction &ref, const v3f &wi) const
@@ -337,7 +390,20 @@ float Triangle::pdf(const Interaction &ref, const v3f &wi) const
     if (!intersect(r, isect)) {
         return .0f;
     }
-    return DistanceSquared(ref.p, isect.p) / (AbsDot(isect.n, -wi) * area());
+    return pdf(ref, isect);
+}
+
+float Triangle::pdf(const Interaction &ref, const Interaction &isect) const
+{
+    v3f v[3];
+    worldVertices(v);
+    float sa = SolidAngle(v, ref.p);
+    if (sa < MinSphericalSampleArea || sa > MaxSphericalSampleArea
+        || !CanSampleSphericalTriangle(v, ref.p)) {
+        v3f wi = Normalize(isect.p - ref.p);
+        return DistanceSquared(ref.p, isect.p) / (AbsDot(isect.n, -wi) * m_area);
+    }
+    return 1.f / sa;
 }
 
 #pragma mark - Mesh
@@ -357,6 +423,7 @@ struct _Mesh : Mesh {
 
     Interaction sample(const Interaction &ref, const v2f &u) const override;
     float pdf(const Interaction &ref, const v3f &wi) const override;
+    float pdf(const Interaction &ref, const Interaction &isect) const override;
 
     std::vector<sptr<Shape>> faces() const override;
 
@@ -366,13 +433,22 @@ struct _Mesh : Mesh {
     Transform m_worldToObj;
 };
 
+/* Triangles created by each job */
+constexpr size_t FacesGrain = 4096;
+
 _Mesh::_Mesh(const sptr<MeshData> &md)
 {
-    m_faces.reserve(md->m_np);
-    for (size_t j = 0; j < md->m_np; j++) {
-        m_faces.emplace_back(std::make_shared<Triangle>(md, j));
-        m_box = Union(m_box, m_faces[j]->bounds());
-    }
+    m_faces.resize(md->m_np);
+    auto create = [&](size_t bgn, size_t end) {
+        bounds3f box;
+        for (size_t j = bgn; j < end; j++) {
+            m_faces[j] = std::make_shared<Triangle>(md, j);
+            box = Union(box, m_faces[j]->bounds());
+        }
+        return box;
+    };
+    auto unite = [](const bounds3f &a, const bounds3f &b) { return Union(a, b); };
+    m_box = parallel_reduce(md->m_np, FacesGrain, bounds3f(), create, unite);
 }
 
 bool _Mesh::intersect(const Ray &r, Interaction &isect) const
@@ -434,6 +510,13 @@ float _Mesh::pdf(const Interaction &, const v3f &) const
     return .0f;
 }
 
+float _Mesh::pdf(const Interaction &, const Interaction &) const
+{
+    /* This function should not be called, Triangle::pdf should be called instead */
+    ASSERT(0);
+    return .0f;
+}
+
 std::vector<sptr<Shape>> _Mesh::faces() const
 {
     return std::vector<sptr<Shape>>(std::begin(m_faces), std::end(m_faces));
@@ -441,13 +524,18 @@ std::vector<sptr<Shape>> _Mesh::faces() const
 
 #pragma mark - Static Constructors
 
+sptr<Mesh> Mesh::create(const sptr<MeshData> &md)
+{
+    return std::make_shared<_Mesh>(md);
+}
+
 sptr<Mesh> Mesh::create(size_t nt,
                         const sptr<VertexData> &vd,
                         uptr<std::vector<uint32_t>> &i,
                         const Transform &worldToObj)
 {
     sptr<MeshData> md = CreateMeshData(nt, vd, i, worldToObj);
-    return std::make_shared<_Mesh>(md);
+    return Mesh::create(md);
 }
 sptr<Mesh> Mesh::create(size_t nt,
                         uptr<std::vector<v3f>> &v,
@@ -22,6 +22,8 @@ sptr<MeshData> CreateMeshData(size_t np,
 
 struct Mesh : Group {
     static sptr<Mesh> create(const sptr<Params> &p);
+    static sptr<Mesh> create(const sptr<MeshData> &md);
+    static sptr<Mesh> create_binary(const sptr<Params> &p);
     static sptr<Mesh> create(size_t nt,
                              const sptr<VertexData> &vd,
                              uptr<std::vector<uint32_t>> &i,
@@ -32,17 +32,42 @@ static inline bool SphereQuadratic(const Ray &r,
     return Quadratic(a, b, c, t0, t1);
 }
 
+/* Conservative float test in world space, only rejects rays that certainly miss the
+ * sphere or only hit it past r.max(). The error bounds and the padded radius are loose
+ * enough to cover both the float rounding & the object space transform done by the
+ * robust EFloat test. */
+static inline bool SphereMayHit(const Ray &r, const v3f &center, float radius)
+{
+    radius *= 1.f + 1e-4f;
+    v3f oc = r.org() - center;
+    v3f d = r.dir();
+
+    float a = Dot(d, d);
+    float b = Dot(oc, d);
+    float oc2 = Dot(oc, oc);
+    float c = oc2 - radius * radius;
+
+    float delta = b * b - a * c;
+    float deltaError = gamma(16) * (b * b + a * (oc2 + radius * radius));
+    if (delta < -deltaError) {
+        return false;
+    }
+    float sq = std::sqrt(std::max(.0f, delta) + deltaError);
+    float tError = gamma(16) * (std::abs(b) + sq) / a;
+
+    float t0 = (-b - sq) / a;
+    float t1 = (-b + sq) / a;
+
+    return t1 + tError > .0f && t0 - tError < r.max();
+}
+
 struct _Sphere : Sphere {
-    _Sphere(const Transform &t, float r) :
-        m_worldToObj(t),
-        m_box(Inverse(t)(bounds3f{ -v3f{ r, r, r }, v3f{ r, r, r } })),
-        m_radius(r)
-    {}
+    _Sphere(const Transform &t, float r);
 
     bool intersect(const Ray &r, Interaction &isect) const override;
     bool qIntersect(const Ray &r) const override;
 
-    float area() const override { return (float)(4. * Pi * m_radius * m_radius); }
+    float area() const override;
     bounds3f bounds() const override { return m_box; }
     Transform worldToObj() const override { return m_worldToObj; }
 
@@ -51,16 +76,60 @@ struct _Sphere : Sphere {
 
     Interaction sample(const Interaction &ref, const v2f &u) const override;
     float pdf(const Interaction &ref, const v3f &wi) const override;
+    float pdf(const Interaction &ref, const Interaction &isect) const override;
 
     float radius() const override { return m_radius; }
 
+    bool seesCone(const Interaction &ref) const;
+
     Transform m_worldToObj;
     bounds3f m_box;
+    v3f m_center;
     float m_radius;
+    float m_worldRadius; /* 0 if the transform doesn't preserve the sphere's shape */
 };
 
+_Sphere::_Sphere(const Transform &t, float r) :
+    m_worldToObj(t),
+    m_box(Inverse(t)(bounds3f{ -v3f{ r, r, r }, v3f{ r, r, r } })),
+    m_center(Mulp(Inverse(t), v3f{ 0.f, 0.f, 0.f })),
+    m_radius(r),
+    m_worldRadius(.0f)
+{
+    /* The fast world space test needs a similarity transform */
+    v3f x = Mulv(Inverse(t), v3f{ 1.f, 0.f, 0.f });
+    v3f y = Mulv(Inverse(t), v3f{ 0.f, 1.f, 0.f });
+    v3f z = Mulv(Inverse(t), v3f{ 0.f, 0.f, 1.f });
+
+    float s = x.length();
+    float eps = 1e-4f * s * s;
+    if (std::abs(y.length_sq() - s * s) < eps && std::abs(z.length_sq() - s * s) < eps
+        && std::abs(Dot(x, y)) < eps && std::abs(Dot(y, z)) < eps
+        && std::abs(Dot(z, x)) < eps) {
+        m_worldRadius = s * r;
+    }
+}
+
+float _Sphere::area() const
+{
+    float r = m_worldRadius > .0f ? m_worldRadius : m_radius;
+    return (float)(4. * Pi * r * r);
+}
+
+/* The cone subtended by the sphere is only known with its world radius, and from
+ * outside of it */
+bool _Sphere::seesCone(const Interaction &ref) const
+{
+    return m_worldRadius > .0f
+           && DistanceSquared(ref.p, m_center) > m_worldRadius * m_worldRadius;
+}
+
 bool _Sphere::intersect(const Ray &ray, Interaction &isect) const
 {
+    if (m_worldRadius > .0f && !SphereMayHit(ray, m_center, m_worldRadius)) {
+        return false;
+    }
+
     v3f oError, dError;
     Ray r = m_worldToObj(ray, oError, dError);
 
@@ -111,6 +180,10 @@ bool _Sphere::intersect(const Ray &ray, Interaction &isect) const
 
 bool _Sphere::qIntersect(const Ray &ray) const
 {
+    if (m_worldRadius > .0f && !SphereMayHit(ray, m_center, m_worldRadius)) {
+        return false;
+    }
+
     v3f oError, dError;
     Ray r = m_worldToObj(ray, oError, dError);
 
@@ -136,19 +209,84 @@ Interaction _Sphere::sample(const v2f &u) const
     return it;
 }
 
-Interaction _Sphere::sample(const Interaction &, const v2f &u) const
+Interaction _Sphere::sample(const Interaction &ref, const v2f &u) const
 {
-    return sample(u);
+    /* Sample uniformly on the surface if ref is inside the sphere, or if the transform
+     * doesn't keep it a sphere */
+    if (!seesCone(ref)) {
+        return sample(u);
+    }
+
+    /* Sample the cone subtended by the sphere, as seen from ref */
+    float r = m_worldRadius;
+    float dc2 = DistanceSquared(ref.p, m_center);
+    float dc = std::sqrt(dc2);
+    v3f wc = (m_center - ref.p) / dc;
+    v3f wcX, wcY;
+    CoordinateSystem(wc, wcX, wcY);
+    wcX = Normalize(wcX);
+    wcY = Cross(wc, wcX);
+
+    float sinThetaMax2 = r * r / dc2;
+    float cosThetaMax = std::sqrt(std::max(.0f, 1.f - sinThetaMax2));
+    v3f w = UniformSampleCone(u, cosThetaMax);
+
+    /* Compute the angle alpha from the center of the sphere to the sampled point */
+    float cosTheta = w.z;
+    float sinTheta2 = std::max(.0f, 1.f - cosTheta * cosTheta);
+    float ds = dc * cosTheta - std::sqrt(std::max(.0f, r * r - dc2 * sinTheta2));
+    float cosAlpha = (dc2 + r * r - ds * ds) / (2.f * dc * r);
+    float sinAlpha = std::sqrt(std::max(.0f, 1.f - cosAlpha * cosAlpha));
+
+    /* The azimuth of the sampled direction is kept for the normal */
+    float sinTheta = std::sqrt(sinTheta2);
+    float cosPhi = sinTheta > .0f ? w.x / sinTheta : 1.f;
+    float sinPhi = sinTheta > .0f ? w.y / sinTheta : .0f;
+
+    v3f n = -(sinAlpha * cosPhi * wcX + sinAlpha * sinPhi * wcY + cosAlpha * wc);
+
+    Interaction it;
+    it.p = m_center + r * n;
+    it.n = n;
+    it.error = gamma(5) * Abs(it.p);
+
+    return it;
 }
 
 float _Sphere::pdf(const Interaction &ref, const v3f &wi) const
 {
-    Ray r = SpawnRay(ref, wi);
-    Interaction isect;
-    if (!intersect(r, isect)) {
+    if (!seesCone(ref)) {
+        /* Sampled over the area, convert the density to solid angle */
+        Interaction isect;
+        if (!intersect(SpawnRay(ref, wi), isect)) {
+            return .0f;
+        }
+        return pdf(ref, isect);
+    }
+    float dc2 = DistanceSquared(ref.p, m_center);
+    float sinThetaMax2 = m_worldRadius * m_worldRadius / dc2;
+    float cosThetaMax = std::sqrt(std::max(.0f, 1.f - sinThetaMax2));
+
+    /* Directions outside the cone can't reach the sphere, leave some slack for
+     * samples generated right on the silhouette */
+    float cosTheta = Dot(Normalize(wi), (m_center - ref.p) / std::sqrt(dc2));
+    if (cosTheta + gamma(3) < cosThetaMax) {
         return .0f;
     }
-    return DistanceSquared(ref.p, isect.p) / (AbsDot(isect.n, -wi) * area());
+    return UniformConePdf(cosThetaMax);
+}
+
+float _Sphere::pdf(const Interaction &ref, const Interaction &isect) const
+{
+    if (!seesCone(ref)) {
+        v3f wi = Normalize(isect.p - ref.p);
+        return DistanceSquared(ref.p, isect.p) / (AbsDot(isect.n, -wi) * area());
+    }
+    float dc2 = DistanceSquared(ref.p, m_center);
+    float sinThetaMax2 = m_worldRadius * m_worldRadius / dc2;
+    float cosThetaMax = std::sqrt(std::max(.0f, 1.f - sinThetaMax2));
+
+    return UniformConePdf(cosThetaMax);
 }
 
 #pragma mark - Static constructors
@@ -1,6 +1,9 @@
+#include "tools/loader_obj.hpp"
+
 #include "shapes/mesh.hpp"
 
 #include "rt1w/material.hpp"
+#include "rt1w/parallel.hpp"
 #include "rt1w/primitive.hpp"
 #include "rt1w/spectrum.hpp"
 #include "rt1w/texture.hpp"
@@ -15,6 +18,9 @@
 #include <functional>
 #include <unordered_map>
 
+/* Vertices copied by each job */
+constexpr size_t RemapGrain = 16384;
+
 /* Hash & Equal fucntion for index_t so they can be put in an unordered_map */
 namespace std {
 /* See https://stackoverflow.com/questions/4948780/magic-number-in-boosthash-combine */
@@ -42,7 +48,11 @@ struct equal_to<tinyobj::index_t> {
 };
 }
 
-sptr<Primitive> Primitive::load_obj(const std::string &path, const Transform &xform)
+bool LoadObj(const std::string &path,
+             std::vector<v3f> &vertices,
+             std::vector<v3f> &normals,
+             std::vector<v2f> &texcoords,
+             std::vector<std::vector<uint32_t>> &indices)
 {
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> obj_shapes;
@@ -58,58 +68,104 @@ sptr<Primitive> Primitive::load_obj(const std::string &path, const Transform &xf
                                true);
     ERROR_IF(!err.empty(), "load_obj: %s", err.c_str());
     if (!ok) {
-        return nullptr;
+        return false;
     }
 
-    /* Vector for storing vertex data */
-    std::vector<v3f> vertices;
-    std::vector<v3f> normals;
-    std::vector<v2f> texcoords;
-
     /* Map that contains the translation from index_t to an index in our
-     * vertex data */
+     * vertex data, and the index_t of each of these vertices */
     std::unordered_map<tinyobj::index_t, uint32_t> remap;
-
-    /* For each mesh, store a vector that contains the mesh indices */
-    std::vector<uptr<std::vector<uint32_t>>> mesh_indices;
+    std::vector<tinyobj::index_t> unique;
 
     for (const auto &s : obj_shapes) {
-        std::vector<uint32_t> indices;
+        std::vector<uint32_t> mesh_indices;
+        mesh_indices.reserve(s.mesh.indices.size());
 
         for (const auto &idx : s.mesh.indices) {
-            uint32_t i;
-            auto it = remap.find(idx);
+            /* 'index' represent a vertex we haven't seen yet if it's inserted,
+             * the vertex data is copied afterwards */
+            auto it = remap.insert({ idx, (uint32_t)unique.size() });
+            if (it.second) {
+                unique.push_back(idx);
+            }
+            mesh_indices.push_back(it.first->second);
+        }
+        indices.emplace_back(std::move(mesh_indices));
+    }
 
-            if (it != remap.end()) {
-                i = it->second;
+    /* Normals & texture coordinates are only kept if every vertex has one */
+    auto all = [](bool a, bool b) { return a && b; };
+    bool hasNormals = parallel_reduce(unique.size(),
+                                      RemapGrain,
+                                      true,
+                                      [&](size_t bgn, size_t end) {
+                                          for (size_t i = bgn; i < end; ++i) {
+                                              if (unique[i].normal_index < 0) {
+                                                  return false;
+                                              }
+                                          }
+                                          return true;
+                                      },
+                                      all);
+    bool hasTexcoords = parallel_reduce(unique.size(),
+                                        RemapGrain,
+                                        true,
+                                        [&](size_t bgn, size_t end) {
+                                            for (size_t i = bgn; i < end; ++i) {
+                                                if (unique[i].texcoord_index < 0) {
+                                                    return false;
+                                                }
+                                            }
+                                            return true;
+                                        },
+                                        all);
+
+    /* Add the vertices to the vertex data */
+    vertices.resize(unique.size());
+    normals.resize(hasNormals ? unique.size() : 0);
+    texcoords.resize(hasTexcoords ? unique.size() : 0);
+    parallel_for(unique.size(), RemapGrain, [&](size_t bgn, size_t end) {
+        for (size_t i = bgn; i < end; ++i) {
+            const tinyobj::index_t &idx = unique[i];
+            const auto *vp = &attrib.vertices[3 * (size_t)idx.vertex_index];
+            vertices[i] = { vp[0], vp[1], vp[2] };
+            if (hasNormals) {
+                const auto *np = &attrib.normals[3 * (size_t)idx.normal_index];
+                normals[i] = { np[0], np[1], np[2] };
             }
-            else {
-                /* 'index' represent a vertex we haven't seen yet, had it to
-                 * the vertex data and create a remaped index for it */
-                const auto *vp =
-                    (const float *)(&attrib.vertices[3 * (size_t)idx.vertex_index]);
-                const auto *np =
-                    (const float *)(&attrib.vertices[3 * (size_t)idx.normal_index]);
-                const auto *tp =
-                    (const float *)(&attrib.vertices[3 * (size_t)idx.texcoord_index]);
-
-                vertices.push_back({ vp[0], vp[1], vp[2] });
-                normals.push_back({ np[0], np[1], np[2] });
-                texcoords.push_back({ tp[0], tp[1] });
-
-                i = (uint32_t)remap.size();
-                remap.insert({ idx, i });
+            if (hasTexcoords) {
+                const auto *tp = &attrib.texcoords[2 * (size_t)idx.texcoord_index];
+                texcoords[i] = { tp[0], tp[1] };
             }
-            indices.push_back(i);
         }
-        mesh_indices.emplace_back(std::make_unique<std::vector<uint32_t>>(indices));
+    });
+    return true;
+}
+
+sptr<Primitive> Primitive::load_obj(const std::string &path, const Transform &xform)
+{
+    /* Vector for storing vertex data */
+    std::vector<v3f> vertices;
+    std::vector<v3f> normals;
+    std::vector<v2f> texcoords;
+
+    /* For each mesh, a vector that contains the mesh indices */
+    std::vector<std::vector<uint32_t>> mesh_indices;
+
+    if (!LoadObj(path, vertices, normals, texcoords, mesh_indices)) {
+        return nullptr;
     }
 
     /* Now that we went through all the indices, create the VertexData struct */
     size_t nv = vertices.size();
-    auto v = std::make_unique<std::vector<v3f>>(vertices);
-    auto n = std::make_unique<std::vector<v3f>>(normals);
-    auto uv = std::make_unique<std::vector<v2f>>(texcoords);
+    auto v = std::make_unique<std::vector<v3f>>(std::move(vertices));
+    uptr<std::vector<v3f>> n;
+    if (!normals.empty()) {
+        n = std::make_unique<std::vector<v3f>>(std::move(normals));
+    }
+    uptr<std::vector<v2f>> uv;
+    if (!texcoords.empty()) {
+        uv = std::make_unique<std::vector<v2f>>(std::move(texcoords));
+    }
 
     sptr<VertexData> vd = CreateVertexData(nv, v, n, uv);
 
@@ -119,8 +175,9 @@ sptr<Primitive> Primitive::load_obj(const std::string &path, const Transform &xf
     std::vector<sptr<Mesh>> meshes;
 
     sptr<Texture> tex = Texture::create_color(Spectrum::fromRGB({ .5f, .5f, .5f }));
-    for (auto &indices_value : mesh_indices) {
-        size_t nt = indices_value->size() / 3;
+    for (auto &indices : mesh_indices) {
+        size_t nt = indices.size() / 3;
+        auto indices_value = std::make_unique<std::vector<uint32_t>>(std::move(indices));
         auto faces = Mesh::create(nt, vd, indices_value, xform)->faces();
 
         for (const auto &f : faces) {
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "rt1w/geometry.hpp"
+
+#include <string>
+#include <vector>
+
+/* Loads all the shapes of an OBJ file into shared vertex arrays, with one vector of
+ * indices per shape. Normals and texcoords are left empty unless all vertices have
+ * one. */
+bool LoadObj(const std::string &path,
+             std::vector<v3f> &vertices,
+             std::vector<v3f> &normals,
+             std::vector<v2f> &texcoords,
+             std::vector<std::vector<uint32_t>> &indices);
@@ -0,0 +1,48 @@
+#include "render.hpp"
+
+#include "rt1w/aov.hpp"
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+
+#include <set>
+
+TEST_CASE("AOVs", "[aov]")
+{
+    std::string file = WriteScene();
+
+    sptr<Render> plain = CreateRender(file, 2, 0);
+    REQUIRE(plain);
+    plain->schedulePass()->wait();
+    CHECK_FALSE(plain->normals());
+    CHECK_FALSE(plain->albedo());
+    CHECK_FALSE(plain->depth());
+    CHECK_FALSE(plain->primitiveIDs());
+    CHECK_FALSE(plain->materialIDs());
+
+    uint32_t aovs = AOV_NORMALS | AOV_ALBEDO | AOV_DEPTH | AOV_PRIMITIVE_ID
+                    | AOV_MATERIAL_ID;
+    sptr<Render> full = CreateRender(file, 2, aovs);
+    full->schedulePass()->wait();
+
+    /* The passes don't change the samples of the image */
+    CHECK(Equal(plain->image()->buffer(), full->image()->buffer()));
+
+    /* The ball is at the center, the ground at the bottom and nothing at the top */
+    buffer_t depth = full->depth()->buffer();
+    buffer_t prims = full->primitiveIDs()->buffer();
+    buffer_t mats = full->materialIDs()->buffer();
+    REQUIRE(depth.format.order == ORDER_R);
+
+    auto at = [](const buffer_t &b, uint32_t x, uint32_t y) {
+        return *(const float *)((const uint8_t *)b.data + y * b.bpr + x * b.format.size);
+    };
+    CHECK(at(prims, 20, 15) == 1.f);
+    CHECK(at(mats, 20, 15) == 1.f);
+    CHECK(at(depth, 20, 15) == Approx(5.f).epsilon(.05));
+    CHECK(at(prims, 20, 29) == 2.f);
+    CHECK(at(mats, 20, 29) == 2.f);
+    CHECK(at(prims, 0, 0) == .0f);
+    CHECK(at(depth, 0, 0) == .0f);
+
+    unlink(file.c_str());
+}
@@ -0,0 +1,96 @@
+#include "catch.hpp"
+
+#include "rt1w/arena.hpp"
+#include "rt1w/bxdf.hpp"
+#include "rt1w/fresnel.hpp"
+#include "rt1w/interaction.hpp"
+#include "rt1w/spectrum.hpp"
+
+#include <cstdint>
+#include <thread>
+
+struct Pair {
+    Pair(int a, int b) : a(a), b(b) {}
+
+    int a;
+    int b;
+};
+
+TEST_CASE("Arena", "[arena]")
+{
+    uptr<Arena> arena = Arena::create();
+    CHECK(arena->stats().blocks == 0);
+
+    /* Aligned as requested, and built in place */
+    for (size_t align : { 1, 8, 16, 64, 256 }) {
+        arena->alloc(3, 1);
+        CHECK((uintptr_t)arena->alloc(24, align) % align == 0);
+    }
+    Pair *p = arena->make<Pair>(1, 2);
+    CHECK(p->a == 1);
+    CHECK(p->b == 2);
+    double *zeros = arena->array<double>(0);
+    CHECK(zeros);
+
+    /* Rewound to a mark, or to the start, the blocks are reused */
+    Arena::Mark mark = arena->mark();
+    size_t used = arena->stats().used;
+    void *after = arena->alloc(100);
+    arena->alloc(1 << 20);
+    ArenaStats stats = arena->stats();
+    CHECK(stats.blocks == 2);
+    CHECK(stats.used >= used + (1 << 20));
+    CHECK(stats.allocated >= stats.used);
+
+    arena->rewind(mark);
+    CHECK(arena->stats().used == used);
+    CHECK(arena->alloc(100) == after);
+
+    arena->reset();
+    CHECK(arena->stats().used == 0);
+    CHECK(arena->stats().peak == stats.peak);
+    void *first = arena->alloc(1 << 20);
+    CHECK(arena->stats().blocks == 2);
+    arena->alloc(1 << 20);
+    CHECK(arena->stats().blocks == 3);
+    arena->reset();
+    CHECK(arena->alloc(1 << 20) == first);
+
+    /* One per thread */
+    Arena *other = nullptr;
+    std::thread([&]() { other = &Arena::local(); }).join();
+    CHECK(&Arena::local() == &Arena::local());
+    CHECK(other != &Arena::local());
+}
+
+TEST_CASE("BSDF in an arena", "[arena]")
+{
+    uptr<Arena> arena = Arena::create();
+    Interaction isect;
+    isect.n = isect.shading.n = { 0, 0, 1 };
+    isect.dpdu = isect.shading.dpdu = { 1, 0, 0 };
+
+    /* A diffuse and a specular layer, nothing else allocated */
+    BSDF *bsdf = BSDF::create(*arena, isect);
+    bsdf->add(LambertianReflection::create(*arena, Spectrum(.5f)));
+    bsdf->add(SpecularReflection::create(*arena,
+                                         Spectrum(1.f),
+                                         FresnelConductor::create(*arena,
+                                                                  Spectrum(1.f),
+                                                                  Spectrum(1.f),
+                                                                  Spectrum(1.f))));
+    CHECK(arena->stats().blocks == 1);
+
+    v3f wo = Normalize(v3f{ 1, 0, 1 });
+    v3f wi = Normalize(v3f{ -1, 1, 1 });
+    auto diffuse = BxDFType(BSDF_DIFFUSE | BSDF_REFLECTION);
+    CHECK(bsdf->f(wo, wi, diffuse)[0] == Approx(.5f * InvPi));
+    CHECK(bsdf->pdf(wo, wi, diffuse) == Approx(AbsCosTheta(wi) * InvPi));
+
+    /* Gone with the vertex */
+    Arena::Mark mark = arena->mark();
+    size_t used = arena->stats().used;
+    BSDF::create(*arena, isect)->add(LambertianReflection::create(*arena, 1.f));
+    arena->rewind(mark);
+    CHECK(arena->stats().used == used);
+}
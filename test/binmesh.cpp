@@ -0,0 +1,91 @@
+#include "catch.hpp"
+
+#include "shapes/binmesh.hpp"
+#include "shapes/mesh.hpp"
+
+#include "rt1w/interaction.hpp"
+#include "rt1w/params.hpp"
+#include "rt1w/ray.hpp"
+#include "rt1w/rng.hpp"
+#include "rt1w/transform.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <unistd.h>
+
+static bool Equal(const v3f &a, const v3f &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static sptr<Shape> LoadBinMesh(const std::string &path)
+{
+    auto p = Params::create();
+    p->insert("type", std::string("binmesh"));
+    p->insert("file", path);
+
+    return Shape::create(p);
+}
+
+TEST_CASE("Binary mesh", "[mesh]")
+{
+    uptr<RNG> rng = RNG::create();
+
+    /* Random triangle soup, with normals but without uvs */
+    const size_t nv = 64;
+    const size_t nt = 100;
+
+    auto v = std::make_unique<std::vector<v3f>>();
+    auto n = std::make_unique<std::vector<v3f>>();
+    auto uv = uptr<std::vector<v2f>>();
+    auto i = std::make_unique<std::vector<uint32_t>>();
+    for (size_t j = 0; j < nv; ++j) {
+        v->push_back({ rng->f32(), rng->f32(), rng->f32() });
+        n->push_back(Normalize(v3f{ rng->f32(), rng->f32(), rng->f32() + 1.f }));
+    }
+    for (size_t j = 0; j < 3 * nt; ++j) {
+        i->push_back((uint32_t)j % nv);
+    }
+
+    char path[] = "/tmp/rt1w-binmesh-XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+
+    REQUIRE(WriteBinMesh(path, nv, v->data(), n->data(), nullptr, nt, i->data()));
+
+    auto binmesh = std::dynamic_pointer_cast<Mesh>(LoadBinMesh(path));
+    auto mesh = Mesh::create(nt, v, n, uv, i, Transform());
+    REQUIRE(binmesh);
+
+    auto bfaces = binmesh->faces();
+    auto faces = mesh->faces();
+    REQUIRE(bfaces.size() == faces.size());
+
+    /* Both meshes have the same triangles */
+    size_t errors = 0;
+    for (size_t j = 0; j < faces.size(); ++j) {
+        bounds3f bb = bfaces[j]->bounds();
+        bounds3f b = faces[j]->bounds();
+        if (!Equal(bb.lo, b.lo) || !Equal(bb.hi, b.hi)) {
+            ++errors;
+        }
+
+        Ray r = { v3f{ .5f, .5f, -1.f }, v3f{ .0f, .0f, 1.f } };
+        Interaction bisect, isect;
+        bool bhit = bfaces[j]->intersect(r, bisect);
+        bool hit = faces[j]->intersect(r, isect);
+        if (bhit != hit || (hit && (bisect.t != isect.t || !Equal(bisect.n, isect.n)))) {
+            ++errors;
+        }
+    }
+    CHECK(errors == 0);
+
+    /* Truncated files are rejected */
+    REQUIRE(truncate(path, sizeof(BinMeshHeader) + 16) == 0);
+    CHECK(!LoadBinMesh(path));
+
+    close(fd);
+    unlink(path);
+}
@@ -0,0 +1,90 @@
+#include "render.hpp"
+
+#include "rt1w/aov.hpp"
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+#include "rt1w/workq.hpp"
+
+static sptr<Render> CreateAdaptiveRender(const std::string &file, uint32_t tileSize)
+{
+    sptr<Render> render = CreateRender(file, 2, AOV_NORMALS | AOV_DEPTH);
+    render->setTiles(tileSize, TileOrder::Hilbert);
+    render->setAdaptiveThreshold(.2f);
+    return render;
+}
+
+TEST_CASE("Render checkpoints", "[checkpoint]")
+{
+    std::string file = WriteScene();
+    std::string ckpt = std::string(file).append(".ckpt");
+    const uint32_t passes = 4;
+
+    sptr<Render> uninterrupted = CreateAdaptiveRender(file, 8);
+    REQUIRE(uninterrupted);
+    for (uint32_t i = 0; i < passes; ++i) {
+        uninterrupted->schedulePass()->wait();
+    }
+
+    /* Saved while the third pass renders */
+    sptr<Render> stopped = CreateAdaptiveRender(file, 8);
+    stopped->schedulePass()->wait();
+    stopped->schedulePass()->wait();
+    sptr<Event> e = stopped->schedulePass();
+    REQUIRE(stopped->checkpoint(ckpt));
+    e->wait();
+
+    sptr<Render> resumed = CreateAdaptiveRender(file, 8);
+    REQUIRE(resumed->resume(ckpt));
+    CHECK(resumed->passes() >= 2);
+    while (resumed->passes() < passes) {
+        resumed->schedulePass()->wait();
+    }
+
+    CHECK(resumed->samples() == uninterrupted->samples());
+    CHECK(resumed->activePixels() == uninterrupted->activePixels());
+    CHECK(Equal(resumed->image()->buffer(), uninterrupted->image()->buffer()));
+    CHECK(Equal(resumed->normals()->buffer(), uninterrupted->normals()->buffer()));
+    CHECK(Equal(resumed->depth()->buffer(), uninterrupted->depth()->buffer()));
+
+    /* The tiles must be the same */
+    sptr<Render> other = CreateAdaptiveRender(file, 16);
+    CHECK_FALSE(other->resume(ckpt));
+
+    unlink(ckpt.c_str());
+    unlink(file.c_str());
+}
+
+TEST_CASE("Cancelled passes", "[checkpoint]")
+{
+    std::string file = WriteScene();
+    std::string ckpt = std::string(file).append(".ckpt");
+
+    for (const char *integrator : { "path", "wavefront" }) {
+        sptr<Render> render = CreateRender(file, 2, AOV_NORMALS, integrator);
+        REQUIRE(render);
+
+        /* Signaled without any sample, nor any tile saved as done */
+        workq_context preview;
+        preview.priority = WORKQ_PRIORITY_INTERACTIVE;
+        preview.token = std::make_shared<CancelToken>();
+        preview.token->cancel();
+        workq_context previous = workq_set_context(preview);
+        sptr<Event> e = render->schedulePass();
+        workq_set_context(previous);
+        e->wait();
+        CHECK(render->samples() == 0);
+        REQUIRE(render->checkpoint(ckpt));
+
+        /* The following pass renders the whole image */
+        render->schedulePass()->wait();
+        CHECK(render->samples() == 40 * 30 * 4);
+
+        sptr<Render> resumed = CreateRender(file, 2, AOV_NORMALS, integrator);
+        REQUIRE(resumed->resume(ckpt));
+        resumed->schedulePass()->wait();
+        CHECK(resumed->samples() == 40 * 30 * 4);
+    }
+
+    unlink(ckpt.c_str());
+    unlink(file.c_str());
+}
@@ -0,0 +1,49 @@
+#include "render.hpp"
+
+#include "rt1w/aov.hpp"
+#include "rt1w/distributed.hpp"
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+
+#include <thread>
+#include <vector>
+
+TEST_CASE("Distributed rendering", "[distributed]")
+{
+    std::string file = WriteScene();
+    std::string address = std::string("unix:").append(file).append(".sock");
+    const uint32_t quality = 2;
+    const uint32_t aovs = AOV_NORMALS | AOV_ALBEDO | AOV_DEPTH | AOV_PRIMITIVE_ID;
+
+    /* Same pass rendered locally */
+    sptr<Render> local = CreateRender(file, quality, aovs);
+    REQUIRE(local);
+    local->schedulePass()->wait();
+
+    /* And by two workers */
+    sptr<Render> assembled = CreateRender(file, quality, aovs);
+    sptr<Coordinator> coordinator = Coordinator::create(address);
+    REQUIRE(coordinator);
+
+    auto create = [](const RenderSetup &setup) {
+        return CreateRender(setup.file, setup.quality, setup.aovs);
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < 2; ++i) {
+        workers.emplace_back([&]() { CHECK(RenderWorker(address, create)); });
+    }
+    CHECK(coordinator->render(assembled, { file, quality, aovs }, 1));
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    CHECK(assembled->samples() == local->samples());
+    CHECK(Equal(assembled->image()->buffer(), local->image()->buffer()));
+    CHECK(Equal(assembled->normals()->buffer(), local->normals()->buffer()));
+    CHECK(Equal(assembled->albedo()->buffer(), local->albedo()->buffer()));
+    CHECK(Equal(assembled->depth()->buffer(), local->depth()->buffer()));
+    CHECK(Equal(assembled->primitiveIDs()->buffer(), local->primitiveIDs()->buffer()));
+
+    unlink(file.c_str());
+}
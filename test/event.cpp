@@ -0,0 +1,131 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+#include "catch.hpp"
+
+#include "rt1w/event.hpp"
+#include "rt1w/workq.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct Calls : Object {
+    std::atomic<uint32_t> count{ 0 };
+};
+
+static void Call(const sptr<Object> &obj, const sptr<Object> &)
+{
+    std::static_pointer_cast<Calls>(obj)->count.fetch_add(1);
+}
+
+/* Events signaled back and forth by two threads, returns the number of rounds */
+static uint32_t PingPong(uint32_t rounds)
+{
+    std::vector<sptr<Event>> ping, pong;
+    for (uint32_t i = 0; i < rounds; ++i) {
+        ping.push_back(Event::create(1));
+        pong.push_back(Event::create(1));
+    }
+
+    std::thread other([&]() {
+        for (uint32_t i = 0; i < rounds; ++i) {
+            ping[i]->wait();
+            pong[i]->signal();
+        }
+    });
+    for (uint32_t i = 0; i < rounds; ++i) {
+        ping[i]->signal();
+        pong[i]->wait();
+    }
+    other.join();
+    return rounds;
+}
+
+/* Continuations added to an event that is signaled afterwards */
+static uint32_t Continuations(workq *queue, uint32_t count)
+{
+    auto calls = std::make_shared<Calls>();
+    auto e = Event::create(1);
+    std::vector<sptr<Event>> done;
+    for (uint32_t i = 0; i < count; ++i) {
+        done.push_back(e->notify(queue, Call, calls, {}));
+    }
+    e->signal();
+    Event::create(done)->wait();
+    return calls->count;
+}
+
+TEST_CASE("Events", "[event]")
+{
+    CHECK(Event::create(0)->test());
+
+    auto e = Event::create(2);
+    CHECK_FALSE(e->test());
+    e->signal();
+    CHECK_FALSE(e->test());
+    e->signal();
+    CHECK(e->test());
+    e->wait();
+
+    /* Waiters parked on another thread */
+    auto later = Event::create(1);
+    std::atomic<uint32_t> woken{ 0 };
+    std::vector<std::thread> waiters;
+    for (size_t i = 0; i < 4; ++i) {
+        waiters.emplace_back([&]() {
+            later->wait();
+            woken++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(woken == 0);
+    later->signal();
+    for (auto &t : waiters) {
+        t.join();
+    }
+    CHECK(woken == 4);
+
+    /* Continuations run by the signal, or right away once signaled */
+    auto calls = std::make_shared<Calls>();
+    auto pending = Event::create(1);
+    CHECK_FALSE(pending->notify(nullptr, Call, calls, {})->test());
+    CHECK(calls->count == 0);
+    pending->signal();
+    CHECK(calls->count == 1);
+    CHECK(pending->notify(nullptr, Call, calls, {})->test());
+    CHECK(calls->count == 2);
+    pending->notify(workq_get_queue(), Call, calls, {})->wait();
+    CHECK(calls->count == 3);
+
+    CHECK(Continuations(nullptr, 100) == 100);
+    CHECK(Continuations(workq_get_queue(), 100) == 100);
+    CHECK(Event::create(std::vector<sptr<Event>>())->test());
+
+    CHECK(PingPong(1000) == 1000);
+}
+
+TEST_CASE("Event latency", "[.benchmark]")
+{
+    BENCHMARK("1000 signal to wakeup round trips")
+    {
+        return PingPong(1000);
+    };
+    BENCHMARK("1000 continuations run by the signal")
+    {
+        return Continuations(nullptr, 1000);
+    };
+    BENCHMARK("1000 continuations of a signaled event")
+    {
+        auto calls = std::make_shared<Calls>();
+        auto e = Event::create(0);
+        for (uint32_t i = 0; i < 1000; ++i) {
+            e->notify(nullptr, Call, calls, {});
+        }
+        return calls->count.load();
+    };
+    BENCHMARK("1000 continuations dispatched to the queue")
+    {
+        return Continuations(workq_get_queue(), 1000);
+    };
+}
@@ -0,0 +1,85 @@
+#include "catch.hpp"
+
+#include "shapes/sphere.hpp"
+
+#include "rt1w/arena.hpp"
+#include "rt1w/bxdf.hpp"
+#include "rt1w/interaction.hpp"
+#include "rt1w/material.hpp"
+#include "rt1w/primitive.hpp"
+#include "rt1w/ray.hpp"
+#include "rt1w/spectrum.hpp"
+#include "rt1w/texture.hpp"
+#include "rt1w/transform.hpp"
+
+#include <vector>
+
+static sptr<Primitive> Ball(float x, const sptr<Material> &material)
+{
+    return Primitive::create(Sphere::create(Transform::Translate({ -x, 0, 0 }), .5f),
+                             material);
+}
+
+static Interaction Hit(const sptr<Primitive> &world, float x)
+{
+    Interaction isect;
+    world->intersect(Ray({ x, .3f, 5 }, { 0, 0, -1 }), isect);
+    return isect;
+}
+
+TEST_CASE("Material table", "[material]")
+{
+    sptr<Texture> checker = Texture::create_checker(Texture::create_color(Spectrum(.2f)),
+                                                    Texture::create_color(Spectrum(.8f)));
+    sptr<Material> matte = Lambertian::create(checker);
+    sptr<Material> metal = Metal::create(checker, .1f);
+    sptr<Material> glass = Dielectric::create(1.5f);
+    std::vector<sptr<Primitive>> balls = {
+        Ball(-3, matte), Ball(-1, metal), Ball(1, matte), Ball(3, glass)
+    };
+    sptr<Primitive> world = Aggregate::create(balls);
+
+    /* Each material and texture once, the primitives refer to them by index */
+    sptr<MaterialTable> table = MaterialTable::create(world);
+    REQUIRE(table->materials().size() == 3);
+    CHECK(table->textures().size() == 3);
+    CHECK(table->materials()[0].op == MATERIAL_MATTE);
+    CHECK(table->materials()[1].op == MATERIAL_METAL);
+    CHECK(table->materials()[1].texture == table->materials()[0].texture);
+    CHECK(table->materials()[2].op == MATERIAL_DIELECTRIC);
+    CHECK(table->materials()[2].param == Approx(1.5f));
+
+    Interaction a = Hit(world, -3);
+    Interaction b = Hit(world, 1);
+    REQUIRE(a.t > 0);
+    REQUIRE(b.t > 0);
+    CHECK(a.matIndex == 0);
+    CHECK(b.matIndex == 0);
+    CHECK(Hit(world, -1).matIndex == 1);
+    CHECK(Hit(world, 3).matIndex == 2);
+
+    /* Same values as the textures, alone or in a batch */
+    uptr<Arena> arena = Arena::create();
+    const Interaction *isects[] = { &a, &b };
+    BSDF *bsdfs[2];
+    table->computeBsdfs(0, isects, 2, *arena, bsdfs);
+    for (size_t i = 0; i < 2; ++i) {
+        const Interaction &isect = *isects[i];
+        Spectrum Kd = checker->value(isect.uv.x, isect.uv.y, isect.p);
+        v3f wi = isect.n;
+        REQUIRE(bsdfs[i]);
+        CHECK(bsdfs[i]->f(isect.wo, wi)[0] == Approx(Kd[0] * InvPi));
+        BSDF *bsdf = table->computeBsdf(isect, *arena);
+        CHECK(bsdf->f(isect.wo, wi)[0] == Approx(Kd[0] * InvPi));
+    }
+
+    /* No BSDF without a material */
+    Interaction none;
+    CHECK_FALSE(table->computeBsdf(none, *arena));
+
+    /* Compiled again after an edit */
+    balls[2]->setMaterial(glass);
+    table = MaterialTable::create(world);
+    CHECK(table->materials().size() == 3);
+    CHECK(Hit(world, 1).matIndex == 2);
+}
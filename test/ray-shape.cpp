@@ -170,3 +170,182 @@ TEST_CASE("Mesh qIntersect", "[mesh], [qisect]")
     }
     REQUIRE(n == 0);
 }
+
+/* Number of rays passing right inside the silhouette of the sphere of the given world
+ * center and radius that miss it, or right outside that hit it */
+static size_t SilhouetteErrors(RNG &rng,
+                               const sptr<Shape> &sphere,
+                               const v3f &center,
+                               float radius)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+        v3f w = UniformSampleSphere({ rng.f32(), rng.f32() });
+        float d = Lerp(rng.f32(), 2.f, 10.f) * radius;
+        v3f org = center + d * w;
+
+        v3f u, v;
+        CoordinateSystem(w, u, v);
+        u = Normalize(u);
+
+        float sinIn = .999f * radius / d;
+        float sinOut = 1.001f * radius / d;
+        Ray in = { org, std::sqrt(1.f - sinIn * sinIn) * -w + sinIn * u };
+        Ray out = { org, std::sqrt(1.f - sinOut * sinOut) * -w + sinOut * u };
+
+        Interaction isect;
+        if (!sphere->intersect(in, isect) || !sphere->qIntersect(in)
+            || sphere->intersect(out, isect) || sphere->qIntersect(out)) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+TEST_CASE("Sphere silhouette", "[sphere], [isect]")
+{
+    uptr<RNG> rng = RNG::create();
+
+    v3f center = RandomPoint(*rng, .0f, 2.f);
+    float radius = std::abs(pExp(*rng, -1.f, 1.f));
+    sptr<Shape> sphere = Sphere::create(Transform::Translate(-center), radius);
+    REQUIRE(SilhouetteErrors(*rng, sphere, center, radius) == 0);
+
+    /* Any similarity takes the world space test, including small and large spheres */
+    for (float minExp : { -3.f, -1.f, 2.f }) {
+        center = RandomPoint(*rng, .0f, 2.f) * std::pow(10.f, minExp + 1.f);
+        radius = std::abs(pExp(*rng, minExp, minExp + 1.f));
+        v3f axis = UniformSampleSphere({ rng->f32(), rng->f32() });
+        Transform rotate = Transform::Rotate(360.f * rng->f32(), axis);
+
+        sphere = Sphere::create(rotate * Transform::Translate(-center), radius);
+        CHECK(SilhouetteErrors(*rng, sphere, center, radius) == 0);
+
+        /* The object radius is scaled back by the transform */
+        float scale = std::pow(10.f, Lerp(rng->f32(), -1.f, 1.f));
+        Transform t = Transform::Scale(scale) * rotate * Transform::Translate(-center);
+        sphere = Sphere::create(t, radius * scale);
+        CHECK(SilhouetteErrors(*rng, sphere, center, radius) == 0);
+    }
+}
+
+TEST_CASE("Sphere cone sampling", "[sphere], [sample]")
+{
+    uptr<RNG> rng = RNG::create();
+
+    v3f center = RandomPoint(*rng, .0f, 2.f);
+    float radius = 1.f + rng->f32();
+    sptr<Shape> sphere = Sphere::create(Transform::Translate(-center), radius);
+
+    /* Reference point outside of the sphere */
+    Interaction ref(center + v3f{ 0.f, 0.f, 4.f * radius });
+
+    size_t n = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+        Interaction it = sphere->sample(ref, { rng->f32(), rng->f32() });
+        v3f wi = Normalize(it.p - ref.p);
+
+        /* Sampled points are on the visible side of the sphere */
+        if (Distance(it.p, center) != Approx(radius).epsilon(1e-3)
+            || Dot(it.n, ref.p - it.p) < .0f || !(sphere->pdf(ref, wi) > .0f)) {
+            ++n;
+        }
+    }
+    REQUIRE(n == 0);
+
+    /* Scaled by the transform, the cone is the one of the world radius */
+    float scale = .25f + rng->f32();
+    Transform t = Transform::Scale(scale, scale, scale) * Transform::Translate(-center);
+    sphere = Sphere::create(t, radius);
+    float worldRadius = radius / scale;
+    ref = Interaction(center + v3f{ 0.f, 0.f, 4.f * worldRadius });
+
+    for (size_t i = 0; i < 1000; ++i) {
+        Interaction it = sphere->sample(ref, { rng->f32(), rng->f32() });
+        v3f wi = Normalize(it.p - ref.p);
+
+        /* The sample is what the ray towards it hits first */
+        Interaction isect;
+        if (Distance(it.p, center) != Approx(worldRadius).epsilon(1e-3)
+            || !sphere->intersect(SpawnRay(ref, wi), isect)
+            || Distance(isect.p, it.p) > 1e-2f * worldRadius
+            || sphere->pdf(ref, isect) != Approx(sphere->pdf(ref, wi)).epsilon(1e-3)) {
+            ++n;
+        }
+    }
+    REQUIRE(n == 0);
+}
+
+TEST_CASE("Mesh pdf", "[mesh], [sample]")
+{
+    uptr<RNG> rng = RNG::create();
+
+    auto vertices = std::make_unique<std::vector<v3f>>();
+    vertices->push_back(RandomPoint(*rng, .0f, 3.f));
+    vertices->push_back(RandomPoint(*rng, .0f, 3.f));
+    vertices->push_back(RandomPoint(*rng, .0f, 3.f));
+
+    auto normals = uptr<std::vector<v3f>>();
+    auto texcoords = uptr<std::vector<v2f>>();
+    auto indices = std::make_unique<std::vector<uint32_t>>(std::vector<uint32_t>{ 0, 1, 2 });
+
+    sptr<Shape> triangle =
+        Mesh::create(1, vertices, normals, texcoords, indices, Transform())->faces()[0];
+
+    Interaction ref(RandomPoint(*rng, .0f, 3.f));
+
+    size_t n = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+        Interaction it = triangle->sample({ rng->f32(), rng->f32() });
+        v3f wi = Normalize(it.p - ref.p);
+
+        Interaction isect;
+        if (triangle->intersect(SpawnRay(ref, wi), isect)) {
+            /* Both pdf paths agree */
+            float pdf = triangle->pdf(ref, wi);
+            if (triangle->pdf(ref, isect) != Approx(pdf).epsilon(1e-3)) {
+                ++n;
+            }
+        }
+    }
+    REQUIRE(n == 0);
+}
+
+TEST_CASE("Mesh solid angle sampling", "[mesh], [sample]")
+{
+    uptr<RNG> rng = RNG::create();
+
+    /* A large triangle right above the reference point */
+    auto vertices = std::make_unique<std::vector<v3f>>(
+        std::vector<v3f>{ { -1.f, 1.f, -1.f }, { 1.f, 1.f, -1.f }, { .0f, 1.f, 1.f } });
+    auto normals = uptr<std::vector<v3f>>();
+    auto texcoords = uptr<std::vector<v2f>>();
+    auto indices = std::make_unique<std::vector<uint32_t>>(std::vector<uint32_t>{ 0, 1, 2 });
+
+    sptr<Shape> triangle =
+        Mesh::create(1, vertices, normals, texcoords, indices, Transform())->faces()[0];
+
+    Interaction ref(v3f{ .0f, .0f, .0f });
+    ref.n = { .0f, 1.f, .0f };
+
+    /* Estimate the cosine weighted solid angle with both sampling strategies */
+    const size_t count = 100000;
+    double solidAngle = 0, area = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Interaction it = triangle->sample(ref, { rng->f32(), rng->f32() });
+        v3f wi = Normalize(it.p - ref.p);
+        float pdf = triangle->pdf(ref, it);
+        if (it.p.y != Approx(1.f)
+            || pdf != Approx(triangle->pdf(ref, wi)).epsilon(1e-3)) {
+            ++n;
+        }
+        solidAngle += wi.y / pdf;
+
+        it = triangle->sample({ rng->f32(), rng->f32() });
+        wi = Normalize(it.p - ref.p);
+        area += wi.y * AbsDot(it.n, wi) * triangle->area() / DistanceSquared(ref.p, it.p);
+    }
+    REQUIRE(n == 0);
+    CHECK(solidAngle / count == Approx(area / count).epsilon(1e-2));
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "catch.hpp"
+
+#include "rt1w/accelerator.hpp"
+#include "rt1w/context.hpp"
+#include "rt1w/event.hpp"
+#include "rt1w/integrator.hpp"
+#include "rt1w/sampler.hpp"
+#include "rt1w/scene.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+/* A ball on the ground, lit by a small spherical light */
+static const char *SceneJSON = R"({
+    "shapes": [
+        { "name": "ball", "type": "sphere", "radius": 1 },
+        { "name": "ground", "type": "sphere", "radius": 100,
+          "transform": { "translate": [ 0, -101, 0 ] } },
+        { "name": "sun", "type": "sphere", "radius": 0.5,
+          "transform": { "translate": [ 2, 3, 1 ] } }
+    ],
+    "materials": [
+        { "name": "grey", "type": "matte",
+          "Kd": { "type": "constant", "color": [ 0.5, 0.5, 0.5 ] } },
+        { "name": "red", "type": "matte",
+          "Kd": { "type": "constant", "color": [ 0.8, 0.1, 0.1 ] } }
+    ],
+    "primitives": [
+        { "shape": "ball", "material": "red" },
+        { "shape": "ground", "material": "grey" }
+    ],
+    "lights": [
+        { "type": "area", "shape": "sun", "emit": [ 10, 10, 10 ] }
+    ],
+    "camera": {
+        "type": "perspective",
+        "position": [ 0, 0, 6 ],
+        "lookat": [ 0, 0, 0 ],
+        "up": [ 0, 1, 0 ],
+        "resolution": [ 40, 30 ],
+        "fov": 40
+    },
+    "options": { "integrator": "path" }
+})";
+
+/* Path of a temporary copy of the scene */
+inline std::string WriteScene()
+{
+    char file[] = "/tmp/rt1w-scene-XXXXXX";
+    int fd = mkstemp(file);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, SceneJSON, strlen(SceneJSON)) == (ssize_t)strlen(SceneJSON));
+    close(fd);
+    return file;
+}
+
+inline sptr<Render> CreateRender(const std::string &file,
+                                 uint32_t quality,
+                                 uint32_t aovs,
+                                 const std::string &integrator = "path")
+{
+    sptr<RenderDescription> desc = RenderDescription::load(file);
+    if (!desc) {
+        return nullptr;
+    }
+    sptr<Primitive> accel = Accelerator::create("bvh", desc->primitives());
+    sptr<Scene> scene = Scene::create(accel, desc->lights());
+    desc->schedule()->wait();
+    sptr<Sampler> sampler = Sampler::create(quality, quality, 4, true);
+    sptr<Render> render =
+        Render::create(scene, desc->camera(), Integrator::create(integrator, sampler, 4));
+    render->setTiles(8, TileOrder::Center);
+    render->setAOVs(aovs, desc->primitives());
+    return render;
+}
+
+inline bool Equal(const buffer_t &a, const buffer_t &b)
+{
+    size_t size = a.rect.size.x * a.format.size;
+    for (uint32_t y = 0; y < a.rect.size.y; ++y) {
+        if (memcmp((uint8_t *)a.data + y * a.bpr, (uint8_t *)b.data + y * b.bpr, size)) {
+            return false;
+        }
+    }
+    return true;
+}
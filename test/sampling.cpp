@@ -58,3 +58,37 @@ TEST_CASE("Triangle Sampling")
     }
     CHECK(n == 0);
 }
+
+TEST_CASE("Cone Sampling")
+{
+    size_t n = 0;
+    for (size_t i = 0; i < 10000; ++i) {
+        float cosThetaMax = randomSample().x;
+        v3f w = UniformSampleCone(randomSample(), cosThetaMax);
+        float r = w.x * w.x + w.y * w.y + w.z * w.z;
+        if (r != Approx(1.0f) || (w.z < cosThetaMax && w.z != Approx(cosThetaMax))) {
+            ++n;
+        }
+    }
+    CHECK(n == 0);
+}
+
+TEST_CASE("Spherical Triangle Sampling")
+{
+    /* One octant of the unit sphere */
+    const v3f v[3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    const v3f p = { 0, 0, 0 };
+
+    CHECK(SphericalTriangleArea(v[0], v[1], v[2]) == Approx(Pi / 2));
+
+    size_t n = 0;
+    for (size_t i = 0; i < 10000; ++i) {
+        float pdf;
+        v3f b = SampleSphericalTriangle(v, p, randomSample(), pdf);
+        if (pdf != Approx(2 / Pi) || std::min({ b.x, b.y, b.z }) < -1e-6f
+            || b.x + b.y + b.z != Approx(1.0f)) {
+            ++n;
+        }
+    }
+    CHECK(n == 0);
+}
@@ -0,0 +1,59 @@
+#include "render.hpp"
+
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+#include "rt1w/imageio.h"
+#include "rt1w/primitive.hpp"
+
+#include <fstream>
+#include <vector>
+
+TEST_CASE("Scene loading", "[scene]")
+{
+    std::string file = WriteScene();
+    std::string png = file + ".png";
+    std::vector<uint8_t> pixels(4 * 2 * 3, 128);
+    REQUIRE(image_write_png(png.c_str(), 4, 2, pixels.data(), 4 * 3) == 0);
+
+    /* The image is decoded when scheduled, or by the first reader */
+    sptr<Image> img = Image::create(png);
+    CHECK(img->schedule()->wait() == 0);
+    CHECK(img->size().x == 4);
+    CHECK(img->size().y == 2);
+    CHECK(Image::create(png)->size().y == 2);
+
+    /* A textured quad added before the ball, whose primitive waits for its shape,
+     * and a primitive of a missing shape */
+    std::string scene(SceneJSON);
+    scene.replace(scene.find("\"shapes\": ["), strlen("\"shapes\": ["), R"(
+    "textures": [ { "name": "map", "type": "image", "file": ")" + png + R"(" } ],
+    "shapes": [
+        { "name": "quad", "type": "mesh", "count": 2,
+          "vertices": [ [ -1, 0, -1 ], [ -1, 0, 1 ], [ 1, 0, 1 ], [ 1, 0, -1 ] ],
+          "indices": [ 0, 1, 2, 0, 2, 3 ] },)");
+    scene.replace(scene.find("\"materials\": ["), strlen("\"materials\": ["), R"(
+    "materials": [
+        { "name": "mapped", "type": "matte", "Kd": "map" },)");
+    scene.replace(scene.find("\"primitives\": ["), strlen("\"primitives\": ["), R"(
+    "primitives": [
+        { "shape": "quad", "material": "mapped" },
+        { "shape": "missing", "material": "grey" },)");
+    std::ofstream(file) << scene;
+
+    sptr<RenderDescription> desc = RenderDescription::load(file);
+    REQUIRE(desc);
+    CHECK(desc->schedule()->wait() == 0);
+
+    /* In the order of the file, the faces of the quad, the ball, the ground, then
+     * the light */
+    const std::vector<sptr<Primitive>> &prims = desc->primitives();
+    REQUIRE(prims.size() == 5);
+    CHECK(prims[0]->bounds().hi.y == Approx(0));
+    CHECK(prims[1]->bounds().lo.x == Approx(-1));
+    CHECK(prims[2]->bounds().hi.x == Approx(1));
+    CHECK(prims[3]->bounds().hi.x == Approx(100));
+    CHECK(prims[4]->light());
+
+    unlink(png.c_str());
+    unlink(file.c_str());
+}
@@ -0,0 +1,59 @@
+#include "catch.hpp"
+
+#include "rt1w/arena.hpp"
+#include "rt1w/sampler.hpp"
+#include "rt1w/scratch.hpp"
+
+#include <thread>
+#include <vector>
+
+static std::vector<float> PixelSamples(const sptr<Sampler> &sampler, v2i p)
+{
+    std::vector<float> samples;
+    sampler->startPixel(p);
+    do {
+        CameraSample cs = sampler->cameraSample();
+        samples.push_back(cs.pFilm.x);
+        samples.push_back(sampler->sample1D());
+    } while (sampler->startNextSample());
+    return samples;
+}
+
+TEST_CASE("Thread scratch", "[scratch]")
+{
+    sptr<const Sampler> prototype = Sampler::create(2, 2, 4, true);
+    Scratch &scratch = Scratch::get();
+    CHECK(&scratch == &Scratch::get());
+
+    /* Reseeded in place, with the same samples as a clone */
+    ScratchStats before = Scratch::stats();
+    sptr<Sampler> first = scratch.sampler(prototype, 3);
+    CHECK(PixelSamples(first, { 1, 2 }) == PixelSamples(prototype->clone(3), { 1, 2 }));
+    CHECK(scratch.sampler(prototype, 5) == first);
+    CHECK(PixelSamples(first, { 1, 2 }) == PixelSamples(prototype->clone(5), { 1, 2 }));
+    CHECK(Scratch::stats().samplers == before.samplers + 1);
+
+    /* Another prototype replaces it */
+    sptr<const Sampler> other = Sampler::create(1, 1, 2, false);
+    CHECK(scratch.sampler(other, 5)->samplesPerPixel() == 1);
+    CHECK(Scratch::stats().samplers == before.samplers + 2);
+
+    /* Each thread has its own, counted after it exits */
+    Scratch *elsewhere = nullptr;
+    std::thread([&]() {
+        elsewhere = &Scratch::get();
+        elsewhere->count(2, 100);
+    }).join();
+    CHECK(elsewhere != &scratch);
+    scratch.count(1, 10);
+    CHECK(Scratch::stats().tiles == before.tiles + 3);
+    CHECK(Scratch::stats().samples == before.samples + 110);
+
+    /* The arena starts over at the beginning of its block */
+    Arena &arena = scratch.arena();
+    arena.reset();
+    void *p = arena.alloc(64);
+    arena.alloc(1024);
+    arena.reset();
+    CHECK(arena.alloc(16) == p);
+}
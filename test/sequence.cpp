@@ -0,0 +1,42 @@
+#include "render.hpp"
+
+#include "rt1w/camera.hpp"
+
+#include <fstream>
+
+TEST_CASE("Camera sequence", "[sequence]")
+{
+    /* Two keyframes moving the camera to the right, spread over three frames */
+    std::string scene(SceneJSON);
+    std::string sequence = R"("sequence": {
+        "frames": 3,
+        "cameras": [ { "position": [ 0, 0, 6 ] },
+                     { "position": [ 2, 0, 6 ], "fov": 60 } ]
+    },
+    "camera")";
+    scene.replace(scene.find("\"camera\""), strlen("\"camera\""), sequence);
+
+    std::string file = WriteScene();
+    std::ofstream(file) << scene;
+    sptr<RenderDescription> desc = RenderDescription::load(file);
+    REQUIRE(desc);
+
+    const std::vector<sptr<Camera>> &cameras = desc->cameras();
+    REQUIRE(cameras.size() == 3);
+    CHECK(cameras[0]->position().x == Approx(0));
+    CHECK(cameras[1]->position().x == Approx(1));
+    CHECK(cameras[2]->position().x == Approx(2));
+    for (const auto &camera : cameras) {
+        CHECK(camera->position().z == Approx(6));
+        CHECK(camera->resolution().x == 40);
+        CHECK(camera->resolution().y == 30);
+    }
+
+    /* Without one, a scene has no frames */
+    std::ofstream(file) << SceneJSON;
+    desc = RenderDescription::load(file);
+    REQUIRE(desc);
+    CHECK(desc->cameras().empty());
+
+    unlink(file.c_str());
+}
@@ -0,0 +1,109 @@
+#include "render.hpp"
+
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+#include "rt1w/server.hpp"
+
+#include <thread>
+
+static sptr<RenderServer> CreateServer(const sptr<RenderDescription> &desc)
+{
+    auto create = [](const sptr<RenderDescription> &d, const sptr<Scene> &scene) {
+        sptr<Sampler> sampler = Sampler::create(1, 1, 4, true);
+        sptr<Integrator> integrator = Integrator::create("path", sampler, 4);
+        sptr<Render> render = Render::create(scene, d->camera(), integrator);
+        render->setTiles(8, TileOrder::Center);
+        return render;
+    };
+    return RenderServer::create(desc, create);
+}
+
+static v3f Pixel(const sptr<Render> &render, uint32_t x, uint32_t y)
+{
+    buffer_t b = render->image()->buffer();
+    return *(const v3f *)((const uint8_t *)b.data + y * b.bpr + x * b.format.size);
+}
+
+TEST_CASE("Render server", "[server]")
+{
+    std::string file = WriteScene();
+    sptr<RenderDescription> desc = RenderDescription::load(file);
+    REQUIRE(desc);
+    sptr<RenderServer> server = CreateServer(desc);
+
+    CHECK(server->execute("render 2") == "ok 2");
+    CHECK(server->execute("render") == "ok 3");
+    sptr<Scene> scene = server->scene();
+    v3f red = Pixel(server->render(), 20, 15);
+    CHECK(red.x > red.z);
+
+    /* Camera and materials don't touch the scene, and restart the render */
+    CHECK(server->execute(R"(camera { "type": "perspective", "position": [ 0, 0, 8 ],
+        "lookat": [ 0, 0, 0 ], "up": [ 0, 1, 0 ], "resolution": [ 20, 16 ], "fov": 40 })")
+          == "ok");
+    CHECK(server->execute(R"(material { "name": "red", "type": "matte",
+        "Kd": { "type": "constant", "color": [ 0.1, 0.1, 0.8 ] } })")
+          == "ok");
+    CHECK(server->execute("render") == "ok 1");
+    CHECK(server->scene() == scene);
+    CHECK(server->render()->image()->size().x == 20);
+    CHECK(server->render()->image()->size().y == 16);
+    v3f blue = Pixel(server->render(), 10, 8);
+    CHECK(blue.z > blue.x);
+
+    /* Invalid edits are rejected */
+    CHECK(server->execute(R"(material { "name": "green", "type": "matte" })")
+              .compare(0, 5, "error")
+          == 0);
+    CHECK(server->execute("camera {").compare(0, 5, "error") == 0);
+    CHECK(server->execute("render 0").compare(0, 5, "error") == 0);
+    CHECK(server->execute("frobnicate").compare(0, 5, "error") == 0);
+    CHECK(server->scene() == scene);
+
+    /* Without the area light, its primitive is gone */
+    CHECK(server->execute(R"(lights [ { "type": "point", "position": [ 2, 3, 1 ],
+        "emit": [ 20, 20, 20 ] } ])")
+          == "ok");
+    CHECK(desc->primitives().size() == 2);
+    CHECK(desc->lights().size() == 1);
+    CHECK(server->scene() != scene);
+    CHECK(server->execute("render") == "ok 1");
+
+    std::string png = std::string(file).append(".png");
+    CHECK(server->execute("write " + png) == "ok");
+    CHECK(access(png.c_str(), F_OK) == 0);
+    unlink(png.c_str());
+
+    CHECK(server->execute("quit") == "ok");
+    CHECK(server->done());
+
+    unlink(file.c_str());
+}
+
+TEST_CASE("Render server commands", "[server]")
+{
+    std::string file = WriteScene();
+    sptr<RenderDescription> desc = RenderDescription::load(file);
+    REQUIRE(desc);
+    sptr<RenderServer> server = CreateServer(desc);
+
+    int in[2];
+    int out[2];
+    REQUIRE(pipe(in) == 0);
+    REQUIRE(pipe(out) == 0);
+
+    const char *commands = "render 2\r\n\nunknown\nquit\nrender\n";
+    REQUIRE(write(in[1], commands, strlen(commands)) == (ssize_t)strlen(commands));
+    close(in[1]);
+    Serve(server, in[0], out[1]);
+    close(out[1]);
+
+    char replies[256] = {};
+    ssize_t n = read(out[0], replies, sizeof(replies) - 1);
+    CHECK(n > 0);
+    CHECK(std::string(replies) == "ok 2\nerror unknown command unknown\nok\n");
+
+    close(in[0]);
+    close(out[0]);
+    unlink(file.c_str());
+}
@@ -0,0 +1,53 @@
+#include "render.hpp"
+
+#include "rt1w/aov.hpp"
+#include "rt1w/event.hpp"
+#include "rt1w/image.hpp"
+
+static double Mean(const buffer_t &b)
+{
+    double sum = .0;
+    for (uint32_t y = 0; y < b.rect.size.y; ++y) {
+        const auto *row = (const float *)((const uint8_t *)b.data + y * b.bpr);
+        for (uint32_t x = 0; x < b.rect.size.x * 3; ++x) {
+            sum += row[x];
+        }
+    }
+    return sum / (b.rect.size.x * b.rect.size.y * 3);
+}
+
+TEST_CASE("Wavefront integrator", "[wavefront]")
+{
+    std::string file = WriteScene();
+    const uint32_t aovs = AOV_NORMALS | AOV_DEPTH | AOV_PRIMITIVE_ID;
+    const uint32_t passes = 8;
+
+    sptr<Render> path = CreateRender(file, 2, aovs);
+    sptr<Render> wavefront = CreateRender(file, 2, aovs, "wavefront");
+    REQUIRE(path);
+    REQUIRE(wavefront);
+    for (uint32_t i = 0; i < passes; ++i) {
+        path->schedulePass()->wait();
+        wavefront->schedulePass()->wait();
+    }
+    CHECK(wavefront->samples() == path->samples());
+
+    /* Same camera rays */
+    CHECK(Equal(wavefront->normals()->buffer(), path->normals()->buffer()));
+    CHECK(Equal(wavefront->depth()->buffer(), path->depth()->buffer()));
+    CHECK(Equal(wavefront->primitiveIDs()->buffer(), path->primitiveIDs()->buffer()));
+
+    /* Different estimators of the same image */
+    CHECK(Mean(wavefront->image()->buffer())
+          == Approx(Mean(path->image()->buffer())).epsilon(.03));
+
+    /* The paths don't depend on the tiles they're traced with */
+    sptr<Render> tiled = CreateRender(file, 2, aovs, "wavefront");
+    tiled->setTiles(16, TileOrder::Hilbert);
+    for (uint32_t i = 0; i < passes; ++i) {
+        tiled->schedulePass()->wait();
+    }
+    CHECK(Equal(tiled->image()->buffer(), wavefront->image()->buffer()));
+
+    unlink(file.c_str());
+}
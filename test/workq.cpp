@@ -0,0 +1,307 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+#include "catch.hpp"
+
+#include "rt1w/event.hpp"
+#include "rt1w/parallel.hpp"
+#include "rt1w/workq.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Counter : Object {
+    workq *queue = nullptr;
+    std::atomic<uint64_t> count{ 0 };
+    sptr<Event> done;
+};
+
+static void Count(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto c = std::static_pointer_cast<Counter>(obj);
+    c->count.fetch_add(1);
+    c->done->signal();
+}
+
+/* Splits its range in two jobs, submitted from the worker, down to single indices */
+static void Split(const sptr<Object> &obj, const sptr<Object> &arg)
+{
+    auto c = std::static_pointer_cast<Counter>(obj);
+    auto r = std::static_pointer_cast<WorkRange>(arg);
+    if (r->end - r->begin == 1) {
+        c->count.fetch_add(1);
+        c->done->signal();
+        return;
+    }
+    size_t mid = (r->begin + r->end) / 2;
+    workq_execute(c->queue, Split, c, std::make_shared<WorkRange>(r->begin, mid));
+    workq_execute(c->queue, Split, c, std::make_shared<WorkRange>(mid, r->end));
+}
+
+static uint64_t RunSplit(workq *queue, size_t count)
+{
+    auto c = std::make_shared<Counter>();
+    c->queue = queue;
+    c->done = Event::create((int32_t)count);
+    workq_execute(queue, Split, c, std::make_shared<WorkRange>(0, count));
+    c->done->wait();
+    return c->count.load();
+}
+
+struct Indices : Object {
+    std::vector<std::atomic<uint32_t>> seen;
+};
+
+static void See(const sptr<Object> &obj, size_t i)
+{
+    std::static_pointer_cast<Indices>(obj)->seen[i].fetch_add(1);
+}
+
+static void Nothing(const sptr<Object> &, size_t) {}
+
+static uint64_t RunInjected(workq *queue, size_t count)
+{
+    auto c = std::make_shared<Counter>();
+    c->done = Event::create((int32_t)count);
+    for (size_t i = 0; i < count; ++i) {
+        workq_execute(queue, Count, c, {});
+    }
+    c->done->wait();
+    return c->count.load();
+}
+
+TEST_CASE("Work queue setup", "[workq]")
+{
+    workq *queue = workq_get_queue();
+    REQUIRE(queue);
+    CHECK(workq_concurrency(queue) >= 1);
+    CHECK(workq_busy_times(queue).size() == workq_concurrency(queue));
+    CHECK(workq_numa_nodes() >= 1);
+
+    /* Too late once the threads run */
+    workq_config config;
+    config.threads = 1;
+    CHECK_FALSE(workq_configure(config));
+
+    config.cpus = "0-";
+    CHECK_FALSE(workq_create(config));
+}
+
+TEST_CASE("Work stealing", "[workq]")
+{
+    workq_config config;
+    config.threads = 4;
+    workq *queue = workq_create(config);
+    REQUIRE(queue);
+    CHECK(workq_concurrency(queue) == 4);
+
+    /* Jobs submitted from the workers, and from several threads at once */
+    CHECK(RunSplit(queue, 10000) == 10000);
+
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> total{ 0 };
+    for (size_t i = 0; i < 4; ++i) {
+        threads.emplace_back([&]() { total += RunInjected(queue, 5000); });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    CHECK(total == 20000);
+
+    /* Ranges split from a job */
+    auto c = std::make_shared<Counter>();
+    c->done = Event::create(143);
+    workq_execute_ranges(queue, 1000, 7, Count, c)->wait();
+    CHECK(c->count == 143);
+
+    /* Indices, from another thread and from a job */
+    auto indices = std::make_shared<Indices>();
+    indices->seen = std::vector<std::atomic<uint32_t>>(10000);
+    workq_execute_n(queue, 10000, See, indices)->wait();
+    workq_execute_n(nullptr, 10000, See, indices)->wait();
+    CHECK(std::all_of(indices->seen.begin(), indices->seen.end(), [](const auto &n) {
+        return n == 2;
+    }));
+    CHECK(workq_execute_n(queue, 0, See, indices)->test());
+
+    workq_destroy(queue);
+}
+
+/* Sums the indices covered by a parallel_for() ran from a job */
+static void SumFromJob(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto c = std::static_pointer_cast<Counter>(obj);
+    parallel_for(1000, 10, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            c->count.fetch_add(i);
+        }
+    });
+    c->done->signal();
+}
+
+TEST_CASE("Parallel loops", "[workq]")
+{
+    std::vector<std::atomic<uint32_t>> seen(10007);
+    std::atomic<size_t> largest{ 0 };
+    parallel_for(seen.size(), 64, [&](size_t begin, size_t end) {
+        size_t n = end - begin;
+        for (size_t l = largest; n > l && !largest.compare_exchange_weak(l, n);) {}
+        for (size_t i = begin; i < end; ++i) {
+            seen[i].fetch_add(1);
+        }
+    });
+    CHECK(std::all_of(seen.begin(), seen.end(), [](const auto &n) { return n == 1; }));
+    CHECK(largest == 64);
+
+    /* Not commutative, only right if reduced in the order of the ranges */
+    auto ranges = parallel_reduce(
+        10007,
+        64,
+        std::vector<size_t>(),
+        [](size_t begin, size_t) { return std::vector<size_t>{ begin }; },
+        [](std::vector<size_t> a, const std::vector<size_t> &b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        });
+    REQUIRE(ranges.size() == 157);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        CHECK(ranges[i] == i * 64);
+    }
+    auto sum = [](size_t a, size_t b) { return a + b; };
+    CHECK(parallel_reduce(0, 64, (size_t)3, [](size_t, size_t) { return 1; }, sum) == 3);
+
+    /* The job takes part in its own loop rather than waiting on the workers */
+    auto c = std::make_shared<Counter>();
+    c->done = Event::create(4);
+    for (size_t i = 0; i < 4; ++i) {
+        workq_execute(workq_get_queue(), SumFromJob, c, {});
+    }
+    c->done->wait();
+    CHECK(c->count == 4 * 999 * 1000 / 2);
+}
+
+/* Jobs in the order they were executed, with their priority */
+struct Trace : Object {
+    sptr<Event> blocked = Event::create(1);
+    sptr<Event> gate = Event::create(1);
+    std::mutex lock;
+    std::vector<size_t> jobs;
+    std::vector<workq_priority> priorities;
+    std::atomic<uint32_t> cancelled{ 0 };
+};
+
+/* Keeps the thread busy until the gate opens */
+static void Block(const sptr<Object> &obj, const sptr<Object> &)
+{
+    auto t = std::static_pointer_cast<Trace>(obj);
+    t->blocked->signal();
+    t->gate->wait();
+}
+
+static void Record(const sptr<Object> &obj, const sptr<Object> &arg)
+{
+    auto t = std::static_pointer_cast<Trace>(obj);
+    std::lock_guard<std::mutex> lock(t->lock);
+    t->jobs.push_back(std::static_pointer_cast<WorkRange>(arg)->begin);
+    t->priorities.push_back(workq_get_context().priority);
+}
+
+static void RecordCancelled(const sptr<Object> &obj, const sptr<Object> &)
+{
+    if (workq_cancelled()) {
+        std::static_pointer_cast<Trace>(obj)->cancelled.fetch_add(1);
+    }
+}
+
+/* Submits a job recorded as i in the given context */
+static sptr<Event> Submit(workq *queue,
+                          const sptr<Trace> &t,
+                          size_t i,
+                          const workq_context &context)
+{
+    workq_context previous = workq_set_context(context);
+    sptr<Event> e = workq_execute(queue, Record, t, std::make_shared<WorkRange>(i, i));
+    workq_set_context(previous);
+    return e;
+}
+
+TEST_CASE("Priorities and cancellation", "[workq]")
+{
+    workq_config config;
+    config.threads = 1;
+    workq *queue = workq_create(config);
+    REQUIRE(queue);
+
+    workq_context batch;
+    workq_context interactive;
+    interactive.priority = WORKQ_PRIORITY_INTERACTIVE;
+
+    /* Queued behind a job, the interactive ones go first */
+    auto t = std::make_shared<Trace>();
+    workq_execute(queue, Block, t, {});
+    t->blocked->wait();
+    std::vector<sptr<Event>> events;
+    for (size_t i = 0; i < 4; ++i) {
+        events.push_back(Submit(queue, t, i, i < 2 ? batch : interactive));
+    }
+    CHECK(workq_get_context().priority == WORKQ_PRIORITY_BATCH);
+    t->gate->signal();
+    Event::create(events)->wait();
+    CHECK(t->jobs == std::vector<size_t>{ 2, 3, 0, 1 });
+    CHECK(t->priorities[0] == WORKQ_PRIORITY_INTERACTIVE);
+    CHECK(t->priorities[3] == WORKQ_PRIORITY_BATCH);
+
+    /* Cancelled before they start, the jobs and their queued continuations are
+     * skipped, the inline ones run knowing it */
+    t = std::make_shared<Trace>();
+    workq_execute(queue, Block, t, {});
+    t->blocked->wait();
+    workq_context preview = interactive;
+    preview.token = std::make_shared<CancelToken>();
+    sptr<Event> skipped = Submit(queue, t, 0, preview);
+    sptr<Event> kept = Submit(queue, t, 1, batch);
+
+    workq_context previous = workq_set_context(preview);
+    auto cascaded = skipped->notify(queue, Record, t, std::make_shared<WorkRange>(2, 2));
+    auto inlined = cascaded->notify(nullptr, RecordCancelled, t, {});
+    CHECK_FALSE(workq_cancelled());
+    preview.token->cancel();
+    CHECK(workq_cancelled());
+    workq_set_context(previous);
+    CHECK_FALSE(workq_cancelled());
+
+    t->gate->signal();
+    Event::create({ skipped, kept, cascaded, inlined })->wait();
+    CHECK(t->jobs == std::vector<size_t>{ 1 });
+    CHECK(t->cancelled == 1);
+
+    workq_destroy(queue);
+}
+
+TEST_CASE("Work queue throughput", "[.benchmark]")
+{
+    uint32_t max = std::max(std::thread::hardware_concurrency(), 2u);
+    for (uint32_t threads = 1; threads <= max; threads *= 2) {
+        workq_config config;
+        config.threads = threads;
+        workq *queue = workq_create(config);
+
+        std::string n = std::to_string(threads);
+        BENCHMARK("10000 jobs from another thread, " + n + " threads")
+        {
+            return RunInjected(queue, 10000);
+        };
+        BENCHMARK("10000 jobs split by the workers, " + n + " threads")
+        {
+            return RunSplit(queue, 10000);
+        };
+        BENCHMARK("10000 indices, " + n + " threads")
+        {
+            return workq_execute_n(queue, 10000, Nothing, nullptr)->wait();
+        };
+
+        workq_destroy(queue);
+    }
+}